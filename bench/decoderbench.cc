@@ -0,0 +1,424 @@
+#include "R3BAlpideDecoder.h"
+#include "R3BParallelDecoder.h"
+#include "R3BPixHit.h"
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/* >> Throughput of R3BAlpideDecoder on synthetic ALPIDE streams.
+ * "legacy walk" is the former if/else FindDataType() + GetWordLength() pair,
+ * "table walk" is the kWordTable lookup now used by DecodeEvent(). Both only
+ * walk the words. "old decode" is the former DecodeEvent() as a whole,
+ * a vector of R3BPixHit per event, "DecodeEvent" the decoder now, both on the
+ * same buffers and checked for the same hits. */
+
+using namespace std;
+
+#define timeNow() std::chrono::high_resolution_clock::now()
+
+constexpr int N_EVENTS = 4096;
+constexpr int N_REPEAT = 20;
+
+/* One chip event: header, a few regions with DATASHORT/DATALONG words, trailer, IDLE padding.
+ * With fillerRuns set, long IDLE/BUSY runs are also put between the words. */
+static vector<unsigned char> MakeEvent(std::mt19937& rng, int chipId, bool fillerRuns = false) {
+	vector<unsigned char> ev;
+	ev.push_back(0xa0 | chipId);
+	ev.push_back(0x00);
+	std::uniform_int_distribution<int> nHits(0, 12), enc(0, 15), addr(0, 1000), map(0, 0x7f), idle(0, 32), run(0, 400);
+	auto pushFiller = [&]() {
+		if(!fillerRuns) return;
+		for(int i=run(rng); i>0; --i) ev.push_back(0xff);
+		ev.push_back(0xf1);
+		for(int i=run(rng)/8; i>0; --i) ev.push_back(0xff);
+		ev.push_back(0xf0);
+	};
+	for(int region=0; region<32; region+=4) {
+		pushFiller();
+		ev.push_back(0xc0 | region);
+		int n = nHits(rng);
+		int a = addr(rng) % 16; // sorted addresses in one double column
+		int e = enc(rng);
+		for(int i=0; i<n; ++i, a += 8) {
+			if(i & 1) { // DATALONG
+				ev.push_back(0x00 | (e << 2) | (a >> 8));
+				ev.push_back(a & 0xff);
+				ev.push_back(map(rng));
+			}
+			else {      // DATASHORT
+				ev.push_back(0x40 | (e << 2) | (a >> 8));
+				ev.push_back(a & 0xff);
+			}
+		}
+	}
+	pushFiller();
+	ev.push_back(0xb0);
+	for(int i=idle(rng); i>0; --i) ev.push_back(0xff);
+	return ev;
+}
+
+struct LegacyWalker {
+	AlpideDataType fDataType;
+	void FindDataType(unsigned char dataWord) {
+		if     (dataWord == 0xff)          fDataType = AlpideDataType::kIDLE;
+		else if(dataWord == 0xf1)          fDataType = AlpideDataType::kBUSYON;
+		else if(dataWord == 0xf0)          fDataType = AlpideDataType::kBUSYOFF;
+		else if((dataWord & 0xf0) == 0xa0) fDataType = AlpideDataType::kCHIPHEADER;
+		else if((dataWord & 0xf0) == 0xb0) fDataType = AlpideDataType::kCHIPTRAILER;
+		else if((dataWord & 0xf0) == 0xe0) fDataType = AlpideDataType::kEMPTYFRAME;
+		else if((dataWord & 0xe0) == 0xc0) fDataType = AlpideDataType::kREGIONHEADER;
+		else if((dataWord & 0xc0) == 0x40) fDataType = AlpideDataType::kDATASHORT;
+		else if((dataWord & 0xc0) == 0x00) fDataType = AlpideDataType::kDATALONG;
+		else fDataType = AlpideDataType::kUNKNOWN;
+	}
+	int GetWordLength() const {
+		if(fDataType == AlpideDataType::kDATALONG) return 3;
+		else if((fDataType == AlpideDataType::kDATASHORT) ||
+				(fDataType == AlpideDataType::kCHIPHEADER) || 
+				(fDataType == AlpideDataType::kEMPTYFRAME))
+			return 2;
+		else return 1;
+	}
+	/* classify, dispatch on the type, then re-branch for the length */
+	long Walk(const unsigned char* data, int nBytes) {
+		long sum = 0;
+		for(int byte=0; byte<nBytes; ) {
+			FindDataType(data[byte]);
+			switch(fDataType) {
+				case AlpideDataType::kDATALONG:     sum += data[byte+2]; break;
+				case AlpideDataType::kDATASHORT:    sum += data[byte+1]; break;
+				case AlpideDataType::kREGIONHEADER: sum += data[byte] & 0x1f; break;
+				case AlpideDataType::kCHIPHEADER:   sum += data[byte] & 0xf; break;
+				default: break;
+			}
+			byte += GetWordLength();
+		}
+		return sum;
+	}
+};
+
+/* The former R3BAlpideDecoder::DecodeEvent() and its word decoders, the messages
+ * left out: the synthetic events never trigger them. Its hits went into the
+ * vector through R3BPixHit's copy constructor, which resets the double column,
+ * address and flag, so only the number of hits and their chip and region can
+ * be compared with the decoder now. */
+struct BaselineDecoder {
+	bool fNewEvent = false;
+	uint32_t fChipId = UINT_MAX;
+	uint32_t fRegion = 32;
+	uint32_t fFlags = 0;
+	uint32_t thi = UINT_MAX;
+	uint32_t tlo = UINT_MAX;
+	LegacyWalker fWalker;
+	vector<R3BPixHit> fHits;
+
+	BaselineDecoder() {fHits.reserve(2048);}
+
+	/* the duplicate and address order checks against the previous hit */
+	void Check(R3BPixHit& hit) {
+		if((fHits.size() > 0) && !fNewEvent) {
+			if((hit.GetRegion() == fHits.back().GetRegion())
+					&& (hit.GetDoubleColumn() == fHits.back().GetDoubleColumn())
+					&& (hit.GetAddress() <= fHits.back().GetAddress())) {
+				hit.SetPixFlag(AlpidePixFlag::kSTUCK);
+				fHits.back().SetPixFlag(AlpidePixFlag::kSTUCK);
+			}
+		}
+		if(hit.GetPixFlag() == AlpidePixFlag::kUNKNOWN) hit.SetPixFlag(AlpidePixFlag::kOK);
+	}
+	bool DecodeDataShort(const unsigned char* data) {
+		R3BPixHit hit;
+		hit.SetTriggerTime(thi, tlo);
+		uint16_t data_field = (((uint16_t) data[0]) << 8) | (uint16_t)data[1];
+		hit.SetChipId(fChipId);
+		hit.SetRegion(fRegion);
+		hit.SetDoubleColumn((data_field & 0x3c00) >> 10);
+		hit.SetAddress(data_field & 0x03ff);
+		Check(hit);
+		const bool corrupt = hit.IsPixHitCorrupted();
+		fHits.emplace_back(std::move(hit));
+		return corrupt;
+	}
+	bool DecodeDataLong(const unsigned char* data) {
+		R3BPixHit hit;
+		hit.SetTriggerTime(thi, tlo);
+		uint16_t data_field = (((uint16_t) data[0]) << 8) | (uint16_t)data[1];
+		bool corrupt = false;
+		hit.SetChipId(fChipId);
+		hit.SetRegion(fRegion);
+		hit.SetDoubleColumn((data_field & 0x3c00) >> 10);
+		uint32_t address = (data_field & 0x03ff);
+		for(int i=-1; i<7; ++i) {
+			if((i >= 0) && (!((data[2] >> i) & 0x1))) continue;
+			R3BPixHit singleHit(hit);
+			singleHit.SetAddress(address + (i + 1));
+			Check(singleHit);
+			corrupt = corrupt | singleHit.IsPixHitCorrupted();
+			fHits.emplace_back(std::move(singleHit));
+		}
+		fNewEvent = false;
+		return corrupt;
+	}
+	bool DecodeEvent(const unsigned char* data, int nBytes) {
+		fHits.clear(); // the scan cleared them after each event
+		fFlags = 0;
+		fChipId = -1;
+		fRegion = 32;
+		bool started = false, finished = false, corrupt = false;
+		int byte = 0;
+		while(byte < nBytes) {
+			fWalker.FindDataType(data[byte]);
+			switch(fWalker.fDataType) {
+				case AlpideDataType::kEMPTYFRAME:
+					started = true;
+					fChipId = data[byte] & 0xf;
+					finished = true;
+					break;
+				case AlpideDataType::kCHIPHEADER:
+					started = true;
+					finished = false;
+					fChipId = data[byte] & 0xf;
+					fNewEvent = true;
+					break;
+				case AlpideDataType::kCHIPTRAILER:
+					if(!started || finished) return false;
+					fFlags = data[byte] & 0xf;
+					finished = true;
+					fChipId = -1;
+					break;
+				case AlpideDataType::kREGIONHEADER:
+					if(!started) return false;
+					fRegion = data[byte] & 0x1f;
+					fNewEvent = false;
+					break;
+				case AlpideDataType::kDATASHORT:
+					if(!started) return false;
+					corrupt = DecodeDataShort(data + byte);
+					break;
+				case AlpideDataType::kDATALONG:
+					if(!started) return false;
+					corrupt = DecodeDataLong(data + byte);
+					break;
+				case AlpideDataType::kUNKNOWN:
+					return false;
+				default:
+					break;
+			}
+			byte += fWalker.GetWordLength();
+		}
+		return started && finished && !corrupt;
+	}
+};
+
+/* one table lookup gives the dispatch key, each case then advances by its own word length */
+static long TableWalk(const unsigned char* data, int nBytes) {
+	long sum = 0;
+	for(int byte=0; byte<nBytes; ) {
+		switch(R3BAlpideDecoder::GetWord(data[byte]).type) {
+			case AlpideDataType::kDATALONG:     sum += data[byte+2]; byte += 3; break;
+			case AlpideDataType::kDATASHORT:    sum += data[byte+1]; byte += 2; break;
+			case AlpideDataType::kREGIONHEADER: sum += data[byte] & 0x1f; byte += 1; break;
+			case AlpideDataType::kCHIPHEADER:   sum += data[byte] & 0xf; byte += 2; break;
+			case AlpideDataType::kEMPTYFRAME:   byte += 2; break;
+			default: byte += 1; break;
+		}
+	}
+	return sum;
+}
+
+template<class F>
+static double BytesPerSecond(const vector<vector<unsigned char>>& events, long totalBytes, F&& f) {
+	auto t1 = timeNow();
+	for(int r=0; r<N_REPEAT; ++r) f();
+	auto t2 = timeNow();
+	double s = std::chrono::duration<double>(t2-t1).count();
+	return (double)totalBytes * N_REPEAT / s;
+}
+
+auto main() -> int {
+	std::mt19937 rng(12345);
+	vector<vector<unsigned char>> events;
+	long totalBytes = 0;
+	for(int i=0; i<N_EVENTS; ++i) {
+		events.push_back(MakeEvent(rng, 1 + i%3));
+		totalBytes += events.back().size();
+	}
+
+	volatile long sink = 0;
+	LegacyWalker legacy;
+	double legacyRate = BytesPerSecond(events, totalBytes, [&]() {
+		for(auto& ev : events) sink += legacy.Walk(ev.data(), ev.size());
+	});
+	double tableRate = BytesPerSecond(events, totalBytes, [&]() {
+		for(auto& ev : events) sink += TableWalk(ev.data(), ev.size());
+	});
+	BaselineDecoder baseline;
+	double baselineRate = BytesPerSecond(events, totalBytes, [&]() {
+		for(auto& ev : events) sink += baseline.DecodeEvent(ev.data(), ev.size());
+	});
+	double decodeRate = BytesPerSecond(events, totalBytes, [&]() {
+		R3BAlpideDecoder decoder;
+		for(auto& ev : events) sink += decoder.DecodeEvent(ev.data(), ev.size());
+	});
+
+	int status = 0;
+	bool sameAsBaseline = true;
+	{
+		R3BAlpideDecoder decoder;
+		for(auto& ev : events) {
+			sameAsBaseline &= baseline.DecodeEvent(ev.data(), ev.size()) == decoder.DecodeEvent(ev.data(), ev.size());
+			const R3BHitBuffer& hits = decoder.GetHits();
+			sameAsBaseline &= hits.Size() == baseline.fHits.size();
+			for(size_t i=0; sameAsBaseline && i<hits.Size(); ++i) {
+				sameAsBaseline &= hits.GetChipId(i) == baseline.fHits[i].GetChipId()
+					&& hits.GetRegion(i) == baseline.fHits[i].GetRegion();
+			}
+		}
+	}
+	if(!sameAsBaseline) status = 1;
+
+	printf("events      : %d x %d passes, %ld bytes per pass\n", N_EVENTS, N_REPEAT, totalBytes);
+	printf("legacy walk : %10.1f MB/s\n", legacyRate*1e-6);
+	printf("table walk  : %10.1f MB/s (x%.2f)\n", tableRate*1e-6, tableRate/legacyRate);
+	printf("old decode  : %10.1f MB/s\n", baselineRate*1e-6);
+	printf("DecodeEvent : %10.1f MB/s (x%.2f), hit chips and regions %s baseline\n", decodeRate*1e-6, decodeRate/baselineRate,
+		sameAsBaseline ? "identical to" : "DIFFER from");
+
+	/* Same decoder on IDLE/BUSY heavy buffers, per filler skip variant */
+	vector<vector<unsigned char>> fillerEvents;
+	long fillerBytes = 0;
+	for(int i=0; i<N_EVENTS; ++i) {
+		fillerEvents.push_back(MakeEvent(rng, 1 + i%3, true));
+		fillerBytes += fillerEvents.back().size();
+	}
+	printf("filler events: %d x %d passes, %ld bytes per pass\n", N_EVENTS, N_REPEAT, fillerBytes);
+
+	/* hit buffers are per event, keep the scalar result of each one as reference */
+	vector<R3BHitBuffer> reference;
+	{
+		R3BAlpideDecoder decoder;
+		decoder.SetFillerSkip(FillerSkipImpl::kSCALAR);
+		for(auto& ev : fillerEvents) {
+			decoder.DecodeEvent(ev.data(), ev.size());
+			reference.push_back(decoder.TakeHits());
+		}
+	}
+
+	for(FillerSkipImpl impl : {FillerSkipImpl::kSCALAR, FillerSkipImpl::kSSE2, FillerSkipImpl::kAVX2}) {
+		if(ResolveFillerSkip(impl) != impl) {
+			printf("DecodeEvent [%-6s] : not supported on this CPU\n", GetFillerSkipName(impl));
+			continue;
+		}
+		double rate = BytesPerSecond(fillerEvents, fillerBytes, [&]() {
+			R3BAlpideDecoder decoder;
+			decoder.SetFillerSkip(impl);
+			for(auto& ev : fillerEvents) sink += decoder.DecodeEvent(ev.data(), ev.size());
+		});
+		R3BAlpideDecoder check;
+		check.SetFillerSkip(impl);
+		bool same = true;
+		for(size_t i=0; i<fillerEvents.size(); ++i) {
+			check.DecodeEvent(fillerEvents[i].data(), fillerEvents[i].size());
+			same &= (check.GetHits() == reference[i]);
+		}
+		if(!same) status = 1;
+		printf("DecodeEvent [%-6s] : %10.1f MB/s, hits %s scalar\n", GetFillerSkipName(impl), rate*1e-6, same ? "identical to" : "DIFFER from");
+	}
+
+	/* Memory-bounded mode must give the same hits, only in chunks */
+	{
+		R3BAlpideDecoder bounded;
+		bounded.SetHitLimit(16);
+		bool same = true;
+		size_t maxChunk = 0;
+		for(size_t i=0; i<fillerEvents.size(); ++i) {
+			const R3BHitBuffer& ref = reference[i];
+			size_t n = 0;
+			bool ok = bounded.DecodeEvent(fillerEvents[i].data(), fillerEvents[i].size());
+			for(;;) {
+				const R3BHitBuffer& chunk = bounded.GetHits();
+				maxChunk = std::max(maxChunk, chunk.Size());
+				for(size_t k=0; k<chunk.Size(); ++k, ++n) {
+					same &= (n < ref.Size() && (chunk.Get(k).GetWord() & 0xffffffff) == (ref.Get(n).GetWord() & 0xffffffff));
+				}
+				if(!bounded.IsSuspended()) break;
+				ok = bounded.ResumeEvent();
+			}
+			same &= ok && (n == ref.Size());
+		}
+		if(!same) status = 1;
+		printf("DecodeEvent [limit 16] : largest chunk %zu hits, hits %s unbounded\n", maxChunk, same ? "identical to" : "DIFFER from");
+	}
+
+	/* IDLE filler in front of the first chip header must stay with that chip's segment */
+	{
+		vector<unsigned char> buffer(8, 0xff);
+		for(int chipId=0; chipId<4; ++chipId) {
+			vector<unsigned char> ev = MakeEvent(rng, chipId);
+			buffer.insert(buffer.end(), ev.begin(), ev.end());
+		}
+		R3BAlpideDecoder serial;
+		const bool serialOk = serial.DecodeEvent(buffer.data(), buffer.size());
+		R3BParallelDecoder parallel(4);
+		parallel.SetMinParallelBytes(0);
+		const bool parallelOk = parallel.DecodeEvent(buffer.data(), buffer.size());
+		vector<R3BParallelDecoder::Segment> segments;
+		R3BParallelDecoder::Split(buffer.data(), buffer.size(), segments, GetFillerSkip());
+		const bool same = serialOk && parallelOk && segments.size() == 4 && parallel.GetHits() == serial.GetHits();
+		if(!same) status = 1;
+		printf("ParallelDecoder [lead filler] : %zu segments, hits %s serial\n", segments.size(), same ? "identical to" : "DIFFER from");
+	}
+
+	/* Several chips in one buffer: the serial decoder starts each chip event afresh,
+	 * as every parallel segment does. The same pixel in two chips is no duplicate. */
+	{
+		R3BAlpideDecoder serial;
+		R3BParallelDecoder parallel(4);
+		parallel.SetMinParallelBytes(0);
+		unsigned char twoChips[] = {0xa1, 0x00, 0xc0, 0x40, 0x05, 0xb0, 0xa2, 0x00, 0xc0, 0x40, 0x05, 0xb0};
+		bool same = serial.DecodeEvent(twoChips, sizeof(twoChips)) && parallel.DecodeEvent(twoChips, sizeof(twoChips))
+			&& serial.GetHits().Size() == 2 && serial.GetHits().GetPixFlag(1) == AlpidePixFlag::kOK
+			&& parallel.GetHits() == serial.GetHits();
+		for(int i=0; i<1024; ++i) {
+			vector<unsigned char> buffer;
+			for(int chipId=0; chipId<4; ++chipId) {
+				vector<unsigned char> ev = MakeEvent(rng, (i + chipId) % 16, i & 1);
+				buffer.insert(buffer.end(), ev.begin(), ev.end());
+			}
+			const bool serialOk = serial.DecodeEvent(buffer.data(), buffer.size());
+			const bool parallelOk = parallel.DecodeEvent(buffer.data(), buffer.size());
+			same &= serialOk == parallelOk && parallel.GetHits() == serial.GetHits();
+		}
+		if(!same) status = 1;
+		printf("ParallelDecoder [4 chips]    : %lu buffers in parallel, hits %s serial\n", (unsigned long)parallel.GetNParallel(), same ? "identical to" : "DIFFER from");
+	}
+
+	/* Single-chip buffers as MOSAIC sends them, four side by side through DecodeEvents() */
+	{
+		R3BAlpideDecoder serial;
+		R3BParallelDecoder parallel(4);
+		bool same = true;
+		for(int i=0; i<256; ++i) {
+			vector<vector<unsigned char>> events;
+			vector<unsigned char*> data;
+			vector<int> nBytes;
+			for(int j=0; j<4; ++j) events.push_back(MakeEvent(rng, (i + j) % 16, i & 1));
+			for(auto& ev : events) {
+				data.push_back(ev.data());
+				nBytes.push_back(ev.size());
+			}
+			parallel.DecodeEvents(data.data(), nBytes.data(), events.size());
+			for(size_t j=0; j<events.size(); ++j) {
+				const bool serialOk = serial.DecodeEvent(events[j].data(), events[j].size());
+				R3BHitBuffer hits;
+				parallel.SwapHits(j, hits);
+				same &= serialOk == parallel.IsOk(j) && hits == serial.GetHits();
+			}
+		}
+		if(!same) status = 1;
+		printf("ParallelDecoder [batched]    : %lu buffers side by side, hits %s serial\n", (unsigned long)parallel.GetNBatched(), same ? "identical to" : "DIFFER from");
+	}
+	return status;
+}
@@ -0,0 +1,278 @@
+#include "R3BAlpideDecoder.h"
+#include "R3BParallelDecoder.h"
+#include "R3BHitBuffer.h"
+#include "R3BPixHit.h"
+#include "R3BStorePixHit.h"
+#include "R3BByteSwap.h"
+#include "CMDLineParser.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+/* >> Decoder and storage micro-benchmarks at fixed occupancies
+ * Scenarios, one chip event per MOSAIC buffer as the scan reads them:
+ *   empty  - empty frames only
+ *   sparse - a handful of DATASHORT hits spread over the regions
+ *   dense  - DATALONG clusters with full hitmaps in every region
+ *   idle   - sparse hits between long IDLE runs
+ *   multi  - dense events of 15 chips in each buffer, fewer buffers
+ * Stages, each on the same events:
+ *   decode - R3BAlpideDecoder::DecodeEvent(), one decoder for all events
+ *   dec-cnt, dec-none - the same with validation kCOUNTERS / kNONE, see R3BDecodePolicy
+ *   pdecode - R3BParallelDecoder with a thread per core, only multi is split
+ *   pbatch - R3BParallelDecoder::DecodeEvents() of a buffer per thread, as the pipeline batches them
+ *   swap   - the big-endian copy of each event R3BLmdWriter makes, widest byte swap the CPU has
+ *   pixhit - R3BPixHit of every decoded hit, as R3BHitBuffer::GetPixHit() gives them
+ *   store  - R3BStorePixHit::Fill() of the decoded hit buffers
+ *   astore - the same handing batches to the writer thread, as the scan's hit files
+ *            do: the time the storing thread spends, the writer catching up after
+ * Every result gives ns per raw byte, hits/s and heap allocations per event.
+ * The table goes to stdout, the same numbers as JSON to --json=<file>
+ * (default microbench.json) to compare builds against each other. */
+
+using namespace std;
+
+#define timeNow() std::chrono::high_resolution_clock::now()
+
+/* every operator new of the process, ROOT's included */
+static std::atomic<uint64_t> gNAllocs{0};
+
+void* operator new(size_t n) {
+	++gNAllocs;
+	if(void* p = malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {free(p);}
+void operator delete(void* p, size_t) noexcept {free(p);}
+
+constexpr int N_EVENTS      = 2000;
+constexpr int N_MULTI       = 200;  // buffers of the multi scenario
+constexpr int N_MULTI_CHIPS = 15;
+constexpr int DECODE_PASSES = 20;
+constexpr int PIXHIT_PASSES = 20;
+constexpr int SWAP_PASSES   = 20;
+constexpr int STORE_PASSES  = 2;
+
+struct Scenario {
+	std::string name;
+	vector<vector<unsigned char>> events;
+	long nBytes = 0; // per pass
+	long nHits = 0;  // per pass
+};
+
+struct Result {
+	std::string scenario;
+	std::string stage;
+	long nEvents;
+	long nBytes;
+	long nHits;
+	double seconds;
+	uint64_t nAllocs;
+
+	double NsPerByte() const {return nBytes ? seconds * 1e9 / nBytes : 0.;}
+	double HitsPerSecond() const {return seconds > 0 ? nHits / seconds : 0.;}
+	double AllocsPerEvent() const {return nEvents ? (double)nAllocs / nEvents : 0.;}
+};
+
+/* Hits of one region: nClusters per double column of nEnc encoders,
+ * ascending addresses as the chip sends them */
+static void PushRegion(vector<unsigned char>& ev, int region, int nEnc, int nClusters, bool dataLong, std::mt19937& rng) {
+	std::uniform_int_distribution<int> gap(0, 96);
+	ev.push_back(0xc0 | region);
+	for(int e=0; e<nEnc; ++e) {
+		const int enc = (e * 5 + region) % 16;
+		int address = gap(rng);
+		for(int c=0; c<nClusters && address + (dataLong ? 7 : 0) <= (int)common::MAX_ADDR; ++c) {
+			ev.push_back((dataLong ? 0x00 : 0x40) | (enc << 2) | (address >> 8));
+			ev.push_back(address & 0xff);
+			if(dataLong) {
+				ev.push_back(0x7f);
+				address += 8;
+			}
+			address += 1 + gap(rng);
+		}
+	}
+}
+
+static vector<unsigned char> MakeEvent(const std::string& scenario, int chipId, uint8_t bc, std::mt19937& rng) {
+	vector<unsigned char> ev;
+	if(scenario == "empty") {
+		ev.push_back(0xe0 | chipId);
+		ev.push_back(bc);
+	}
+	else {
+		ev.push_back(0xa0 | chipId);
+		ev.push_back(bc);
+		if(scenario == "dense") {
+			for(int region=0; region<32; ++region) PushRegion(ev, region, 4, 4, true, rng);
+		}
+		else {
+			const bool idle = scenario == "idle";
+			std::uniform_int_distribution<int> idleRun(64, 512);
+			for(int region=0; region<32; region+=4) {
+				if(idle) ev.insert(ev.end(), idleRun(rng), 0xff);
+				PushRegion(ev, region, 1, 1, false, rng);
+			}
+			if(idle) ev.insert(ev.end(), idleRun(rng), 0xff);
+		}
+		ev.push_back(0xb0);
+	}
+	ev.insert(ev.end(), 3, 0xff);
+	return ev;
+}
+
+static Scenario MakeScenario(const std::string& name) {
+	std::mt19937 rng(12345);
+	Scenario s;
+	s.name = name;
+	R3BAlpideDecoder decoder;
+	const bool multi = name == "multi";
+	for(int i=0; i<(multi ? N_MULTI : N_EVENTS); ++i) {
+		if(multi) {
+			vector<unsigned char> buffer;
+			for(int chipId=0; chipId<N_MULTI_CHIPS; ++chipId) {
+				const vector<unsigned char> ev = MakeEvent("dense", chipId, i & 0xff, rng);
+				buffer.insert(buffer.end(), ev.begin(), ev.end());
+			}
+			s.events.push_back(std::move(buffer));
+		}
+		else s.events.push_back(MakeEvent(name, i % 3, i & 0xff, rng));
+		s.nBytes += s.events.back().size();
+		decoder.DecodeEvent(s.events.back().data(), s.events.back().size());
+		s.nHits += decoder.GetHits().Size();
+	}
+	return s;
+}
+
+template<class F>
+static Result Measure(const Scenario& s, const std::string& stage, int nPasses, F&& pass) {
+	pass(); // warm-up: buffers grown, pages touched
+	const uint64_t allocs = gNAllocs;
+	auto t1 = timeNow();
+	for(int p=0; p<nPasses; ++p) pass();
+	auto t2 = timeNow();
+	return Result{s.name, stage, (long)s.events.size() * nPasses, s.nBytes * nPasses, s.nHits * nPasses,
+		std::chrono::duration<double>(t2-t1).count(), gNAllocs - allocs};
+}
+
+static void WriteJson(const std::string& fileName, const vector<Result>& results) {
+	FILE* f = fopen(fileName.c_str(), "w");
+	if(!f) {
+		fprintf(stderr, "microbench - can't write %s\n", fileName.c_str());
+		return;
+	}
+	fprintf(f, "[\n");
+	for(size_t i=0; i<results.size(); ++i) {
+		const Result& r = results[i];
+		fprintf(f, "  {\"scenario\": \"%s\", \"stage\": \"%s\", \"events\": %ld, \"bytes\": %ld, \"hits\": %ld, "
+			"\"seconds\": %.6f, \"ns_per_byte\": %.4f, \"hits_per_s\": %.1f, \"allocs_per_event\": %.4f}%s\n",
+			r.scenario.c_str(), r.stage.c_str(), r.nEvents, r.nBytes, r.nHits, r.seconds,
+			r.NsPerByte(), r.HitsPerSecond(), r.AllocsPerEvent(), i+1 < results.size() ? "," : "");
+	}
+	fprintf(f, "]\n");
+	fclose(f);
+}
+
+auto main(int argc, char* argv[]) -> int {
+	std::string jsonFile = "microbench.json";
+	ParseCmdLine("json", jsonFile, argc, argv);
+	const bool store = !IsCmdArg("nostore", argc, argv);
+	const std::string rootFile = "microbench_store.root";
+
+	vector<Result> results;
+	volatile uint64_t sink = 0;
+	R3BParallelDecoder parallelDecoder;
+	for(const char* name : {"empty", "sparse", "dense", "idle", "multi"}) {
+		Scenario s = MakeScenario(name);
+
+		R3BAlpideDecoder decoder;
+		results.push_back(Measure(s, "decode", DECODE_PASSES, [&]() {
+			for(auto& ev : s.events) sink += decoder.DecodeEvent(ev.data(), ev.size());
+		}));
+		results.push_back(Measure(s, "dec-cnt", DECODE_PASSES, [&]() {
+			for(auto& ev : s.events) sink += decoder.DecodeEvent<R3BDecodePolicy<true, DecodeValidation::kCOUNTERS>>(ev.data(), ev.size());
+		}));
+		results.push_back(Measure(s, "dec-none", DECODE_PASSES, [&]() {
+			for(auto& ev : s.events) sink += decoder.DecodeEvent<R3BDecodePolicy<true, DecodeValidation::kNONE>>(ev.data(), ev.size());
+		}));
+
+		results.push_back(Measure(s, "pdecode", DECODE_PASSES, [&]() {
+			for(auto& ev : s.events) sink += parallelDecoder.DecodeEvent(ev.data(), ev.size());
+		}));
+
+		vector<unsigned char*> eventData;
+		vector<int> eventBytes;
+		for(auto& ev : s.events) {
+			eventData.push_back(ev.data());
+			eventBytes.push_back(ev.size());
+		}
+		const size_t batchSize = parallelDecoder.GetNThreads();
+		results.push_back(Measure(s, "pbatch", DECODE_PASSES, [&]() {
+			for(size_t i=0; i<eventData.size(); i+=batchSize) {
+				const size_t n = min(batchSize, eventData.size() - i);
+				parallelDecoder.DecodeEvents(eventData.data() + i, eventBytes.data() + i, n);
+				sink += parallelDecoder.IsOk(0);
+			}
+		}));
+
+		size_t maxBytes = 0;
+		for(auto& ev : s.events) if(ev.size() > maxBytes) maxBytes = ev.size();
+		vector<unsigned char> swapped(maxBytes + 4);
+		const ByteSwapFn swap = GetByteSwap();
+		results.push_back(Measure(s, "swap", SWAP_PASSES, [&]() {
+			for(auto& ev : s.events) swap(swapped.data(), ev.data(), ev.size() / 4);
+			sink += swapped[0];
+		}));
+
+		/* decoded once, the later stages only see hit buffers */
+		vector<R3BHitBuffer> hits;
+		for(auto& ev : s.events) {
+			decoder.DecodeEvent(ev.data(), ev.size());
+			hits.push_back(decoder.TakeHits());
+		}
+
+		results.push_back(Measure(s, "pixhit", PIXHIT_PASSES, [&]() {
+			for(auto& h : hits) {
+				for(size_t i=0; i<h.Size(); ++i) {
+					R3BPixHit hit = h.GetPixHit(i);
+					sink += hit.GetRow() + hit.GetColumn();
+				}
+			}
+		}));
+
+		if(store) {
+			R3BStorePixHit storePixHit;
+			storePixHit.SetFileName(rootFile);
+			storePixHit.Init();
+			results.push_back(Measure(s, "store", STORE_PASSES, [&]() {
+				for(auto& h : hits) storePixHit.Fill(h);
+			}));
+			storePixHit.Terminate();
+			std::remove(rootFile.c_str());
+
+			R3BStorePixHit asyncStore;
+			asyncStore.SetFileName(rootFile);
+			asyncStore.SetQueueDepth(16);
+			asyncStore.Init();
+			results.push_back(Measure(s, "astore", STORE_PASSES, [&]() {
+				for(auto& h : hits) asyncStore.Fill(h);
+			}));
+			asyncStore.Wait();
+			std::remove(rootFile.c_str());
+		}
+	}
+
+	printf("%-8s %-8s %10s %12s %14s %14s\n", "scenario", "stage", "hits/event", "ns/byte", "hits/s", "allocs/event");
+	for(const Result& r : results) {
+		printf("%-8s %-8s %10.1f %12.3f %14.4g %14.3f\n", r.scenario.c_str(), r.stage.c_str(),
+			r.nEvents ? (double)r.nHits / r.nEvents : 0., r.NsPerByte(), r.HitsPerSecond(), r.AllocsPerEvent());
+	}
+	WriteJson(jsonFile, results);
+	printf("results written to %s\n", jsonFile.c_str());
+	return 0;
+}
@@ -1,4 +1,8 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
 #include <regex>
 #include <string>
 #include <iostream>
@@ -12,7 +16,7 @@ bool IsCmdArg(const char* line, int argc, char** argv) {
 	cmatch m;
     std::regex r(R"(^(?:-){1,2}(\w+)$)");
     for(int i(1); i<argc; ++i) 
-		if(regex_match(argv[i],m,r) && !strcmp(m[1].str().c_str(),str)) return 1;
+		if(regex_match(argv[i],m,r) && !strcmp(m[1].str().c_str(),line)) return 1;
     return 0;
 }
 
@@ -28,6 +32,19 @@ bool ParseCmdLine(const char* line, string& parsed, int argc, char** argv) {
     return 0;
 }
 
+/* --tag=<n> with n a whole number in [minValue, maxValue]: 1 and parsed set,
+ * 0 if the tag isn't there, -1 if it is but n is no such number */
+int ParseCmdLineNumber(const char* line, long long& parsed, long long minValue, long long maxValue, int argc, char** argv) {
+	string arg;
+	if(!ParseCmdLine(line, arg, argc, argv)) return 0;
+	errno = 0;
+	char* end = nullptr;
+	const long long value = strtoll(arg.c_str(), &end, 10);
+	if(errno || end == arg.c_str() || *end != '\0' || value < minValue || value > maxValue) return -1;
+	parsed = value;
+	return 1;
+}
+
 void RemoveCharsFromString(string& str, string chars) {
 	for(char c : chars) {
 		str.erase(std::remove(str.begin(), str.end(), c), str.end());
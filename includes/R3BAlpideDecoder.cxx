@@ -1,8 +1,6 @@
 #include "R3BAlpideDecoder.h"
 #include "R3BStorePixHit.h"
 #include "R3BPixHit.h"
-#include "THisto.h"
-#include "TErrorCounter.h"
 #include <stdint.h>
 #include <iostream>
 #include <string>
@@ -11,141 +9,276 @@
 
 using namespace std;
 
+static const size_t HIT_RESERVE = 2048;
+static const size_t MAX_SPARE_HITS = 4;
+
+/* DecodeEvent() advances by a constant per case, keep those in line with the table */
+static_assert(R3BAlpideDecoder::kWordTable[0xa0].length == 2, "chip header is 2 bytes");
+static_assert(R3BAlpideDecoder::kWordTable[0xe0].length == 2, "empty frame is 2 bytes");
+static_assert(R3BAlpideDecoder::kWordTable[0xb0].length == 1, "chip trailer is 1 byte");
+static_assert(R3BAlpideDecoder::kWordTable[0xc0].length == 1, "region header is 1 byte");
+static_assert(R3BAlpideDecoder::kWordTable[0x40].length == 2, "data short is 2 bytes");
+static_assert(R3BAlpideDecoder::kWordTable[0x00].length == 3, "data long is 3 bytes");
+
 R3BAlpideDecoder::R3BAlpideDecoder() : 
     fNewEvent(false),
 	fBoardIndex(UINT_MAX),
     fChipId(UINT_MAX),
     fRegion(32),
     fFlags(0),
-	thi(UINT_MAX),
 	tlo(UINT_MAX),
-    fDataType(AlpideDataType::kUNKNOWN) {
-		fHits.reserve(2048);
+	thi(UINT_MAX),
+	fSkipFiller(GetFillerSkip(FillerSkipImpl::kAUTO)),
+	fTimeIndex(0),
+	fHitLimit(0),
+	fData(nullptr),
+	fNBytes(0),
+	fByte(0),
+	fStarted(false),
+	fFinished(false),
+	fCorrupt(false),
+	fSuspended(false),
+	fMask(nullptr),
+	fMaskBits(nullptr) {
+		fHits.Reserve(HIT_RESERVE);
+		SetDecodeMode(R3BDecodeMode());
+		fResumeFn = fDecodeFn;
+	}
+
+const char* GetDecodeValidationName(DecodeValidation validation) {
+	switch(validation) {
+		case DecodeValidation::kFULL:     return "full";
+		case DecodeValidation::kCOUNTERS: return "counters";
+		case DecodeValidation::kNONE:     return "none";
+		default:                          return "unknown";
+	}
+}
+
+bool ParseDecodeValidation(const string& name, DecodeValidation& validation) {
+	for(DecodeValidation v : {DecodeValidation::kFULL, DecodeValidation::kCOUNTERS, DecodeValidation::kNONE}) {
+		if(name == GetDecodeValidationName(v)) {
+			validation = v;
+			return true;
+		}
 	}
+	return false;
+}
+
+void R3BAlpideDecoder::SetDecodeMode(const R3BDecodeMode& mode) {
+	fMode = mode;
+	switch(mode.validation) {
+		case DecodeValidation::kFULL:
+			fDecodeFn = mode.clustering ? &R3BAlpideDecoder::Decode<R3BDecodePolicy<true, DecodeValidation::kFULL>>
+			                            : &R3BAlpideDecoder::Decode<R3BDecodePolicy<false, DecodeValidation::kFULL>>;
+			break;
+		case DecodeValidation::kCOUNTERS:
+			fDecodeFn = mode.clustering ? &R3BAlpideDecoder::Decode<R3BDecodePolicy<true, DecodeValidation::kCOUNTERS>>
+			                            : &R3BAlpideDecoder::Decode<R3BDecodePolicy<false, DecodeValidation::kCOUNTERS>>;
+			break;
+		case DecodeValidation::kNONE:
+			fDecodeFn = mode.clustering ? &R3BAlpideDecoder::Decode<R3BDecodePolicy<true, DecodeValidation::kNONE>>
+			                            : &R3BAlpideDecoder::Decode<R3BDecodePolicy<false, DecodeValidation::kNONE>>;
+			break;
+	}
+}
 
 /* MARK: Main method */
-bool R3BAlpideDecoder::DecodeEvent(unsigned char* data, int nBytes) {
+void R3BAlpideDecoder::BeginEvent(unsigned char* data, int nBytes) {
     fFlags  = 0;
     fChipId = -1;
     fRegion = 32; // bad region 
-    fDataType = AlpideDataType::kUNKNOWN;
+    fMaskBits = nullptr;
+
+    fHits.Clear();
+    fTimeIndex = fHits.AddTriggerTime(((uint64_t)thi) << 32 | (uint64_t)tlo);
+
+    fData = data;
+    fNBytes = nBytes;
+    fByte = 0;
+    fStarted = false;
+    fFinished = false;
+    fCorrupt = false;
+    fSuspended = false;
+}
+
+bool R3BAlpideDecoder::DecodeEvent(unsigned char* data, int nBytes) {
+    BeginEvent(data, nBytes);
+    fResumeFn = fDecodeFn;
+    return (this->*fDecodeFn)();
+}
+
+template<class Policy>
+bool R3BAlpideDecoder::DecodeEvent(unsigned char* data, int nBytes) {
+    BeginEvent(data, nBytes);
+    fResumeFn = &R3BAlpideDecoder::Decode<Policy>;
+    return Decode<Policy>();
+}
+
+template bool R3BAlpideDecoder::DecodeEvent<R3BDecodePolicy<true, DecodeValidation::kFULL>>(unsigned char*, int);
+template bool R3BAlpideDecoder::DecodeEvent<R3BDecodePolicy<true, DecodeValidation::kCOUNTERS>>(unsigned char*, int);
+template bool R3BAlpideDecoder::DecodeEvent<R3BDecodePolicy<true, DecodeValidation::kNONE>>(unsigned char*, int);
+template bool R3BAlpideDecoder::DecodeEvent<R3BDecodePolicy<false, DecodeValidation::kFULL>>(unsigned char*, int);
+template bool R3BAlpideDecoder::DecodeEvent<R3BDecodePolicy<false, DecodeValidation::kCOUNTERS>>(unsigned char*, int);
+template bool R3BAlpideDecoder::DecodeEvent<R3BDecodePolicy<false, DecodeValidation::kNONE>>(unsigned char*, int);
+
+bool R3BAlpideDecoder::ResumeEvent() {
+    if(!fSuspended) {
+        cerr << "R3BAlpideDecoder::ResumeEvent() - Error: no suspended event" << endl;
+        return false;
+    }
+    fHits.Clear();
+    fTimeIndex = fHits.AddTriggerTime(((uint64_t)thi) << 32 | (uint64_t)tlo);
+    fSuspended = false;
+    return (this->*fResumeFn)();
+}
+
+R3BHitBuffer R3BAlpideDecoder::TakeHits() {
+    R3BHitBuffer hits(std::move(fHits));
+    if(!fSpareHits.empty()) {
+        fHits = std::move(fSpareHits.back());
+        fSpareHits.pop_back();
+    }
+    else {
+        fHits = R3BHitBuffer();
+        fHits.Reserve(HIT_RESERVE);
+    }
+    fHits.SetBoardIndex(fBoardIndex);
+    fTimeIndex = fHits.AddTriggerTime(((uint64_t)thi) << 32 | (uint64_t)tlo);
+    return hits;
+}
 
-    bool started = false;  // event has started, i.e. chip header has been found
-    bool finished = false; // event trailer found
-    bool corrupt  = false; // corrupt data found (i.e. data without region or chip)
-    int byte = 0;
+void R3BAlpideDecoder::RecycleHits(R3BHitBuffer&& hits) {
+    if(fSpareHits.size() >= MAX_SPARE_HITS) return;
+    hits.Clear();
+    fSpareHits.emplace_back(std::move(hits));
+}
+
+/* counted unless the policy says kNONE */
+template<class Policy>
+static inline void CountError(R3BDecodeErrors& errors, DecodeError error, uint32_t chipId) {
+    if constexpr(Policy::kValidation != DecodeValidation::kNONE) errors.Count(error, chipId);
+}
+
+/* Every leading byte is classified with one lookup in kWordTable and dispatched on
+ * the type. Each case advances by its own (constant) word length, so the next lead
+ * byte doesn't wait on the table load. Runs of filler words are skipped in one go.
+ * With validation kNONE and no clustering this is the bare DATASHORT loop. */
+template<class Policy>
+bool R3BAlpideDecoder::Decode() {
+    unsigned char* data = fData;
+    const int nBytes = fNBytes;
+    // at most one DATALONG word (8 hits) is decoded past this
+    const size_t hitLimit = fHitLimit ? fHitLimit - 8 : SIZE_MAX;
+
+    bool started = fStarted;
+    bool finished = fFinished;
+    bool corrupt  = fCorrupt;
+    int byte = fByte;
     
     unsigned char last = 0x0;
     
     while(byte < nBytes) {
         last = data[byte];
-        FindDataType(data[byte]);
+        const AlpideWord word = kWordTable[last];
         
-        switch(fDataType) {
+        switch(word.type) {
             case AlpideDataType::kIDLE:
-                byte += GetWordLength();
-                break;
             case AlpideDataType::kBUSYON:
-                byte += GetWordLength();
-                break;
             case AlpideDataType::kBUSYOFF:
-                byte += GetWordLength();
+                byte = fSkipFiller(data, byte + 1, nBytes);
+                break;
+            case AlpideDataType::kDATASHORT:
+                if(!started) {
+                    CountError<Policy>(fErrors, DecodeError::kDATA_OUTSIDE_EVENT, fChipId);
+                    return EndEvent(false);
+                }
+                if(fRegion == 32) CountError<Policy>(fErrors, DecodeError::kNO_REGION, fChipId);
+				corrupt |= DecodeDataShort<Policy>(data + byte);
+				byte += 2;
+				break;
+            case AlpideDataType::kDATALONG:
+                if(!started) {
+                    CountError<Policy>(fErrors, DecodeError::kDATA_OUTSIDE_EVENT, fChipId);
+                    return EndEvent(false);
+                }
+                if(fRegion == 32) CountError<Policy>(fErrors, DecodeError::kNO_REGION, fChipId);
+                if constexpr(Policy::kClustering) corrupt |= DecodeDataLong<Policy>(data + byte);
+                else corrupt |= DecodeUnexpectedDataLong<Policy>(data + byte);
+                byte += 3;
+                break;
+            case AlpideDataType::kREGIONHEADER:
+                if(!started) {
+                    CountError<Policy>(fErrors, DecodeError::kREGION_OUTSIDE_EVENT, fChipId);
+                    return EndEvent(false);
+                }
+                DecodeRegionHeader(data + byte);
+                byte += 1;
                 break;
             case AlpideDataType::kEMPTYFRAME:
                 started = true;
                 DecodeEmptyFrame(data + byte);
-                byte += GetWordLength();
                 finished = true;
+                byte += 2;
                 break;
             case AlpideDataType::kCHIPHEADER:
                 started = true;
                 finished = false;
                 DecodeChipHeader(data + byte);
-                byte += GetWordLength();
+                byte += 2;
                 break;
             case AlpideDataType::kCHIPTRAILER:
                 if(!started) {
-                    cerr << "R3BAlpideDecoder::DecodeEvent() - Error: chip trailer found before chip header ?" << endl;
-                    return false;
+                    CountError<Policy>(fErrors, DecodeError::kTRAILER_OUTSIDE_EVENT, fChipId);
+                    return EndEvent(false);
                 }
                 if(finished) {
-                    cerr << "R3BAlpideDecoder::DecodeEvent() - Error: chip trailer found after event was finished ?" << endl;
-                    return false;
+                    CountError<Policy>(fErrors, DecodeError::kTRAILER_TWICE, fChipId);
+                    return EndEvent(false);
                 }
                 DecodeChipTrailer(data + byte);
                 finished = true;
                 fChipId = -1;
-                byte += GetWordLength();
-                break;
-            case AlpideDataType::kREGIONHEADER:
-                if(!started) {
-                    cerr << "R3BAlpideDecoder::DecodeEvent() - Error: region header found before chip header or after chip trailer" << endl;
-                    return false;
-                }
-                DecodeRegionHeader(data + byte);
-                byte += GetWordLength();
-                break;
-            case AlpideDataType::kDATASHORT:
-                if(!started) {
-                    cerr << "R3BAlpideDecoder::DecodeEvent() - Error: hit data found before chip header or after chip trailer" << endl;
-                    return false;
-                }
-                if(fRegion == 32)
-                    cout << "R3BAlpideDecoder::DecodeEvent() - Warning: data word without region (Chip " << fChipId << ")" << endl;
-				corrupt = DecodeDataShort(data + byte);
-				byte += GetWordLength();
-				break;
-            case AlpideDataType::kDATALONG:
-                if(!started) {
-                    cerr << "R3BAlpideDecoder::DecodeEvent() - Error: hit data found before chip header or after chip trailer" << endl;
-                    return false;
-                }
-                if(fRegion == 32)
-                    cerr << "R3BAlpideDecoder::DecodeEvent() - Warning: data word without region, skipping (Chip " << fChipId << ")" << endl;
-                corrupt = DecodeDataLong(data + byte);
-                byte += GetWordLength();
+                fMaskBits = nullptr;
+                byte += 1;
                 break;
             case AlpideDataType::kUNKNOWN:
-                cerr << "R3BAlpideDecoder::DecodeEvent() - Error: data of unknown type 0x" << std::hex << data[byte] << std::dec << endl;
-                return false;
+                CountError<Policy>(fErrors, DecodeError::kUNKNOWN_WORD, fChipId);
+                return EndEvent(false);
+        }
+        if(fHits.Size() > hitLimit && byte < nBytes) {
+            // backpressure: hand back to the caller before the buffer grows any further
+            fStarted = started;
+            fFinished = finished;
+            fCorrupt = corrupt;
+            fByte = byte;
+            fSuspended = true;
+            return !corrupt;
         }
     }
+    fByte = byte;
 	if(started && !finished) {
-		cout << "R3BAlpideDecoder::DecodeEvent() - Warning (chip "<< fChipId << "): event not finished at end of data, last byte was 0x" << std::hex << (int) last << std::dec << ", event length = " << nBytes << endl;
-		return false;
+		CountError<Policy>(fErrors, DecodeError::kEVENT_NOT_FINISHED, fChipId);
+		return EndEvent(false);
 	}
 	else if(!started) {
-		cout << "R3BAlpideDecoder::DecodeEvent() - Warning: event not started at end of data." << endl;
-		return false;
+		CountError<Policy>(fErrors, DecodeError::kEVENT_NOT_STARTED, fChipId);
+		return EndEvent(false);
 	}
-    return !corrupt;
-}
-
-void R3BAlpideDecoder::FindDataType(unsigned char dataWord) {
-    if     (dataWord == 0xff)          fDataType = AlpideDataType::kIDLE;
-    else if(dataWord == 0xf1)          fDataType = AlpideDataType::kBUSYON;
-    else if(dataWord == 0xf0)          fDataType = AlpideDataType::kBUSYOFF;
-    else if((dataWord & 0xf0) == 0xa0) fDataType = AlpideDataType::kCHIPHEADER;
-    else if((dataWord & 0xf0) == 0xb0) fDataType = AlpideDataType::kCHIPTRAILER;
-    else if((dataWord & 0xf0) == 0xe0) fDataType = AlpideDataType::kEMPTYFRAME;
-    else if((dataWord & 0xe0) == 0xc0) fDataType = AlpideDataType::kREGIONHEADER;
-    else if((dataWord & 0xc0) == 0x40) fDataType = AlpideDataType::kDATASHORT;
-    else if((dataWord & 0xc0) == 0x00) fDataType = AlpideDataType::kDATALONG;
-    else fDataType = AlpideDataType::kUNKNOWN;
+    return EndEvent(!corrupt);
 }
 
-int R3BAlpideDecoder::GetWordLength() const {
-	if(fDataType == AlpideDataType::kDATALONG) return 3;
-	else if((fDataType == AlpideDataType::kDATASHORT) ||
-			(fDataType == AlpideDataType::kCHIPHEADER) || 
-			(fDataType == AlpideDataType::kEMPTYFRAME))
-		return 2;
-	else return 1;
+bool R3BAlpideDecoder::EndEvent(bool ok) {
+    fErrors.CountEvent(!ok);
+    fErrors.MaybeSummarise();
+    return ok;
 }
 
-/* 16-bits: 1010 <chip_id[3:0]> <bunch_counter[10:3]> 1011 */
+/* 16-bits: 1010 <chip_id[3:0]> <bunch_counter[10:3]> 1011
+ * Nothing of the previous chip event carries over: region and duplicate check start afresh */
 void R3BAlpideDecoder::DecodeChipHeader(unsigned char* data) {
   fChipId = (uint32_t)(*data & 0xf); 
+  fRegion = 32;
+  fMaskBits = fMask ? fMask->GetBits(fChipId) : nullptr;
   fNewEvent = true;
 }
 
@@ -157,127 +290,110 @@ void R3BAlpideDecoder::DecodeChipTrailer(unsigned char* data) {
 /* 8-bits: 110 <region_id[4:0]> */
 void R3BAlpideDecoder::DecodeRegionHeader(unsigned char* data) {
     fRegion = data[0] & 0x1f;
-    fNewEvent = false;
 }
 
 /* 16-bits: 1110 <chip_id[3:0]> <bunch_counter[10:3]> */
 void R3BAlpideDecoder::DecodeEmptyFrame(unsigned char* data) {
   fChipId = (uint32_t)(*data & 0xf); 
+  fRegion = 32;
+  fNewEvent = true;
+}
+
+/* Same checks as the R3BPixHit setters (SetRegion, SetDoubleColumn, SetAddress),
+ * applied in that order so the last failing one sets the flag. The chip id has
+ * 4 bits in the data, 0-15 are all valid: only a hit before any chip header fails. */
+static AlpidePixFlag CheckHit(R3BDecodeErrors& errors, uint32_t chipId, uint32_t region, uint32_t dcol, uint32_t address) {
+	AlpidePixFlag flag = AlpidePixFlag::kOK;
+	if(chipId > 15) {
+		errors.CountPixel(DecodeError::kBAD_CHIPID, chipId, region, dcol);
+		flag = AlpidePixFlag::kBAD_CHIPID;
+	}
+	if(region > common::MAX_REGION) {
+		errors.CountPixel(DecodeError::kBAD_REGIONID, chipId, region, dcol);
+		flag = AlpidePixFlag::kBAD_REGIONID;
+	}
+	if(dcol > common::MAX_DCOL) {
+		errors.CountPixel(DecodeError::kBAD_DCOLID, chipId, region, dcol);
+		flag = AlpidePixFlag::kBAD_DCOLID;
+	}
+	if(address > common::MAX_ADDR) {
+		errors.CountPixel(DecodeError::kBAD_ADDRESS, chipId, region, dcol);
+		flag = AlpidePixFlag::kBAD_ADDRESS;
+	}
+	return flag;
+}
+
+template<class Policy>
+bool R3BAlpideDecoder::AddHit(uint32_t dcol, uint32_t address) {
+	if(fMaskBits && dcol < R3BPixelMask::N_DCOLS && address < R3BPixelMask::N_ADDR && R3BPixelMask::TestBit(fMaskBits, dcol, address)) {
+		fErrors.CountMasked(fChipId);
+		return false;
+	}
+	if constexpr(Policy::kValidation != DecodeValidation::kFULL) {
+		fHits.PushBack(fChipId, dcol, address, AlpidePixFlag::kOK, fTimeIndex);
+		return false;
+	}
+	AlpidePixFlag flag = CheckHit(fErrors, fChipId, fRegion, dcol, address);
+
+	// check if there are duplicates in the chip event, region is part of the double column id.
+	// Hits already handed over on a suspended event are not revisited.
+	const size_t n = fHits.Size();
+	if(n > 0 && !fNewEvent && dcol == fHits.GetDoubleColumn(n-1)) {
+		const uint32_t prevAddress = fHits.GetAddress(n-1);
+		if(address <= prevAddress) {
+			fErrors.CountPixel(address == prevAddress ? DecodeError::kDUPLICATE_PIXEL : DecodeError::kADDRESS_ORDER, fChipId, fRegion, dcol);
+			flag = AlpidePixFlag::kSTUCK;
+			fHits.SetPixFlag(n-1, AlpidePixFlag::kSTUCK);
+		}
+	}
+
+	//finally flush the decoded hit into fHits buffer
+	fHits.PushBack(fChipId, dcol, address, flag, fTimeIndex);
+	fNewEvent = false;
+
+	// data word is corrupted if there is any bad hit found
+	return flag != AlpidePixFlag::kOK;
 }
 
 /* 16-bits: 01 <encoder_id[3:0]> <addr[9:0]> */
+template<class Policy>
 bool R3BAlpideDecoder::DecodeDataShort(unsigned char* data) {
-	R3BPixHit hit;
-	hit.SetTriggerTime(thi, tlo);
-
     uint16_t data_field = (((uint16_t) data[0]) << 8) | (uint16_t)data[1];
 
-    bool corrupt = false;
-    hit.SetChipId(fChipId); // only basic checks on chip id done here
-    hit.SetRegion(fRegion); // can generate a bad region flag
-
 	uint32_t encoder_id = (data_field & 0x3c00) >> 10;
-    hit.SetDoubleColumn(encoder_id); // can generate a bad dcol flag
-
+	uint32_t dcol = encoder_id + fRegion * common::NDCOL_PER_REGION;
 	uint32_t address = (data_field & 0x03ff);		
-	hit.SetAddress(address);
-
-	// check if there are duplicates in the vector
-	if((fHits.size() > 0) && !fNewEvent) {
-		if((hit.GetRegion() == (fHits.back()).GetRegion())
-				&& (hit.GetDoubleColumn() == (fHits.back()).GetDoubleColumn())
-				&& (hit.GetAddress() == (fHits.back()).GetAddress())) {
-			cerr << "R3BAlpideDecoder::DecodeDataWordShort() - received a pixel twice." << endl;
-			hit.SetPixFlag(AlpidePixFlag::kSTUCK);
-			(fHits.back()).SetPixFlag(AlpidePixFlag::kSTUCK);
-			cerr << "\t -- current hit pixel :" << endl;
-			hit.DumpPixHit();
-			cerr << "\t -- previous hit pixel :" << endl;
-			(fHits.back()).DumpPixHit();
-		}
-		else if((hit.GetRegion() == (fHits.back()).GetRegion())
-				&& (hit.GetDoubleColumn() == (fHits.back()).GetDoubleColumn())
-				&& (hit.GetAddress() < (fHits.back()).GetAddress())) {
-			cerr << "R3BAlpideDecoder::DecodeDataWordShort() - address of pixel is lower than previous one in same double column." << endl;
-			hit.SetPixFlag(AlpidePixFlag::kSTUCK);
-			(fHits.back()).SetPixFlag(AlpidePixFlag::kSTUCK);
-			cerr << "\t -- current hit pixel :" << endl;
-			hit.DumpPixHit();
-			cerr << "\t -- previous hit pixel :" << endl;
-			(fHits.back()).DumpPixHit();
-		}
-	}
-	if(hit.GetPixFlag() == AlpidePixFlag::kUNKNOWN) { // nothing bad detected, it means that the flag still has its initialization value => the pixel hit is ok
-		hit.SetPixFlag(AlpidePixFlag::kOK);
-	}
-	// data word is corrupted if there is any bad hit found
-	corrupt = corrupt | hit.IsPixHitCorrupted();
 
-	//finally flush the decoded hit into fHits vector
-	fHits.emplace_back(std::move(hit));
-	return corrupt;
+	return AddHit<Policy>(dcol, address);
 }
 
+/* 24-bits: 00 <encoder_id[3:0]> <addr[9:0]> 0 <hit_map[6:0]> */
+template<class Policy>
 bool R3BAlpideDecoder::DecodeDataLong(unsigned char* data) {
-    R3BPixHit hit;
-    hit.SetTriggerTime(thi, tlo);
-    
     uint16_t data_field = (((uint16_t) data[0]) << 8) | (uint16_t)data[1];
 
     bool corrupt = false;
 
-    hit.SetChipId(fChipId); // only basic checks on chip id done here
-    hit.SetRegion(fRegion); // can generate a bad region flag
-    hit.SetDoubleColumn((data_field & 0x3c00) >> 10); // calculated from encoder_id & region
-    
+	uint32_t dcol = ((data_field & 0x3c00) >> 10) + fRegion * common::NDCOL_PER_REGION;
     uint32_t address = (data_field & 0x03ff);
 
-    for(int i=-1; i<7; ++i) {
-        if((i >= 0) && (!((data[2] >> i) & 0x1))) continue;
-        R3BPixHit singleHit(hit); // i=0 is the first pixel hit in the cluster
-
-        // set hit address on the new hit, can generate a bad address flag
-        singleHit.SetAddress(address + (i + 1));
-
-        // check if pixel deserves a stuck flag
-        if((fHits.size() > 0) && !fNewEvent) {
-            if((singleHit.GetRegion() == (fHits.back()).GetRegion())
-            && (singleHit.GetDoubleColumn() == (fHits.back()).GetDoubleColumn())
-			&& (singleHit.GetAddress() == (fHits.back()).GetAddress())) {
-				cerr << "R3BAlpideDecoder::DecodeDataWord() - received a pixel twice." << endl;
-				singleHit.SetPixFlag(AlpidePixFlag::kSTUCK);
-				(fHits.back()).SetPixFlag(AlpidePixFlag::kSTUCK);
-				cerr << "\t -- current hit pixel :" << endl;
-				singleHit.DumpPixHit();
-				cerr << "\t -- previous hit pixel :" << endl;
-				(fHits.back()).DumpPixHit();
-			}
-            else if((singleHit.GetRegion() == (fHits.back()).GetRegion())
-			&& (singleHit.GetDoubleColumn() == (fHits.back()).GetDoubleColumn())
-			&& (singleHit.GetAddress() < (fHits.back()).GetAddress())) {
-				cerr << "R3BAlpideDecoder::DecodeDataWord() - address of pixel is lower than previous one in same double column." << endl;
-				singleHit.SetPixFlag(AlpidePixFlag::kSTUCK);
-				(fHits.back()).SetPixFlag(AlpidePixFlag::kSTUCK);
-				cerr << "\t -- current hit pixel :" << endl;
-				singleHit.DumpPixHit();
-				cerr << "\t -- previous hit pixel :" << endl;
-				(fHits.back()).DumpPixHit();
-			}
-        }
-        if(singleHit.GetPixFlag() == AlpidePixFlag::kUNKNOWN) { // nothing bad detected, it means that the flag still has its initialization value => the pixel hit is ok
-            singleHit.SetPixFlag(AlpidePixFlag::kOK);
-        }
-        // data word is corrupted if there is any bad hit found
-        corrupt = corrupt | singleHit.IsPixHitCorrupted();
-
-		//finally flush the decoded hit into fHits vector
-        fHits.emplace_back(std::move(singleHit));
+    corrupt |= AddHit<Policy>(dcol, address); // first pixel of the cluster is always hit
+    for(int i=0; i<7; ++i) {
+        if(!((data[2] >> i) & 0x1)) continue;
+        corrupt |= AddHit<Policy>(dcol, address + (i + 1));
     }
 
     fNewEvent = false;
     return corrupt;
 }
 
+/* kept out of the word loop of the policies without clustering */
+template<class Policy>
+__attribute__((noinline, cold)) bool R3BAlpideDecoder::DecodeUnexpectedDataLong(unsigned char* data) {
+    CountError<Policy>(fErrors, DecodeError::kUNEXPECTED_DATALONG, fChipId);
+    return DecodeDataLong<Policy>(data);
+}
+
 /*
 bool R3BAlpideDecoder::DecodeDataWord(unsigned char* data, bool datalong) {
     R3BPixHit hit();
@@ -2,12 +2,18 @@
 #define R3B_ALPIDEDECODER_H
 
 #include <vector>
+#include <string>
+#include <array>
 #include <memory>
 #include <stdint.h>
 #include <R3BPixHit.h>
+#include "R3BHitBuffer.h"
+#include "R3BFillerSkip.h"
+#include "R3BDecodeErrors.h"
+#include "R3BPixelMask.h"
 #include "Common.h"
 
-enum class AlpideDataType {
+enum class AlpideDataType : uint8_t {
 	kIDLE,
 	kCHIPHEADER,
 	kCHIPTRAILER,
@@ -20,6 +26,58 @@ enum class AlpideDataType {
 	kUNKNOWN
 };
 
+/* Type and length (in bytes) of a data word, both fixed by its leading byte */
+struct AlpideWord {
+	AlpideDataType type;
+	uint8_t length;
+};
+
+/* Reference classification of a leading byte, evaluated at compile time to fill the word table */
+constexpr AlpideWord ClassifyAlpideWord(unsigned char dataWord) {
+    if     (dataWord == 0xff)          return {AlpideDataType::kIDLE, 1};
+    else if(dataWord == 0xf1)          return {AlpideDataType::kBUSYON, 1};
+    else if(dataWord == 0xf0)          return {AlpideDataType::kBUSYOFF, 1};
+    else if((dataWord & 0xf0) == 0xa0) return {AlpideDataType::kCHIPHEADER, 2};
+    else if((dataWord & 0xf0) == 0xb0) return {AlpideDataType::kCHIPTRAILER, 1};
+    else if((dataWord & 0xf0) == 0xe0) return {AlpideDataType::kEMPTYFRAME, 2};
+    else if((dataWord & 0xe0) == 0xc0) return {AlpideDataType::kREGIONHEADER, 1};
+    else if((dataWord & 0xc0) == 0x40) return {AlpideDataType::kDATASHORT, 2};
+    else if((dataWord & 0xc0) == 0x00) return {AlpideDataType::kDATALONG, 3};
+    else return {AlpideDataType::kUNKNOWN, 1};
+}
+
+constexpr std::array<AlpideWord, 256> MakeAlpideWordTable() {
+	std::array<AlpideWord, 256> table{};
+	for(int i=0; i<256; ++i) table[i] = ClassifyAlpideWord((unsigned char)i);
+	return table;
+}
+
+/* How much DecodeEvent() checks, see R3BDecodePolicy */
+enum class DecodeValidation : uint8_t {
+	kFULL,     // every word and pixel, bad hits flagged kSTUCK / kBAD_* (commissioning)
+	kCOUNTERS, // word level errors counted, pixels taken as they come
+	kNONE      // nothing counted, a bad word still ends the event
+};
+
+/* Compile-time decoder variant. Clustering: the chips send DATALONG words; without
+ * it these still decode, out of line, and are counted as kUNEXPECTED_DATALONG
+ * unless validation is kNONE. */
+template<bool Clustering, DecodeValidation Validation>
+struct R3BDecodePolicy {
+	static constexpr bool kClustering = Clustering;
+	static constexpr DecodeValidation kValidation = Validation;
+};
+using R3BFullDecodePolicy = R3BDecodePolicy<true, DecodeValidation::kFULL>;
+
+/* The same, picked at run time, e.g. from the command line at scan start */
+struct R3BDecodeMode {
+	bool clustering = true;
+	DecodeValidation validation = DecodeValidation::kFULL;
+};
+const char* GetDecodeValidationName(DecodeValidation validation);
+// "full", "counters" or "none", false if it is none of those
+bool ParseDecodeValidation(const std::string& name, DecodeValidation& validation);
+
 class R3BAlpideDecoder {
 	friend class R3BStorePixHit;
 
@@ -32,25 +90,83 @@ class R3BAlpideDecoder {
     uint32_t tlo;			// Current status of timestamp
     uint32_t thi;			// Current status of timestamp
 
-    AlpideDataType fDataType;    // type of the data word currently being decoded
-
+    FillerSkipFn fSkipFiller; // jumps over runs of IDLE/BUSY bytes, SIMD when the CPU allows
+    uint32_t fTimeIndex;      // index of the current trigger time in fHits
 
-    // Hit pixel list with all decoded hits for the current event
+    // Hit pixel list with all decoded hits for the current event, 8 bytes per hit
 	// The most important field of the class
-    std::vector<R3BPixHit> fHits;
+    R3BHitBuffer fHits;
+    std::vector<R3BHitBuffer> fSpareHits; // buffers handed back by RecycleHits(), reused by TakeHits()
+    size_t fHitLimit;                     // max hits held at once, 0 = unbounded
+
+    // position inside the event being decoded, kept so a suspended event can be resumed
+    unsigned char* fData;
+    int fNBytes;
+    int fByte;
+    bool fStarted;      // event has started, i.e. chip header has been found
+    bool fFinished;     // event trailer found
+    bool fCorrupt;      // corrupt data found (i.e. data without region or chip)
+    bool fSuspended;    // stopped on fHitLimit, waiting for ResumeEvent()
+
+    R3BDecodeErrors fErrors; // bad words and pixels, nothing is printed per hit
+    R3BDecodeMode fMode;
+    const R3BPixelMask* fMask;     // not owned
+    const uint64_t* fMaskBits;     // fMask's bits of fChipId, nullptr if none
+    bool (R3BAlpideDecoder::*fDecodeFn)(); // Decode<Policy> of fMode
+    bool (R3BAlpideDecoder::*fResumeFn)(); // the one the current event started with
 
 public:
     R3BAlpideDecoder();
-	inline void SetBoard(uint32_t board) {fBoardIndex = board;} 
-     /* Main method of the class - decode each event read by the readout board */
+	inline void SetBoard(uint32_t board) {fBoardIndex = board; fHits.SetBoardIndex(board);} 
+	// choose the filler skipping variant, kAUTO (default) uses the widest SIMD available
+	inline void SetFillerSkip(FillerSkipImpl impl) {fSkipFiller = GetFillerSkip(impl);}
+     /* Main method of the class - decode each event read by the readout board.
+      * The hit buffer is event scoped: it is cleared (capacity kept) at the start of each call.
+      * Decodes with the variant chosen by SetDecodeMode(), full validation by default. */
     bool DecodeEvent(unsigned char* data, int nBytes);
+    // the same with the variant fixed at compile time, instantiated for every R3BDecodePolicy
+    template<class Policy> bool DecodeEvent(unsigned char* data, int nBytes);
+
+    void SetDecodeMode(const R3BDecodeMode& mode);
+    inline const R3BDecodeMode& GetDecodeMode() const {return fMode;}
+
+    /* Hits of the pixels set in the mask are dropped, counted in GetErrors().
+     * Not owned, nullptr (default) for none. */
+    inline void SetPixelMask(const R3BPixelMask* mask) {fMask = mask && !mask->IsEmpty() ? mask : nullptr; fMaskBits = nullptr;}
+
+    /* Memory-bounded mode: with a limit set, decoding stops at the word which would
+     * push fHits over it and IsSuspended() turns true. The caller drains GetHits()
+     * and calls ResumeEvent() to continue on the same data, until IsSuspended() is false.
+     * The return value of the last call covers the whole event. */
+    inline void SetHitLimit(size_t maxHits) {fHitLimit = (maxHits && maxHits < 8) ? 8 : maxHits;}
+    inline bool IsSuspended() const {return fSuspended;}
+    bool ResumeEvent();
+
+    // zero-copy view of the hits of the current event (or event chunk when suspended)
+    inline const R3BHitBuffer& GetHits() const {return fHits;}
+
+    // moves the hits out, the decoder continues with a spare buffer. Give the buffer
+    // back with RecycleHits() once consumed so steady state runs without allocations.
+    R3BHitBuffer TakeHits();
+    void RecycleHits(R3BHitBuffer&& hits);
+
+    // lead byte -> (type, length), 512 bytes in total so it stays in L1
+    static constexpr std::array<AlpideWord, 256> kWordTable = MakeAlpideWordTable();
+
+    // type and length of the data word starting with the given byte, single table lookup
+    static inline AlpideWord GetWord(unsigned char leadByte) {return kWordTable[leadByte];}
+
+    // error counters since construction, see R3BDecodeErrors
+    inline const R3BDecodeErrors& GetErrors() const {return fErrors;}
+    inline R3BDecodeErrors& GetErrors() {return fErrors;}
         
 private:
-    // find the data type of the given data word
-    void FindDataType(unsigned char dataWord);
-    
-    // return the length of the data word depending on its data type
-    int GetWordLength() const;
+    // resets the event state, DecodeEvent() without the decoding
+    void BeginEvent(unsigned char* data, int nBytes);
+    // runs the word loop from fByte until the end of fData or until fHitLimit is hit
+    template<class Policy> bool Decode();
+    // counts the finished event, prints the rate-limited error summary
+    bool EndEvent(bool ok);
     
     // extract the bunch counter and chip id from a data word of type "chip header"
     void DecodeChipHeader(unsigned char* data);
@@ -64,8 +180,12 @@ private:
     // extract the bunch counter and chip id from a data word of type "empty frame"
     void DecodeEmptyFrame(unsigned char* data);
    
-	bool DecodeDataShort(unsigned char* data);
-	bool DecodeDataLong(unsigned char* data);
+	template<class Policy> bool DecodeDataShort(unsigned char* data);
+	template<class Policy> bool DecodeDataLong(unsigned char* data);
+	template<class Policy> bool DecodeUnexpectedDataLong(unsigned char* data);
+
+	// validates one decoded pixel against the previous hit and appends it to fHits, true if corrupt
+	template<class Policy> bool AddHit(uint32_t dcol, uint32_t address);
 };
 
 #endif
@@ -0,0 +1,86 @@
+#include "R3BByteSwap.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define R3B_BYTESWAP_X86
+#include <immintrin.h>
+#endif
+
+static void SwapScalar(unsigned char* dst, const unsigned char* src, size_t nWords) {
+	for(size_t i=0; i<nWords; ++i) {
+		uint32_t w;
+		memcpy(&w, src + 4*i, 4);
+		w = __builtin_bswap32(w);
+		memcpy(dst + 4*i, &w, 4);
+	}
+}
+
+#ifdef R3B_BYTESWAP_X86
+__attribute__((target("ssse3")))
+static void SwapSSSE3(unsigned char* dst, const unsigned char* src, size_t nWords) {
+	const __m128i shuffle = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	size_t i = 0;
+	for(; i + 4 <= nWords; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + 4*i));
+		_mm_storeu_si128((__m128i*)(dst + 4*i), _mm_shuffle_epi8(v, shuffle));
+	}
+	SwapScalar(dst + 4*i, src + 4*i, nWords - i);
+}
+
+__attribute__((target("avx2")))
+static void SwapAVX2(unsigned char* dst, const unsigned char* src, size_t nWords) {
+	// vpshufb works within each 128-bit lane, the same pattern for both
+	const __m256i shuffle = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	                                         3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	size_t i = 0;
+	for(; i + 16 <= nWords; i += 16) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(src + 4*i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(src + 4*i + 32));
+		_mm256_storeu_si256((__m256i*)(dst + 4*i), _mm256_shuffle_epi8(a, shuffle));
+		_mm256_storeu_si256((__m256i*)(dst + 4*i + 32), _mm256_shuffle_epi8(b, shuffle));
+	}
+	SwapSSSE3(dst + 4*i, src + 4*i, nWords - i);
+}
+#endif
+
+ByteSwapImpl ResolveByteSwap(ByteSwapImpl impl) {
+#ifdef R3B_BYTESWAP_X86
+	__builtin_cpu_init();
+	const bool hasAVX2 = __builtin_cpu_supports("avx2");
+	const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+	switch(impl) {
+		case ByteSwapImpl::kAUTO:
+			return hasAVX2 ? ByteSwapImpl::kAVX2 : (hasSSSE3 ? ByteSwapImpl::kSSSE3 : ByteSwapImpl::kSCALAR);
+		case ByteSwapImpl::kAVX2:
+			return hasAVX2 ? impl : ByteSwapImpl::kSCALAR;
+		case ByteSwapImpl::kSSSE3:
+			return hasSSSE3 ? impl : ByteSwapImpl::kSCALAR;
+		default:
+			return ByteSwapImpl::kSCALAR;
+	}
+#else
+	(void)impl;
+	return ByteSwapImpl::kSCALAR;
+#endif
+}
+
+ByteSwapFn GetByteSwap(ByteSwapImpl impl) {
+	switch(ResolveByteSwap(impl)) {
+#ifdef R3B_BYTESWAP_X86
+		case ByteSwapImpl::kAVX2:  return &SwapAVX2;
+		case ByteSwapImpl::kSSSE3: return &SwapSSSE3;
+#endif
+		default: return &SwapScalar;
+	}
+}
+
+const char* GetByteSwapName(ByteSwapImpl impl) {
+	switch(impl) {
+		case ByteSwapImpl::kAUTO:   return "auto";
+		case ByteSwapImpl::kSCALAR: return "scalar";
+		case ByteSwapImpl::kSSSE3:  return "ssse3";
+		case ByteSwapImpl::kAVX2:   return "avx2";
+	}
+	return "unknown";
+}
@@ -0,0 +1,24 @@
+#ifndef R3B_BYTESWAP_H
+#define R3B_BYTESWAP_H
+
+/* Reverses the bytes of every 32-bit word, for the big-endian words the
+ * drasi/ucesb chain unpacks the ALPIDE stream from (see R3BLmdWriter).
+ * dst may be src: the swap then happens in place. Like R3BFillerSkip, the SIMD
+ * variants are x86 only and kAUTO takes the widest one the CPU supports. */
+
+#include <stddef.h>
+
+enum class ByteSwapImpl {
+	kAUTO,
+	kSCALAR,
+	kSSSE3,
+	kAVX2
+};
+
+typedef void (*ByteSwapFn)(unsigned char* dst, const unsigned char* src, size_t nWords);
+
+ByteSwapImpl ResolveByteSwap(ByteSwapImpl impl);
+ByteSwapFn GetByteSwap(ByteSwapImpl impl = ByteSwapImpl::kAUTO);
+const char* GetByteSwapName(ByteSwapImpl impl);
+
+#endif
@@ -0,0 +1,160 @@
+#include "R3BDecodeErrors.h"
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+const char* GetDecodeErrorName(DecodeError error) {
+	switch(error) {
+		case DecodeError::kUNKNOWN_WORD:          return "unknown_word";
+		case DecodeError::kDATA_OUTSIDE_EVENT:    return "data_outside_event";
+		case DecodeError::kREGION_OUTSIDE_EVENT:  return "region_outside_event";
+		case DecodeError::kTRAILER_OUTSIDE_EVENT: return "trailer_outside_event";
+		case DecodeError::kTRAILER_TWICE:         return "trailer_twice";
+		case DecodeError::kEVENT_NOT_FINISHED:    return "event_not_finished";
+		case DecodeError::kEVENT_NOT_STARTED:     return "event_not_started";
+		case DecodeError::kNO_REGION:             return "no_region";
+		case DecodeError::kUNEXPECTED_DATALONG:   return "unexpected_datalong";
+		case DecodeError::kDUPLICATE_PIXEL:       return "duplicate_pixel";
+		case DecodeError::kADDRESS_ORDER:         return "address_order";
+		case DecodeError::kBAD_CHIPID:            return "bad_chipid";
+		case DecodeError::kBAD_REGIONID:          return "bad_regionid";
+		case DecodeError::kBAD_DCOLID:            return "bad_dcolid";
+		case DecodeError::kBAD_ADDRESS:           return "bad_address";
+		default:                                  return "unknown";
+	}
+}
+
+R3BDecodeErrors::R3BDecodeErrors() :
+	fSummaryInterval(DEFAULT_SUMMARY_INTERVAL) {
+		Clear();
+	}
+
+void R3BDecodeErrors::Clear() {
+	fTotal = {};
+	fSinceSummary = {};
+	fChip = {};
+	fRegion = {};
+	fDcol = {};
+	fMasked = {};
+	fNPending = 0;
+	fNEvents = 0;
+	fNBadEvents = 0;
+	fLastSummary = chrono::steady_clock::now();
+}
+
+uint64_t R3BDecodeErrors::GetNErrors() const {
+	uint64_t n = 0;
+	for(auto c : fTotal) n += c;
+	return n;
+}
+
+uint64_t R3BDecodeErrors::GetNMasked() const {
+	uint64_t n = 0;
+	for(auto c : fMasked) n += c;
+	return n;
+}
+
+void R3BDecodeErrors::Summarise(bool force) {
+	const auto now = chrono::steady_clock::now();
+	if(!force && now - fLastSummary < fSummaryInterval) return;
+	fLastSummary = now;
+	if(!fNPending) return;
+	cerr << "R3BAlpideDecoder - " << fNPending << " decoding errors since the last summary:";
+	for(int e=0; e<N_ERRORS; ++e) {
+		if(fSinceSummary[e]) cerr << " " << GetDecodeErrorName(static_cast<DecodeError>(e)) << " " << fSinceSummary[e];
+	}
+	cerr << " (" << fNBadEvents << " of " << fNEvents << " events affected so far)" << endl;
+	fSinceSummary = {};
+	fNPending = 0;
+}
+
+void R3BDecodeErrors::Merge(const R3BDecodeErrors& other) {
+	for(int e=0; e<N_ERRORS; ++e) {
+		fTotal[e] += other.fTotal[e];
+		fSinceSummary[e] += other.fSinceSummary[e];
+	}
+	for(int c=0; c<=NO_CHIP; ++c) {
+		for(int e=0; e<N_ERRORS; ++e) fChip[c][e] += other.fChip[c][e];
+		for(int r=0; r<N_REGIONS; ++r) fRegion[c][r] += other.fRegion[c][r];
+		for(int d=0; d<N_DCOLS; ++d) fDcol[c][d] += other.fDcol[c][d];
+		fMasked[c] += other.fMasked[c];
+	}
+	fNPending += other.fNPending;
+	fNEvents += other.fNEvents;
+	fNBadEvents += other.fNBadEvents;
+}
+
+void R3BDecodeErrors::Print() const {
+	const uint64_t n = GetNErrors();
+	printf("R3BDecodeErrors : %lu errors, %lu of %lu events affected\n", (unsigned long)n, (unsigned long)fNBadEvents, (unsigned long)fNEvents);
+	if(GetNMasked()) printf("R3BDecodeErrors : %lu hits of masked pixels dropped\n", (unsigned long)GetNMasked());
+	if(!n) return;
+	for(int c=0; c<=NO_CHIP; ++c) {
+		uint64_t nChip = 0;
+		for(auto x : fChip[c]) nChip += x;
+		if(!nChip) continue;
+		if(c == NO_CHIP) printf("R3BDecodeErrors : no chip |");
+		else printf("R3BDecodeErrors : chip %2d |", c);
+		for(int e=0; e<N_ERRORS; ++e) {
+			if(fChip[c][e]) printf(" %s %lu", GetDecodeErrorName(static_cast<DecodeError>(e)), (unsigned long)fChip[c][e]);
+		}
+		// the double column with most pixel errors, a stuck pixel shows up there
+		int worst = 0;
+		for(int d=1; d<N_DCOLS; ++d) if(fDcol[c][d] > fDcol[c][worst]) worst = d;
+		if(fDcol[c][worst]) printf(" | worst dcol %d (%u)", worst, fDcol[c][worst]);
+		printf("\n");
+	}
+}
+
+bool R3BDecodeErrors::Write(const string& fileName) const {
+	FILE* f = fopen(fileName.c_str(), "w");
+	if(!f) {
+		cerr << "R3BDecodeErrors::Write() - can't open " << fileName << endl;
+		return false;
+	}
+	auto writeKinds = [&](const array<uint64_t, N_ERRORS>& counts) {
+		fprintf(f, "{");
+		bool first = true;
+		for(int e=0; e<N_ERRORS; ++e) {
+			if(!counts[e]) continue;
+			fprintf(f, "%s\"%s\": %lu", first ? "" : ", ", GetDecodeErrorName(static_cast<DecodeError>(e)), (unsigned long)counts[e]);
+			first = false;
+		}
+		fprintf(f, "}");
+	};
+	// {"index": count} of the nonzero entries
+	auto writeSparse = [&](const uint32_t* counts, int n) {
+		fprintf(f, "{");
+		bool first = true;
+		for(int i=0; i<n; ++i) {
+			if(!counts[i]) continue;
+			fprintf(f, "%s\"%d\": %u", first ? "" : ", ", i, counts[i]);
+			first = false;
+		}
+		fprintf(f, "}");
+	};
+
+	fprintf(f, "{\n  \"events\": %lu,\n  \"bad_events\": %lu,\n  \"masked_hits\": %lu,\n  \"errors\": ", (unsigned long)fNEvents,
+		(unsigned long)fNBadEvents, (unsigned long)GetNMasked());
+	writeKinds(fTotal);
+	fprintf(f, ",\n  \"chips\": [");
+	bool first = true;
+	for(int c=0; c<=NO_CHIP; ++c) {
+		uint64_t nChip = 0;
+		for(auto x : fChip[c]) nChip += x;
+		if(!nChip) continue;
+		fprintf(f, "%s\n    {\"chip\": %d, \"errors\": ", first ? "" : ",", c == NO_CHIP ? -1 : c); // -1: outside of a chip event
+		writeKinds(fChip[c]);
+		fprintf(f, ", \"regions\": ");
+		writeSparse(fRegion[c].data(), N_REGIONS);
+		fprintf(f, ", \"dcols\": ");
+		writeSparse(fDcol[c].data(), N_DCOLS);
+		fprintf(f, "}");
+		first = false;
+	}
+	fprintf(f, "\n  ]\n}\n");
+	const bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
@@ -0,0 +1,111 @@
+#ifndef R3B_DECODEERRORS_H
+#define R3B_DECODEERRORS_H
+
+/* >> What went wrong while decoding, counted instead of printed
+ * R3BAlpideDecoder only increments counters on a bad word or pixel: per error
+ * kind, per chip and kind, and for the pixel errors per region and double
+ * column. The words seen outside of a chip event have their own bucket next to
+ * the 16 chips, NO_CHIP.
+ * At most one summary of the errors since the previous one is printed per
+ * interval (SetSummaryInterval, 0 = never); Print() and Write() dump the totals,
+ * e.g. once per scan. Takes the role TErrorCounter had in the ALPIDE framework. */
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+
+enum class DecodeError {
+	// word level, the event is dropped from there on
+	kUNKNOWN_WORD,
+	kDATA_OUTSIDE_EVENT,    // hit data before the chip header / after the trailer
+	kREGION_OUTSIDE_EVENT,
+	kTRAILER_OUTSIDE_EVENT,
+	kTRAILER_TWICE,
+	kEVENT_NOT_FINISHED,    // no trailer at the end of the data
+	kEVENT_NOT_STARTED,     // no chip header or empty frame in the data
+	// pixel level, the hit is kept with a flag
+	kNO_REGION,             // data word before any region header
+	kUNEXPECTED_DATALONG,   // DATALONG word while the decode mode says clustering is off
+	kDUPLICATE_PIXEL,
+	kADDRESS_ORDER,         // address lower than the previous one of the double column
+	kBAD_CHIPID,
+	kBAD_REGIONID,
+	kBAD_DCOLID,
+	kBAD_ADDRESS,
+	kN_ERRORS
+};
+
+const char* GetDecodeErrorName(DecodeError error);
+
+class R3BDecodeErrors {
+public:
+	static const int N_ERRORS  = static_cast<int>(DecodeError::kN_ERRORS);
+	static const int N_CHIPS   = 16;
+	static const int NO_CHIP   = N_CHIPS; // bucket of the errors outside of a chip event
+	static const int N_REGIONS = 32;
+	static const int N_DCOLS   = 512;
+	static const int DEFAULT_SUMMARY_INTERVAL = 10; // s
+
+private:
+	std::array<uint64_t, N_ERRORS> fTotal;
+	std::array<uint64_t, N_ERRORS> fSinceSummary;
+	std::array<std::array<uint64_t, N_ERRORS>, N_CHIPS+1> fChip;    // [NO_CHIP]: outside of a chip event
+	std::array<std::array<uint32_t, N_REGIONS>, N_CHIPS+1> fRegion; // pixel errors
+	std::array<std::array<uint32_t, N_DCOLS>, N_CHIPS+1> fDcol;     // pixel errors
+	std::array<uint64_t, N_CHIPS+1> fMasked; // hits dropped by the pixel mask, not errors
+	uint64_t fNPending;      // errors since the last summary
+	uint64_t fNEvents;
+	uint64_t fNBadEvents;    // events with at least one error
+	std::chrono::seconds fSummaryInterval;
+	std::chrono::steady_clock::time_point fLastSummary;
+
+	// the decoder's chip id is -1 between chip events
+	static inline int Bucket(uint32_t chipId) {return chipId < (uint32_t)N_CHIPS ? chipId : NO_CHIP;}
+
+public:
+	R3BDecodeErrors();
+
+	void Clear();
+	inline void SetSummaryInterval(int seconds) {fSummaryInterval = std::chrono::seconds(seconds);}
+
+	/* hot path: counters only */
+	inline void Count(DecodeError error, uint32_t chipId) {
+		const int e = static_cast<int>(error);
+		++fTotal[e];
+		++fSinceSummary[e];
+		++fChip[Bucket(chipId)][e];
+		++fNPending;
+	}
+	inline void CountPixel(DecodeError error, uint32_t chipId, uint32_t region, uint32_t dcol) {
+		Count(error, chipId);
+		if(region < N_REGIONS) ++fRegion[Bucket(chipId)][region];
+		if(dcol < N_DCOLS) ++fDcol[Bucket(chipId)][dcol];
+	}
+	inline void CountEvent(bool bad) {++fNEvents; if(bad) ++fNBadEvents;}
+	inline void CountMasked(uint32_t chipId) {++fMasked[Bucket(chipId)];}
+
+	/* once per event: prints the summary if errors are pending and the interval passed */
+	inline void MaybeSummarise() {if(fNPending && fSummaryInterval.count() > 0) Summarise(false);}
+	// prints the errors since the previous summary, now
+	void Summarise(bool force = true);
+
+	inline uint64_t GetTotal(DecodeError error) const {return fTotal[static_cast<int>(error)];}
+	inline uint64_t GetCount(int chipId, DecodeError error) const {return fChip[Bucket(chipId)][static_cast<int>(error)];}
+	inline uint32_t GetRegionCount(int chipId, int region) const {return fRegion[Bucket(chipId)][region];}
+	inline uint32_t GetDcolCount(int chipId, int dcol) const {return fDcol[Bucket(chipId)][dcol];}
+	inline uint64_t GetNEvents() const {return fNEvents;}
+	inline uint64_t GetNBadEvents() const {return fNBadEvents;}
+	uint64_t GetNErrors() const;
+	inline uint64_t GetNMasked(int chipId) const {return fMasked[Bucket(chipId)];}
+	uint64_t GetNMasked() const;
+
+	// adds the counts of another decoder, e.g. one per thread
+	void Merge(const R3BDecodeErrors& other);
+
+	void Print() const;
+	/* JSON dump of the totals, per chip, and the regions / double columns with errors */
+	bool Write(const std::string& fileName) const;
+};
+
+#endif
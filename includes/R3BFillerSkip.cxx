@@ -0,0 +1,84 @@
+#include "R3BFillerSkip.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define R3B_FILLERSKIP_X86
+#include <immintrin.h>
+#endif
+
+static int SkipFillerScalar(const unsigned char* data, int byte, int nBytes) {
+	while(byte < nBytes && IsFillerByte(data[byte])) ++byte;
+	return byte;
+}
+
+#ifdef R3B_FILLERSKIP_X86
+__attribute__((target("sse2")))
+static int SkipFillerSSE2(const unsigned char* data, int byte, int nBytes) {
+	const __m128i idle = _mm_set1_epi8((char)0xff);
+	const __m128i busy = _mm_set1_epi8((char)0xf0);
+	const __m128i busyMask = _mm_set1_epi8((char)0xfe);
+	for(; byte + 16 <= nBytes; byte += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(data + byte));
+		__m128i filler = _mm_or_si128(_mm_cmpeq_epi8(v, idle),
+		                              _mm_cmpeq_epi8(_mm_and_si128(v, busyMask), busy));
+		unsigned mask = (unsigned)_mm_movemask_epi8(filler);
+		if(mask != 0xffff) return byte + __builtin_ctz(~mask);
+	}
+	return SkipFillerScalar(data, byte, nBytes);
+}
+
+__attribute__((target("avx2")))
+static int SkipFillerAVX2(const unsigned char* data, int byte, int nBytes) {
+	const __m256i idle = _mm256_set1_epi8((char)0xff);
+	const __m256i busy = _mm256_set1_epi8((char)0xf0);
+	const __m256i busyMask = _mm256_set1_epi8((char)0xfe);
+	for(; byte + 32 <= nBytes; byte += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(data + byte));
+		__m256i filler = _mm256_or_si256(_mm256_cmpeq_epi8(v, idle),
+		                                 _mm256_cmpeq_epi8(_mm256_and_si256(v, busyMask), busy));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(filler);
+		if(mask != 0xffffffffu) return byte + __builtin_ctz(~mask);
+	}
+	return SkipFillerSSE2(data, byte, nBytes);
+}
+#endif
+
+FillerSkipImpl ResolveFillerSkip(FillerSkipImpl impl) {
+#ifdef R3B_FILLERSKIP_X86
+	__builtin_cpu_init();
+	const bool hasAVX2 = __builtin_cpu_supports("avx2");
+	const bool hasSSE2 = __builtin_cpu_supports("sse2");
+	switch(impl) {
+		case FillerSkipImpl::kAUTO:
+			return hasAVX2 ? FillerSkipImpl::kAVX2 : (hasSSE2 ? FillerSkipImpl::kSSE2 : FillerSkipImpl::kSCALAR);
+		case FillerSkipImpl::kAVX2:
+			return hasAVX2 ? impl : FillerSkipImpl::kSCALAR;
+		case FillerSkipImpl::kSSE2:
+			return hasSSE2 ? impl : FillerSkipImpl::kSCALAR;
+		default:
+			return FillerSkipImpl::kSCALAR;
+	}
+#else
+	(void)impl;
+	return FillerSkipImpl::kSCALAR;
+#endif
+}
+
+FillerSkipFn GetFillerSkip(FillerSkipImpl impl) {
+	switch(ResolveFillerSkip(impl)) {
+#ifdef R3B_FILLERSKIP_X86
+		case FillerSkipImpl::kAVX2: return &SkipFillerAVX2;
+		case FillerSkipImpl::kSSE2: return &SkipFillerSSE2;
+#endif
+		default: return &SkipFillerScalar;
+	}
+}
+
+const char* GetFillerSkipName(FillerSkipImpl impl) {
+	switch(impl) {
+		case FillerSkipImpl::kAUTO:   return "auto";
+		case FillerSkipImpl::kSCALAR: return "scalar";
+		case FillerSkipImpl::kSSE2:   return "sse2";
+		case FillerSkipImpl::kAVX2:   return "avx2";
+	}
+	return "unknown";
+}
@@ -0,0 +1,27 @@
+#ifndef R3B_FILLERSKIP_H
+#define R3B_FILLERSKIP_H
+
+/* Fast skip over the IDLE (0xff) and BUSY ON/OFF (0xf1/0xf0) bytes that pad
+ * MOSAIC buffers. All three are single-byte words, so from any lead byte
+ * position the next real word starts at the first byte that isn't filler.
+ * The SIMD variants are only compiled for x86; kAUTO picks the widest one the
+ * running CPU supports, kSCALAR is always available and is the reference. */
+
+enum class FillerSkipImpl {
+	kAUTO,
+	kSCALAR,
+	kSSE2,
+	kAVX2
+};
+
+/* Returns the index of the first non-filler byte in [byte, nBytes), or nBytes */
+typedef int (*FillerSkipFn)(const unsigned char* data, int byte, int nBytes);
+
+inline bool IsFillerByte(unsigned char b) {return b == 0xff || (b & 0xfe) == 0xf0;}
+
+// kAUTO resolves to the best supported variant, unsupported requests fall back to kSCALAR
+FillerSkipImpl ResolveFillerSkip(FillerSkipImpl impl);
+FillerSkipFn GetFillerSkip(FillerSkipImpl impl = FillerSkipImpl::kAUTO);
+const char* GetFillerSkipName(FillerSkipImpl impl);
+
+#endif
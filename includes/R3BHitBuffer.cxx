@@ -0,0 +1,42 @@
+#include "R3BHitBuffer.h"
+
+void R3BHitBuffer::Reserve(size_t nHits) {
+	fHits.reserve(nHits);
+}
+
+void R3BHitBuffer::Clear() {
+	fHits.clear();
+	fTriggerTimes.clear();
+}
+
+/* Consecutive events with the same trigger time share one entry */
+uint32_t R3BHitBuffer::AddTriggerTime(uint64_t time) {
+	if(fTriggerTimes.empty() || fTriggerTimes.back() != time) fTriggerTimes.push_back(time);
+	return fTriggerTimes.size() - 1;
+}
+
+void R3BHitBuffer::Append(const R3BHitBuffer& other) {
+	if(other.Empty()) return;
+	const size_t n = Size();
+	fHits.insert(fHits.end(), other.fHits.begin(), other.fHits.end());
+	/* the usual case: one trigger time for all of them */
+	if(other.fTriggerTimes.size() == 1) {
+		const uint32_t index = AddTriggerTime(other.fTriggerTimes.front());
+		for(size_t i=n; i<fHits.size(); ++i) fHits[i].SetTimeIndex(index);
+		return;
+	}
+	for(size_t i=n; i<fHits.size(); ++i) fHits[i].SetTimeIndex(AddTriggerTime(other.fTriggerTimes[fHits[i].GetTimeIndex()]));
+}
+
+R3BPixHit R3BHitBuffer::GetPixHit(size_t i) const {
+	return R3BPixHit(Get(i), fBoardIndex, GetTriggerTime(i));
+}
+
+bool R3BHitBuffer::operator==(const R3BHitBuffer& rhs) const {
+	if(Size() != rhs.Size()) return false;
+	for(size_t i=0; i<Size(); ++i) {
+		if((Get(i).GetWord() & 0xffffffff) != (rhs.Get(i).GetWord() & 0xffffffff)) return false; // all but the time index
+		if(GetTriggerTime(i) != rhs.GetTriggerTime(i)) return false;
+	}
+	return true;
+}
@@ -0,0 +1,119 @@
+#ifndef R3B_HITBUFFER_H
+#define R3B_HITBUFFER_H
+
+/* Compact hit storage for the decoder hot path.
+ * R3BPackedHit squeezes one hit into a single 64-bit word:
+ *   [3:0] chip id | [13:4] double column | [24:14] address | [28:25] flag | [63:32] trigger time index
+ * Double column and address get one extra bit each, so out-of-range values
+ * (the ones that earn a kBAD_* flag) are stored as decoded, not truncated.
+ * The trigger time itself lives once per event in the buffer, hits only keep its index.
+ *
+ * R3BHitBuffer stores the hits as packed words, 8 bytes per hit against 40 for
+ * R3BPixHit. A hit after the chip trailer, flagged kBAD_CHIPID, keeps only the
+ * 4 bits of the chip id. R3BPixHit can still be built from any entry for the
+ * callers which want the full object. */
+
+#include "R3BPixHit.h"
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+class R3BPackedHit {
+	uint64_t fWord;
+
+public:
+	static const uint32_t CHIP_BITS    = 4;
+	static const uint32_t DCOL_BITS    = 10;
+	static const uint32_t ADDRESS_BITS = 11;
+	static const uint32_t FLAG_BITS    = 4;
+
+	R3BPackedHit() : fWord(0) {}
+	R3BPackedHit(uint32_t chipId, uint32_t dcol, uint32_t address, AlpidePixFlag flag, uint32_t timeIndex) :
+		fWord( (uint64_t)(chipId & 0xf)
+			| ((uint64_t)(dcol & 0x3ff) << 4)
+			| ((uint64_t)(address & 0x7ff) << 14)
+			| ((uint64_t)((uint32_t)flag & 0xf) << 25)
+			| ((uint64_t)timeIndex << 32)) {}
+
+	inline uint32_t GetChipId() const {return fWord & 0xf;}
+	inline uint32_t GetDoubleColumn() const {return (fWord >> 4) & 0x3ff;}
+	inline uint32_t GetAddress() const {return (fWord >> 14) & 0x7ff;}
+	inline AlpidePixFlag GetPixFlag() const {return (AlpidePixFlag)((fWord >> 25) & 0xf);}
+	inline uint32_t GetTimeIndex() const {return fWord >> 32;}
+	inline uint32_t GetRegion() const {return GetDoubleColumn() / common::NDCOL_PER_REGION;}
+	inline uint64_t GetWord() const {return fWord;}
+
+	inline void SetPixFlag(AlpidePixFlag flag) {fWord = (fWord & ~((uint64_t)0xf << 25)) | ((uint64_t)((uint32_t)flag & 0xf) << 25);}
+	inline void SetTimeIndex(uint32_t timeIndex) {fWord = (fWord & 0xffffffff) | ((uint64_t)timeIndex << 32);}
+};
+
+static_assert(sizeof(R3BPackedHit) <= 8, "R3BPackedHit has to fit in 8 bytes");
+
+/* Pixel coordinates from the (double column, address) pair, same mapping as R3BPixHit */
+inline uint32_t AlpideRow(uint32_t address) {
+	uint32_t row = address / 2;
+	if((address % 4) == 3) row -= 1;
+	if((address % 4) == 0) row += 1;
+	return row;
+}
+inline uint32_t AlpideColumn(uint32_t dcol, uint32_t address) {
+	return dcol * 2 + (((address % 4) == 1 || (address % 4) == 2) ? 1 : 0);
+}
+// the inverse, the double column being col / 2
+inline uint32_t AlpideAddress(uint32_t row, uint32_t col) {
+	const uint32_t base = (row / 2) * 4;
+	if(row % 2 == 0) return base + ((col % 2) ? 1 : 3);
+	return base + ((col % 2) ? 2 : 0);
+}
+
+class R3BHitBuffer {
+	uint32_t fBoardIndex;                // board the hits were read from
+	std::vector<R3BPackedHit> fHits;     // time index into fTriggerTimes
+	std::vector<uint64_t> fTriggerTimes; // thi << 32 | tlo, one per event
+
+public:
+	R3BHitBuffer() : fBoardIndex(0) {}
+
+	void Reserve(size_t nHits);
+	// drops the hits but keeps the allocated memory
+	void Clear();
+
+	inline size_t Size() const {return fHits.size();}
+	inline bool Empty() const {return fHits.empty();}
+	inline size_t Capacity() const {return fHits.capacity();}
+
+	inline void SetBoardIndex(uint32_t board) {fBoardIndex = board;}
+	inline uint32_t GetBoardIndex() const {return fBoardIndex;}
+
+	// registers the trigger time of the hits which follow, returns its index
+	uint32_t AddTriggerTime(uint64_t time);
+
+	// appends the hits of another buffer, its trigger times registered here
+	void Append(const R3BHitBuffer& other);
+
+	inline void PushBack(uint32_t chipId, uint32_t dcol, uint32_t address, AlpidePixFlag flag, uint32_t timeIndex) {
+		fHits.emplace_back(chipId, dcol, address, flag, timeIndex);
+	}
+
+	inline uint32_t GetChipId(size_t i) const {return fHits[i].GetChipId();}
+	inline uint32_t GetDoubleColumn(size_t i) const {return fHits[i].GetDoubleColumn();}
+	inline uint32_t GetAddress(size_t i) const {return fHits[i].GetAddress();}
+	inline uint32_t GetRegion(size_t i) const {return fHits[i].GetRegion();}
+	inline AlpidePixFlag GetPixFlag(size_t i) const {return fHits[i].GetPixFlag();}
+	inline uint32_t GetRow(size_t i) const {return AlpideRow(fHits[i].GetAddress());}
+	inline uint32_t GetColumn(size_t i) const {return AlpideColumn(fHits[i].GetDoubleColumn(), fHits[i].GetAddress());}
+	inline uint64_t GetTriggerTime(size_t i) const {return fTriggerTimes[fHits[i].GetTimeIndex()];}
+	// every trigger time registered, the hits' time index points into it
+	inline const std::vector<uint64_t>& GetTriggerTimes() const {return fTriggerTimes;}
+
+	inline void SetPixFlag(size_t i, AlpidePixFlag flag) {fHits[i].SetPixFlag(flag);}
+
+	inline const R3BPackedHit& Get(size_t i) const {return fHits[i];}
+	// full R3BPixHit view of an entry, for the existing callers
+	R3BPixHit GetPixHit(size_t i) const;
+
+	bool operator==(const R3BHitBuffer& rhs) const;
+	inline bool operator!=(const R3BHitBuffer& rhs) const {return !(*this == rhs);}
+};
+
+#endif
@@ -0,0 +1,414 @@
+#include "R3BHitStream.h"
+#include "R3BHitBuffer.h"
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <iostream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+using namespace std;
+
+static size_t RoundUpPow2(size_t n) {
+	size_t p = 1;
+	while(p < n) p <<= 1;
+	return p;
+}
+
+/* waits with short sleeps, the ring has no wakeup of its own */
+static void Backoff(int& nTries) {
+	if(++nTries < 64) this_thread::yield();
+	else this_thread::sleep_for(chrono::microseconds(50));
+}
+
+R3BStreamSink::R3BStreamSink(const string& name, StreamTransport transport, StreamPolicy policy, size_t ringSize) :
+	fName(name),
+	fTransport(transport),
+	fPolicy(policy),
+	fRingSize(RoundUpPow2(ringSize < 2*MAX_RECORD ? 2*MAX_RECORD : ringSize)),
+	fRing(nullptr),
+	fRingData(nullptr),
+	fMapSize(0),
+	fListenFd(-1),
+	fClientFd(-1),
+	fRecord(MAX_RECORD),
+	fSeq(0) {
+		bool ok = false;
+		if(transport != StreamTransport::kSOCKET && (ok = OpenShm())) fTransport = StreamTransport::kSHM;
+		if(!ok && transport != StreamTransport::kSHM && (ok = OpenSocket())) fTransport = StreamTransport::kSOCKET;
+		if(!ok) throw runtime_error("R3BStreamSink::R3BStreamSink() - cannot publish hits as " + name);
+	}
+
+R3BStreamSink::~R3BStreamSink() {
+	Close();
+}
+
+string R3BStreamSink::GetSocketPath(const string& name) {
+	return "/tmp/" + name + ".sock";
+}
+
+bool R3BStreamSink::OpenShm() {
+	const string shmName = "/" + fName;
+	shm_unlink(shmName.c_str()); // left over from a scan which didn't finish
+	const int fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+	if(fd < 0) {
+		cerr << "R3BStreamSink::OpenShm() - shm_open " << shmName << " : " << strerror(errno) << endl;
+		return false;
+	}
+	fMapSize = R3BStreamRingHeader::SIZE + fRingSize;
+	void* p = MAP_FAILED;
+	if(ftruncate(fd, fMapSize) == 0) p = mmap(nullptr, fMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		cerr << "R3BStreamSink::OpenShm() - cannot map " << fMapSize << " bytes of " << shmName << " : " << strerror(errno) << endl;
+		shm_unlink(shmName.c_str());
+		return false;
+	}
+	fRing = static_cast<R3BStreamRingHeader*>(p);
+	fRingData = static_cast<unsigned char*>(p) + R3BStreamRingHeader::SIZE;
+	fRing->version = R3BStreamRingHeader::VERSION;
+	fRing->capacity = fRingSize;
+	fRing->consumerAttached.store(0);
+	fRing->producerDone.store(0);
+	fRing->nDroppedRecords.store(0);
+	fRing->nDroppedHits.store(0);
+	fRing->writePos.store(0);
+	fRing->readPos.store(0);
+	atomic_thread_fence(memory_order_release);
+	fRing->magic = R3BStreamRingHeader::MAGIC; // readers wait for it
+	cout << "R3BStreamSink : publishing hits in shared memory " << shmName << ", " << (fRingSize >> 10) << " kB ring" << endl;
+	return true;
+}
+
+bool R3BStreamSink::OpenSocket() {
+	const string path = GetSocketPath(fName);
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(addr.sun_path)) {
+		cerr << "R3BStreamSink::OpenSocket() - socket path too long : " << path << endl;
+		return false;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	fListenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fListenFd < 0) {
+		cerr << "R3BStreamSink::OpenSocket() - socket : " << strerror(errno) << endl;
+		return false;
+	}
+	unlink(path.c_str());
+	if(bind(fListenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fListenFd, 1) != 0) {
+		cerr << "R3BStreamSink::OpenSocket() - cannot listen on " << path << " : " << strerror(errno) << endl;
+		close(fListenFd);
+		fListenFd = -1;
+		return false;
+	}
+	cout << "R3BStreamSink : publishing hits on " << path << endl;
+	return true;
+}
+
+void R3BStreamSink::Close() {
+	if(fRing) {
+		munmap(fRing, fMapSize);
+		shm_unlink(("/" + fName).c_str()); // attached consumers keep their mapping
+		fRing = nullptr;
+		fRingData = nullptr;
+	}
+	if(fClientFd >= 0) {
+		close(fClientFd);
+		fClientFd = -1;
+	}
+	if(fListenFd >= 0) {
+		close(fListenFd);
+		unlink(GetSocketPath(fName).c_str());
+		fListenFd = -1;
+	}
+}
+
+bool R3BStreamSink::HasConsumer() {
+	if(fRing) return fRing->consumerAttached.load(memory_order_relaxed) != 0;
+	if(fClientFd < 0 && fListenFd >= 0) {
+		fClientFd = accept4(fListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+		if(fClientFd >= 0) {
+			int sndBuf = 4 << 20;
+			setsockopt(fClientFd, SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+			cout << "R3BStreamSink : consumer connected to " << GetSocketPath(fName) << endl;
+		}
+	}
+	return fClientFd >= 0;
+}
+
+R3BStreamRecordHeader& R3BStreamSink::NewRecord(StreamRecord type, const R3BScanContext& ctx) {
+	R3BStreamRecordHeader& header = *reinterpret_cast<R3BStreamRecordHeader*>(fRecord.data());
+	memset(&header, 0, sizeof(header));
+	header.magic = R3BStreamRecordHeader::MAGIC;
+	header.version = R3BStreamRecordHeader::VERSION;
+	header.type = static_cast<uint16_t>(type);
+	header.size = sizeof(header);
+	header.chipId = ctx.chipId;
+	header.row = ctx.row;
+	header.step = ctx.step;
+	header.charge = ctx.charge;
+	header.colPhase = ctx.colPhase;
+	return header;
+}
+
+void R3BStreamSink::Publish(uint32_t nHits) {
+	R3BStreamRecordHeader& header = *reinterpret_cast<R3BStreamRecordHeader*>(fRecord.data());
+	header.seq = fSeq++;
+	bool ok = HasConsumer();
+	if(ok) ok = fRing ? PublishShm(fRecord.data(), header.size) : PublishSocket(fRecord.data(), header.size);
+	if(ok) {
+		++fStats.nRecords;
+		fStats.nHits += nHits;
+		fStats.nBytes += header.size;
+	}
+	else {
+		++fStats.nDroppedRecords;
+		fStats.nDroppedHits += nHits;
+		if(fRing) {
+			fRing->nDroppedRecords.store(fStats.nDroppedRecords, memory_order_relaxed);
+			fRing->nDroppedHits.store(fStats.nDroppedHits, memory_order_relaxed);
+		}
+	}
+}
+
+bool R3BStreamSink::PublishShm(const unsigned char* data, size_t size) {
+	const uint64_t capacity = fRing->capacity;
+	uint64_t pos = fRing->writePos.load(memory_order_relaxed);
+	const uint64_t offset = pos & (capacity - 1);
+	const uint64_t pad = capacity - offset < size ? capacity - offset : 0;
+	if(capacity - (pos - fRing->readPos.load(memory_order_acquire)) < pad + size) {
+		if(fPolicy == StreamPolicy::kDROP) return false;
+		const auto start = chrono::steady_clock::now();
+		const auto deadline = start + chrono::milliseconds(BLOCK_TIMEOUT_MS);
+		++fStats.nBlocked;
+		int nTries = 0;
+		bool room = false;
+		while(!room && chrono::steady_clock::now() < deadline && fRing->consumerAttached.load(memory_order_relaxed)) {
+			Backoff(nTries);
+			room = capacity - (pos - fRing->readPos.load(memory_order_acquire)) >= pad + size;
+		}
+		fStats.blockedNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+		if(!room) return false;
+	}
+	if(pad) {
+		/* the rest of the ring is skipped, the record starts over at 0 */
+		R3BStreamRecordHeader marker;
+		marker.magic = R3BStreamRecordHeader::MAGIC;
+		marker.version = R3BStreamRecordHeader::VERSION;
+		marker.type = static_cast<uint16_t>(StreamRecord::kPAD);
+		memcpy(fRingData + offset, &marker, 8);
+		pos += pad;
+	}
+	memcpy(fRingData + (pos & (capacity - 1)), data, size);
+	fRing->writePos.store(pos + size, memory_order_release);
+	return true;
+}
+
+bool R3BStreamSink::PublishSocket(const unsigned char* data, size_t size) {
+	const auto start = chrono::steady_clock::now();
+	bool blocked = false;
+	for(;;) {
+		if(send(fClientFd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)size) break;
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+			cerr << "R3BStreamSink::PublishSocket() - consumer gone : " << strerror(errno) << endl;
+			close(fClientFd);
+			fClientFd = -1;
+			return false;
+		}
+		if(fPolicy == StreamPolicy::kDROP) return false;
+		if(!blocked) {
+			blocked = true;
+			++fStats.nBlocked;
+		}
+		const int left = BLOCK_TIMEOUT_MS - chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+		pollfd pfd{fClientFd, POLLOUT, 0};
+		if(left <= 0 || poll(&pfd, 1, left) <= 0 || (pfd.revents & (POLLERR | POLLHUP))) {
+			fStats.blockedNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+			return false;
+		}
+	}
+	if(blocked) fStats.blockedNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+bool R3BStreamSink::BeginRow(const R3BScanContext& ctx) {
+	NewRecord(StreamRecord::kBEGIN_ROW, ctx);
+	Publish(0);
+	return true;
+}
+
+void R3BStreamSink::BeginStep(const R3BScanContext& ctx, int nInj) {
+	NewRecord(StreamRecord::kBEGIN_STEP, ctx).value = nInj;
+	Publish(0);
+}
+
+/* As many hits per record as fit MAX_RECORD, each with the trigger times its
+ * hits point to, the time indices counted from the record's first time */
+void R3BStreamSink::Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) {
+	const vector<uint64_t>& times = hits.GetTriggerTimes();
+	const size_t maxWords = (MAX_RECORD - sizeof(R3BStreamRecordHeader)) / sizeof(uint64_t);
+	uint64_t* words = reinterpret_cast<uint64_t*>(fRecord.data() + sizeof(R3BStreamRecordHeader));
+	size_t i = 0;
+	while(i < hits.Size()) {
+		const size_t first = i;
+		uint32_t minTime = hits.Get(i).GetTimeIndex(), maxTime = minTime;
+		for(++i; i < hits.Size(); ++i) {
+			const uint32_t t = hits.Get(i).GetTimeIndex();
+			const uint32_t lo = t < minTime ? t : minTime, hi = t > maxTime ? t : maxTime;
+			if(i + 1 - first + hi - lo + 1 > maxWords) break;
+			minTime = lo;
+			maxTime = hi;
+		}
+		const uint32_t nHits = i - first;
+		const uint32_t nTimes = times.empty() ? 0 : maxTime - minTime + 1;
+		R3BStreamRecordHeader& header = NewRecord(StreamRecord::kHITS, ctx);
+		header.nHits = nHits;
+		header.nTimes = nTimes;
+		header.board = hits.GetBoardIndex();
+		header.size = sizeof(header) + sizeof(uint64_t) * (nHits + nTimes);
+		for(uint32_t k=0; k<nHits; ++k) {
+			const R3BPackedHit hit = hits.Get(first + k);
+			words[k] = R3BPackedHit(hit.GetChipId(), hit.GetDoubleColumn(), hit.GetAddress(), hit.GetPixFlag(),
+				nTimes ? hit.GetTimeIndex() - minTime : 0).GetWord();
+		}
+		if(nTimes) memcpy(words + nHits, &times[minTime], sizeof(uint64_t) * nTimes);
+		Publish(nHits);
+	}
+}
+
+void R3BStreamSink::EndRow(const R3BScanContext& ctx) {
+	NewRecord(StreamRecord::kEND_ROW, ctx);
+	Publish(0);
+}
+
+void R3BStreamSink::Terminate() {
+	NewRecord(StreamRecord::kEND, R3BScanContext{R3BScanContext::ALL_CHIPS, R3BScanContext::ALL_ROWS, 0, 0});
+	Publish(0);
+	if(fRing) fRing->producerDone.store(1, memory_order_release);
+	PrintStats();
+}
+
+void R3BStreamSink::PrintStats() const {
+	printf("R3BStreamSink : %lu records, %lu hits, %lu bytes published, %lu records with %lu hits dropped",
+		(unsigned long)fStats.nRecords, (unsigned long)fStats.nHits, (unsigned long)fStats.nBytes,
+		(unsigned long)fStats.nDroppedRecords, (unsigned long)fStats.nDroppedHits);
+	if(fStats.nBlocked) printf(", blocked %lu times for %.3f s", (unsigned long)fStats.nBlocked, fStats.blockedNs * 1e-9);
+	printf("\n");
+}
+
+R3BStreamReader::R3BStreamReader() :
+	fRing(nullptr),
+	fRingData(nullptr),
+	fMapSize(0),
+	fFd(-1),
+	fRecord(R3BStreamSink::MAX_RECORD) {}
+
+R3BStreamReader::~R3BStreamReader() {
+	Close();
+}
+
+bool R3BStreamReader::Open(const string& name, StreamTransport transport) {
+	Close();
+	if(transport != StreamTransport::kSOCKET) {
+		const int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+		struct stat st;
+		if(fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size > R3BStreamRingHeader::SIZE) {
+			void* p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(p != MAP_FAILED) {
+				fRing = static_cast<R3BStreamRingHeader*>(p);
+				fMapSize = st.st_size;
+				if(fRing->magic == R3BStreamRingHeader::MAGIC && fRing->version == R3BStreamRingHeader::VERSION) {
+					atomic_thread_fence(memory_order_acquire);
+					fRingData = static_cast<unsigned char*>(p) + R3BStreamRingHeader::SIZE;
+					fRing->consumerAttached.store(1);
+				}
+				else {
+					munmap(p, fMapSize);
+					fRing = nullptr;
+				}
+			}
+		}
+		if(fd >= 0) close(fd);
+		if(fRing) return true;
+	}
+	if(transport != StreamTransport::kSHM) {
+		const string path = R3BStreamSink::GetSocketPath(name);
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(addr.sun_path)) return false;
+		strcpy(addr.sun_path, path.c_str());
+		fFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if(fFd >= 0 && connect(fFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) return true;
+		if(fFd >= 0) close(fFd);
+		fFd = -1;
+	}
+	return false;
+}
+
+void R3BStreamReader::Close() {
+	if(fRing) {
+		fRing->consumerAttached.store(0);
+		munmap(fRing, fMapSize);
+		fRing = nullptr;
+		fRingData = nullptr;
+	}
+	if(fFd >= 0) {
+		close(fFd);
+		fFd = -1;
+	}
+}
+
+const R3BStreamRecordHeader* R3BStreamReader::Next(int timeoutMs) {
+	const R3BStreamRecordHeader* record = reinterpret_cast<const R3BStreamRecordHeader*>(fRecord.data());
+	if(fFd >= 0) {
+		pollfd pfd{fFd, POLLIN, 0};
+		if(poll(&pfd, 1, timeoutMs) <= 0) return nullptr;
+		const ssize_t n = recv(fFd, fRecord.data(), fRecord.size(), 0);
+		if(n < (ssize_t)sizeof(R3BStreamRecordHeader) || record->magic != R3BStreamRecordHeader::MAGIC) return nullptr;
+		return record;
+	}
+	if(!fRing) return nullptr;
+	const uint64_t capacity = fRing->capacity;
+	const auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+	int nTries = 0;
+	for(;;) {
+		const uint64_t pos = fRing->readPos.load(memory_order_relaxed);
+		if(pos == fRing->writePos.load(memory_order_acquire)) {
+			if(fRing->producerDone.load(memory_order_acquire) || chrono::steady_clock::now() >= deadline) return nullptr;
+			Backoff(nTries);
+			continue;
+		}
+		const uint64_t offset = pos & (capacity - 1);
+		const unsigned char* p = fRingData + offset;
+		uint16_t type;
+		memcpy(&type, p + 6, sizeof(type));
+		if(type == static_cast<uint16_t>(StreamRecord::kPAD)) {
+			fRing->readPos.store(pos + capacity - offset, memory_order_release);
+			continue;
+		}
+		uint32_t size;
+		memcpy(&size, p + 8, sizeof(size));
+		if(size < sizeof(R3BStreamRecordHeader) || size > fRecord.size()) return nullptr; // not a record, the ring is corrupt
+		memcpy(fRecord.data(), p, size);
+		fRing->readPos.store(pos + size, memory_order_release);
+		return record;
+	}
+}
+
+uint64_t R3BStreamReader::GetNDroppedRecords() const {
+	return fRing ? fRing->nDroppedRecords.load(memory_order_relaxed) : 0;
+}
+
+uint64_t R3BStreamReader::GetNDroppedHits() const {
+	return fRing ? fRing->nDroppedHits.load(memory_order_relaxed) : 0;
+}
@@ -0,0 +1,188 @@
+#ifndef R3B_HITSTREAM_H
+#define R3B_HITSTREAM_H
+
+/* >> Decoded hits published while the scan runs, for the online monitor and the event builder
+ * R3BStreamSink sends one record per sink call to a single local consumer, over a
+ * POSIX shared-memory ring, or over a UNIX socket where shared memory isn't there
+ * (or wanted). R3BStreamReader is the consumer side.
+ *
+ * Record, native byte order, always a multiple of 8 bytes:
+ *   R3BStreamRecordHeader (56 bytes)
+ *   kHITS: nHits x uint64_t, one R3BPackedHit word per hit (layout in R3BHitBuffer.h)
+ *          nTimes x uint64_t, the trigger times the hits' time index points into
+ * Record types follow the sink calls: kBEGIN_ROW, kBEGIN_STEP (value = injections),
+ * kHITS, kEND_ROW, and kEND once after the last row. seq counts every record
+ * the sink made, published or not: a gap is what the consumer lost.
+ *
+ * Shared memory, /dev/shm/<name>: R3BStreamRingHeader, then capacity bytes of ring.
+ * The producer appends at writePos, the consumer frees up to readPos; both only
+ * grow, offset in the ring = pos % capacity. A record never wraps: when it doesn't
+ * fit before the end the producer writes the first 8 bytes of a header with type
+ * kPAD there and starts over at offset 0.
+ * UNIX socket, SOCK_SEQPACKET at <path>: one record per message.
+ *
+ * A slow consumer is handled per StreamPolicy:
+ *   kDROP  - the record is dropped when it doesn't fit, the scan never waits
+ *   kBLOCK - the scan waits for room, up to BLOCK_TIMEOUT_MS, then drops. Without
+ *            a consumer attached records are dropped right away. */
+
+#include "R3BScanSink.h"
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+enum class StreamTransport {
+	kAUTO,  // shared memory, the socket if that fails
+	kSHM,
+	kSOCKET
+};
+
+enum class StreamPolicy {
+	kDROP,
+	kBLOCK
+};
+
+enum class StreamRecord : uint16_t {
+	kPAD = 0,
+	kBEGIN_ROW,
+	kBEGIN_STEP,
+	kHITS,
+	kEND_ROW,
+	kEND
+};
+
+struct R3BStreamRecordHeader {
+	static const uint32_t MAGIC = 0x53423352; // "R3BS"
+	static const uint16_t VERSION = 1;
+
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;     // StreamRecord
+	uint32_t size;     // bytes, this header included
+	uint32_t nHits;
+	uint64_t seq;
+	int32_t chipId;    // R3BScanContext
+	int32_t row;
+	int32_t step;
+	int32_t charge;
+	int32_t colPhase;
+	uint32_t nTimes;
+	uint32_t board;    // R3BHitBuffer::GetBoardIndex()
+	uint32_t value;    // kBEGIN_STEP: injections
+};
+static_assert(sizeof(R3BStreamRecordHeader) == 56, "stream record layout");
+
+struct R3BStreamRingHeader {
+	static const uint32_t MAGIC = 0x52423352; // "R3BR"
+	static const uint32_t VERSION = 1;
+	static const size_t SIZE = 256;           // the ring starts here
+
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	std::atomic<uint32_t> consumerAttached;
+	std::atomic<uint32_t> producerDone;      // kEND is out, nothing follows
+	std::atomic<uint64_t> nDroppedRecords;   // the producer's counters, for the consumer to show
+	std::atomic<uint64_t> nDroppedHits;
+	alignas(64) std::atomic<uint64_t> writePos;
+	alignas(64) std::atomic<uint64_t> readPos;
+};
+static_assert(sizeof(R3BStreamRingHeader) <= R3BStreamRingHeader::SIZE, "ring header too large");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring needs lock-free 64-bit atomics");
+
+class R3BStreamSink : public R3BScanSink {
+public:
+	static const size_t DEFAULT_RING_SIZE = 1 << 26; // 64 MB
+	static const size_t MAX_RECORD        = 1 << 16; // longer hit batches are split, fits a socket message
+	static const int BLOCK_TIMEOUT_MS     = 5000;
+
+	struct Stats {
+		uint64_t nRecords = 0;        // published
+		uint64_t nHits = 0;
+		uint64_t nBytes = 0;
+		uint64_t nDroppedRecords = 0;
+		uint64_t nDroppedHits = 0;
+		uint64_t nBlocked = 0;        // records which had to wait for room (kBLOCK)
+		uint64_t blockedNs = 0;
+	};
+
+private:
+	std::string fName;
+	StreamTransport fTransport;
+	StreamPolicy fPolicy;
+	size_t fRingSize;
+	// shared memory
+	R3BStreamRingHeader* fRing;
+	unsigned char* fRingData;
+	size_t fMapSize;
+	// socket
+	int fListenFd;
+	int fClientFd;
+	std::vector<unsigned char> fRecord; // the record being built
+	uint64_t fSeq;
+	Stats fStats;
+
+public:
+	/* name: the shared memory object is /<name>, the socket <GetSocketPath(name)>.
+	 * Throws std::runtime_error if the transport(s) can't be set up. */
+	R3BStreamSink(const std::string& name, StreamTransport transport = StreamTransport::kAUTO,
+		StreamPolicy policy = StreamPolicy::kDROP, size_t ringSize = DEFAULT_RING_SIZE);
+	~R3BStreamSink();
+
+	bool BeginRow(const R3BScanContext& ctx) override;
+	void BeginStep(const R3BScanContext& ctx, int nInj) override;
+	void Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) override;
+	void EndRow(const R3BScanContext& ctx) override;
+	void Terminate() override;
+
+	// the transport in use, kSHM or kSOCKET
+	inline StreamTransport GetTransport() const {return fTransport;}
+	inline const Stats& GetStats() const {return fStats;}
+	void PrintStats() const;
+
+	static std::string GetSocketPath(const std::string& name);
+
+private:
+	bool OpenShm();
+	bool OpenSocket();
+	void Close();
+	R3BStreamRecordHeader& NewRecord(StreamRecord type, const R3BScanContext& ctx);
+	void Publish(uint32_t nHits);
+	bool PublishShm(const unsigned char* data, size_t size);
+	bool PublishSocket(const unsigned char* data, size_t size);
+	bool HasConsumer();
+};
+
+/* The consumer end: attaches to the ring, or connects to the socket */
+class R3BStreamReader {
+	R3BStreamRingHeader* fRing;
+	unsigned char* fRingData;
+	size_t fMapSize;
+	int fFd;
+	std::vector<unsigned char> fRecord;
+
+public:
+	R3BStreamReader();
+	~R3BStreamReader();
+
+	// false if nothing of that name is there (yet)
+	bool Open(const std::string& name, StreamTransport transport = StreamTransport::kAUTO);
+	void Close();
+
+	/* The next record, nullptr when none came within timeoutMs or the stream ended.
+	 * Valid until the next call. */
+	const R3BStreamRecordHeader* Next(int timeoutMs);
+	inline const uint64_t* GetHits(const R3BStreamRecordHeader* record) const {
+		return reinterpret_cast<const uint64_t*>(record + 1);
+	}
+	inline const uint64_t* GetTriggerTimes(const R3BStreamRecordHeader* record) const {
+		return GetHits(record) + record->nHits;
+	}
+	// records and hits the producer dropped so far, shared memory only
+	uint64_t GetNDroppedRecords() const;
+	uint64_t GetNDroppedHits() const;
+};
+
+#endif
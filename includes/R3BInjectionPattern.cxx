@@ -0,0 +1,42 @@
+#include "R3BInjectionPattern.h"
+#include "R3BScanBackend.h"
+
+using namespace std;
+
+R3BInjectionPattern::R3BInjectionPattern(int rowsPerStage, int colStride) :
+	fRowsPerStage(1),
+	fColStride(colStride < 1 ? 1 : colStride > MAX_COL_STRIDE ? MAX_COL_STRIDE : colStride) {
+		if(rowsPerStage > N_ROWS) rowsPerStage = N_ROWS;
+		while(fRowsPerStage * 2 <= rowsPerStage) fRowsPerStage *= 2;
+	}
+
+vector<int> R3BInjectionPattern::GetRows(int stage) const {
+	vector<int> rows;
+	const int nRowStages = GetNRowStages();
+	for(int row = stage / fColStride; row < N_ROWS; row += nRowStages) rows.push_back(row);
+	return rows;
+}
+
+bool R3BInjectionPattern::IsPulsed(int stage, int row, int col) const {
+	return row % GetNRowStages() == stage / fColStride && col % fColStride == GetColPhase(stage);
+}
+
+/* Whole rows take one register write each, single pixels one per pixel */
+void R3BInjectionPattern::SetPixels(R3BScanBackend& backend, int chipId, int stage, bool enable) const {
+	for(const int row : GetRows(stage)) {
+		if(fColStride == 1) {
+			backend.WritePixRegRow(chipId, AlpidePixConfigReg::MASK_ENABLE, !enable, row);
+			backend.WritePixRegRow(chipId, AlpidePixConfigReg::PULSE_ENABLE, enable, row);
+			continue;
+		}
+		for(int col = GetColPhase(stage); col < N_COLS; col += fColStride) {
+			backend.WritePixRegSingle(chipId, AlpidePixConfigReg::MASK_ENABLE, !enable, row, col);
+			backend.WritePixRegSingle(chipId, AlpidePixConfigReg::PULSE_ENABLE, enable, row, col);
+		}
+	}
+}
+
+void R3BInjectionPattern::Apply(R3BScanBackend& backend, int chipId, int stage) const {
+	if(stage > 0) SetPixels(backend, chipId, stage-1, false);
+	SetPixels(backend, chipId, stage, true);
+}
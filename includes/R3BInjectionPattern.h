@@ -0,0 +1,50 @@
+#ifndef R3B_INJECTIONPATTERN_H
+#define R3B_INJECTIONPATTERN_H
+
+/* >> Which pixels are unmasked and pulsed at each stage of a scan
+ * Stage s pulses rowsPerStage rows spread evenly over the matrix,
+ *   r, r + nRowStages, r + 2*nRowStages, ...   with r = s / colStride,
+ * and in those rows every colStride-th column starting at s % colStride (the
+ * column phase). nRowStages = 512 / rowsPerStage, so a full scan takes
+ * nRowStages * colStride stages instead of 512. The hits themselves carry
+ * row and column, nothing has to be decoded differently. */
+
+#include "AlpideDictionary.h"
+#include <vector>
+
+class R3BScanBackend;
+
+class R3BInjectionPattern {
+public:
+	static const int N_ROWS = 512;
+	static const int N_COLS = 1024;
+	static const int MAX_COL_STRIDE = 32;
+
+private:
+	int fRowsPerStage; // power of two, divides N_ROWS
+	int fColStride;    // 1 = whole rows
+
+public:
+	/* rowsPerStage is rounded down to a power of two, colStride clamped to [1, MAX_COL_STRIDE] */
+	R3BInjectionPattern(int rowsPerStage = 1, int colStride = 1);
+
+	inline int GetRowsPerStage() const {return fRowsPerStage;}
+	inline int GetColStride() const {return fColStride;}
+	inline int GetNRowStages() const {return N_ROWS / fRowsPerStage;}
+	inline int GetNStages() const {return GetNRowStages() * fColStride;}
+	inline int GetColPhase(int stage) const {return stage % fColStride;}
+	// last column phase of its rows: the rows are complete after this stage
+	inline bool IsLastPhase(int stage) const {return GetColPhase(stage) == fColStride - 1;}
+
+	std::vector<int> GetRows(int stage) const;
+	bool IsPulsed(int stage, int row, int col) const;
+
+	/* Masks and disables pulsing of the previous stage's pixels, unmasks and
+	 * enables pulsing of this stage's. The first stage expects a fully masked chip. */
+	void Apply(R3BScanBackend& backend, int chipId, int stage) const;
+
+private:
+	void SetPixels(R3BScanBackend& backend, int chipId, int stage, bool enable) const;
+};
+
+#endif
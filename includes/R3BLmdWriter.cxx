@@ -0,0 +1,235 @@
+#include "R3BLmdWriter.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <stdexcept>
+#include <iostream>
+
+using namespace std;
+
+/* s_filhe, the first buffer of the file */
+struct R3BLmdFileHeader {
+	R3BLmdBufferHeader buffer;
+	int16_t labelLength;
+	char label[30];
+	int16_t fileLength;
+	char file[86];
+	int16_t userLength;
+	char user[30];
+	char time[24];
+	int16_t runLength;
+	char run[66];
+	int16_t expLength;
+	char exp[66];
+	int32_t nLines;
+	struct {
+		int16_t length;
+		char text[78];
+	} lines[30];
+};
+static_assert(sizeof(R3BLmdFileHeader) == 2764, "s_filhe layout");
+
+/* event and subevent header plus the White Rabbit words, in front of the chip data */
+struct R3BLmdEventHead {
+	R3BLmdEventHeader event;
+	R3BLmdSubeventHeader subevent;
+	uint32_t wr[R3BLmdWriter::WR_WORDS];
+};
+static_assert(sizeof(R3BLmdEventHead) == 48, "no padding between the headers");
+
+/* the header of an event fragment in a following buffer */
+struct R3BLmdFragmentHeader {
+	int32_t dlen;
+	int16_t subtype;
+	int16_t type;
+};
+
+static const int16_t BUFFER_TYPE = 100;
+static const int16_t FILE_HEADER_TYPE = 2000;
+static const int16_t EVENT_TYPE = 10;
+static const int16_t EVENT_SUBTYPE = 1;
+static const unsigned char IDLE = 0xff;
+
+R3BLmdWriter::R3BLmdWriter() :
+	fFile(nullptr),
+	fBuffer(BUFFER_SIZE),
+	fPos(sizeof(R3BLmdBufferHeader)),
+	fNBuffers(0),
+	fEventCount(0),
+	fNBytes(0),
+	fWrId(DEFAULT_WR_ID),
+	fProcId(1),
+	fControl(0),
+	fSubcrate(0),
+	fNFragments(0),
+	fContinued(false),
+	fSwap(GetByteSwap()) {}
+
+R3BLmdWriter::~R3BLmdWriter() {
+	Close();
+}
+
+void R3BLmdWriter::Open(const string& fileName) {
+	Close();
+	fFile = fopen(fileName.c_str(), "wb");
+	if(!fFile) {
+		throw runtime_error("R3BLmdWriter::Open() - cannot create " + fileName + " : " + strerror(errno));
+	}
+	fFileName = fileName;
+	fNBuffers = 0;
+	fEventCount = 0;
+	fNBytes = 0;
+	fPos = sizeof(R3BLmdBufferHeader);
+	fNFragments = 0;
+	fContinued = false;
+	WriteFileHeader();
+}
+
+void R3BLmdWriter::Close() {
+	if(!fFile) return;
+	if(fNFragments) Flush(false, 0);
+	if(fclose(fFile) != 0) {
+		cerr << "R3BLmdWriter::Close() - error closing " << fFileName << " : " << strerror(errno) << endl;
+	}
+	fFile = nullptr;
+}
+
+void R3BLmdWriter::Sync() {
+	if(!fFile) return;
+	if(fNFragments) Flush(false, 0);
+	if(fflush(fFile) != 0) {
+		cerr << "R3BLmdWriter::Sync() - cannot write " << fFileName << " : " << strerror(errno) << endl;
+	}
+}
+
+uint64_t R3BLmdWriter::GetWrTime() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+/* l_time: s and ms */
+static void SetTime(R3BLmdBufferHeader& header) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	header.time[0] = now.tv_sec;
+	header.time[1] = now.tv_nsec / 1000000;
+}
+
+void R3BLmdWriter::WriteFileHeader() {
+	memset(fBuffer.data(), 0, BUFFER_SIZE);
+	R3BLmdFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.buffer.dlen = (BUFFER_SIZE - sizeof(R3BLmdBufferHeader)) / 2;
+	header.buffer.type = FILE_HEADER_TYPE;
+	header.buffer.subtype = 1;
+	header.buffer.free[0] = 1;
+	SetTime(header.buffer);
+	auto setString = [](int16_t& length, char* dst, size_t size, const string& s) {
+		length = s.size() < size ? s.size() : size;
+		memcpy(dst, s.data(), length);
+	};
+	const size_t slash = fFileName.rfind('/');
+	setString(header.labelLength, header.label, sizeof(header.label), "R3BThresholdScan");
+	setString(header.fileLength, header.file, sizeof(header.file), slash == string::npos ? fFileName : fFileName.substr(slash + 1));
+	time_t t = header.buffer.time[0];
+	strftime(header.time, sizeof(header.time), "%d-%b-%Y %H:%M:%S", localtime(&t));
+	memcpy(fBuffer.data(), &header, sizeof(header));
+	if(fwrite(fBuffer.data(), BUFFER_SIZE, 1, fFile) != 1) {
+		throw runtime_error("R3BLmdWriter::Open() - cannot write " + fFileName);
+	}
+	fNBytes += BUFFER_SIZE;
+	memset(fBuffer.data(), 0, BUFFER_SIZE);
+}
+
+void R3BLmdWriter::Flush(bool fragAtEnd, int32_t spanWords) {
+	R3BLmdBufferHeader header;
+	memset(&header, 0, sizeof(header));
+	header.dlen = (BUFFER_SIZE - sizeof(R3BLmdBufferHeader)) / 2;
+	header.type = BUFFER_TYPE;
+	header.subtype = 1;
+	header.fragAtEnd = fragAtEnd;
+	header.fragAtBegin = fContinued;
+	header.used = (fPos - sizeof(R3BLmdBufferHeader)) / 2;
+	header.bufNumber = ++fNBuffers;
+	header.nFragments = fNFragments;
+	header.free[0] = 1;
+	header.free[1] = spanWords;
+	header.free[2] = header.used;
+	SetTime(header);
+	memcpy(fBuffer.data(), &header, sizeof(header));
+	if(fwrite(fBuffer.data(), BUFFER_SIZE, 1, fFile) != 1) {
+		cerr << "R3BLmdWriter::Flush() - cannot write " << fFileName << " : " << strerror(errno) << endl;
+	}
+	fNBytes += BUFFER_SIZE;
+	memset(fBuffer.data(), 0, fPos);
+	fPos = sizeof(R3BLmdBufferHeader);
+	fNFragments = 0;
+	fContinued = false;
+}
+
+void R3BLmdWriter::WriteEvent(const unsigned char* data, int nBytes, uint64_t wrTime) {
+	if(!fFile || nBytes <= 0) return;
+	/* pad to whole words, the decoder skips IDLE. A partial last word is padded in
+	 * a copy, data may end at nBytes */
+	const size_t nWords = (nBytes + 3) / 4;
+	const size_t nFull = nBytes / 4;
+	unsigned char tail[4] = {IDLE, IDLE, IDLE, IDLE};
+	memcpy(tail, data + 4*nFull, nBytes - 4*nFull);
+	auto swapWords = [&](unsigned char* dst, size_t first, size_t n) {
+		const size_t full = first < nFull ? min(n, nFull - first) : 0;
+		fSwap(dst, data + 4*first, full);
+		if(full < n) fSwap(dst + 4*full, tail, 1);
+	};
+	const size_t total = sizeof(R3BLmdEventHead) + 4*nWords;
+
+	/* only events longer than a buffer span several */
+	if(total > GetFree() && (total <= BUFFER_SIZE - sizeof(R3BLmdBufferHeader) || GetFree() < sizeof(R3BLmdEventHead) + 4)) {
+		Flush(false, 0);
+	}
+
+	R3BLmdEventHead head;
+	head.event.dlen = (total - 8) / 2;
+	head.event.subtype = EVENT_SUBTYPE;
+	head.event.type = EVENT_TYPE;
+	head.event.dummy = 0;
+	head.event.trigger = 1;
+	head.event.count = ++fEventCount;
+	head.subevent.dlen = (total - sizeof(R3BLmdEventHeader) - 8) / 2;
+	head.subevent.subtype = EVENT_SUBTYPE;
+	head.subevent.type = EVENT_TYPE;
+	head.subevent.control = fControl;
+	head.subevent.subcrate = fSubcrate;
+	head.subevent.procId = fProcId;
+	head.wr[0] = fWrId;
+	for(int i=0; i<4; ++i) head.wr[i+1] = (0x03e1u + (i << 8)) << 16 | ((wrTime >> 16*i) & 0xffff);
+
+	const size_t eventPos = fPos;
+	memcpy(&fBuffer[fPos], &head, sizeof(head));
+	fPos += sizeof(head);
+	size_t done = GetFree() / 4 < nWords ? GetFree() / 4 : nWords;
+	swapWords(&fBuffer[fPos], 0, done);
+	fPos += 4*done;
+	++fNFragments;
+	if(done == nWords) return;
+
+	/* spanning: each fragment's header has its own length, the buffer the whole event's */
+	const int32_t spanWords = head.event.dlen;
+	head.event.dlen = (fPos - eventPos - 8) / 2;
+	memcpy(&fBuffer[eventPos], &head.event.dlen, sizeof(head.event.dlen));
+	Flush(true, spanWords);
+	while(done < nWords) {
+		fContinued = true;
+		const size_t fragPos = fPos;
+		fPos += sizeof(R3BLmdFragmentHeader);
+		const size_t n = GetFree() / 4 < nWords - done ? GetFree() / 4 : nWords - done;
+		swapWords(&fBuffer[fPos], done, n);
+		fPos += 4*n;
+		done += n;
+		R3BLmdFragmentHeader fragment{int32_t((fPos - fragPos - 8) / 2), EVENT_SUBTYPE, EVENT_TYPE};
+		memcpy(&fBuffer[fragPos], &fragment, sizeof(fragment));
+		++fNFragments;
+		if(done < nWords) Flush(true, spanWords);
+	}
+}
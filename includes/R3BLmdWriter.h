@@ -0,0 +1,114 @@
+#ifndef R3B_LMDWRITER_H
+#define R3B_LMDWRITER_H
+
+/* >> Chip events as GSI list-mode data (LMD), the format drasi writes and ucesb reads
+ * File: one file header buffer, then data buffers of BUFFER_SIZE bytes, native
+ * byte order (the buffer header's l_free[0] = 1 tells the reader which one).
+ * Each chip event is one type 10/1 event with one type 10/1 subevent holding
+ *   White Rabbit timestamp: id, 0x03e1|t[15:0], 0x04e1|t[31:16], 0x05e1|t[47:32], 0x06e1|t[63:48]
+ *   the MOSAIC buffer, padded with IDLE to whole 32-bit words, every word byte swapped
+ * so the ALPIDE bytes come in stream order when unpacked as big-endian words.
+ * Events which don't fit a buffer are split over the following ones.
+ * Without a White Rabbit receiver at hand the timestamp is CLOCK_REALTIME in ns. */
+
+#include "R3BByteSwap.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* s_bufhe: the header of every buffer, and the first 48 bytes of the file header */
+struct R3BLmdBufferHeader {
+	int32_t dlen;       // l_dlen, data words (16 bit) after the header
+	int16_t subtype;    // i_subtype
+	int16_t type;       // i_type
+	/* GSI names the flags by the event, not the buffer: h_begin, an event begins
+	 * here and ends in a later buffer; h_end, an event of an earlier buffer ends here */
+	int8_t fragAtEnd;   // h_begin: fragment at the end of this buffer
+	int8_t fragAtBegin; // h_end: fragment at the begin of this buffer
+	int16_t used;       // i_used, data words (16 bit) used
+	int32_t bufNumber;  // l_buf
+	int32_t nFragments; // l_evt, events and event fragments in the buffer
+	int32_t currentIndex;
+	int32_t time[2];    // l_time, s and ms
+	int32_t free[4];    // l_free: [0] = 1 byte order, [1] = words of a spanning event, [2] = used words
+};
+
+/* s_ve10_1 */
+struct R3BLmdEventHeader {
+	int32_t dlen;       // 16 bit words after type/subtype
+	int16_t subtype;
+	int16_t type;
+	int16_t dummy;
+	int16_t trigger;
+	int32_t count;
+};
+
+/* s_ves10_1 */
+struct R3BLmdSubeventHeader {
+	int32_t dlen;
+	int16_t subtype;
+	int16_t type;
+	int8_t control;
+	int8_t subcrate;
+	int16_t procId;
+};
+
+static_assert(sizeof(R3BLmdBufferHeader) == 48, "s_bufhe layout");
+static_assert(sizeof(R3BLmdEventHeader) == 16, "s_ve10_1 layout");
+static_assert(sizeof(R3BLmdSubeventHeader) == 12, "s_ves10_1 layout");
+
+class R3BLmdWriter {
+public:
+	static const size_t BUFFER_SIZE = 1 << 16; // bytes per LMD buffer, header included
+	static const uint32_t DEFAULT_WR_ID = 0x100;
+	static const int WR_WORDS = 5;
+
+private:
+	FILE* fFile;
+	std::string fFileName;
+	std::vector<unsigned char> fBuffer; // the buffer being filled
+	size_t fPos;
+	int32_t fNBuffers;
+	int32_t fEventCount;
+	uint64_t fNBytes;
+	uint32_t fWrId;
+	int16_t fProcId;
+	int8_t fControl;
+	int8_t fSubcrate;
+	int32_t fNFragments; // events and event fragments in the current buffer
+	bool fContinued;     // the current buffer starts with the rest of an event
+	ByteSwapFn fSwap;
+
+public:
+	R3BLmdWriter();
+	~R3BLmdWriter();
+
+	/* Throws std::runtime_error if the file can't be created */
+	void Open(const std::string& fileName);
+	void Close();
+	inline bool IsOpen() const {return fFile != nullptr;}
+	// the events written so far to the file, the buffer being filled goes out part empty
+	void Sync();
+
+	inline void SetWrId(uint32_t id) {fWrId = id;}
+	inline void SetSubevent(int procId, int control = 0, int subcrate = 0) {fProcId = procId; fControl = control; fSubcrate = subcrate;}
+	inline void SetByteSwap(ByteSwapImpl impl) {fSwap = GetByteSwap(impl);}
+
+	/* One chip event, its last word padded with IDLE in the LMD buffer: data
+	 * is only read, up to nBytes */
+	void WriteEvent(const unsigned char* data, int nBytes, uint64_t wrTime);
+
+	// ns since the epoch, stand-in for the White Rabbit time
+	static uint64_t GetWrTime();
+
+	inline int32_t GetNEvents() const {return fEventCount;}
+	inline uint64_t GetNBytes() const {return fNBytes;}
+
+private:
+	void WriteFileHeader();
+	void Flush(bool spanning, int32_t spanWords);
+	inline size_t GetFree() const {return BUFFER_SIZE - fPos;}
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "R3BParallelDecoder.h"
+
+using namespace std;
+
+R3BParallelDecoder::R3BParallelDecoder(unsigned nThreads) :
+	fMinParallelBytes(DEFAULT_MIN_PARALLEL_BYTES),
+	fSkipFiller(GetFillerSkip()),
+	fNext(0),
+	fGeneration(0),
+	fNDone(0),
+	fNActive(0),
+	fOpen(false),
+	fQuit(false),
+	fResult(&fHits),
+	fHitLimit(0),
+	fNParallel(0),
+	fNSerial(0),
+	fNBatched(0) {
+		if(nThreads == 0) nThreads = thread::hardware_concurrency();
+		if(nThreads == 0) nThreads = 1;
+		if(nThreads > MAX_THREADS) nThreads = MAX_THREADS;
+		for(unsigned i=0; i<nThreads; ++i) fDecoders.emplace_back(new R3BAlpideDecoder());
+		for(unsigned i=1; i<nThreads; ++i) fWorkers.emplace_back(&R3BParallelDecoder::WorkerLoop, this, i);
+	}
+
+R3BParallelDecoder::~R3BParallelDecoder() {
+	{
+		lock_guard<mutex> lock(fMutex);
+		fQuit = true;
+	}
+	fWake.notify_all();
+	for(auto& worker : fWorkers) worker.join();
+}
+
+void R3BParallelDecoder::Split(const unsigned char* data, int nBytes, vector<Segment>& segments, FillerSkipFn skipFiller) {
+	segments.clear();
+	segments.push_back(Segment{0, 0});
+	bool started = false; // filler or stray words before the first chip go with its segment, as one decoder sees them
+	int byte = 0;
+	while(byte < nBytes) {
+		const AlpideWord word = R3BAlpideDecoder::GetWord(data[byte]);
+		switch(word.type) {
+			case AlpideDataType::kIDLE:
+			case AlpideDataType::kBUSYON:
+			case AlpideDataType::kBUSYOFF:
+				byte = skipFiller(data, byte + 1, nBytes);
+				continue;
+			case AlpideDataType::kCHIPHEADER:
+			case AlpideDataType::kEMPTYFRAME:
+				if(started && byte > segments.back().begin) {
+					segments.back().nBytes = byte - segments.back().begin;
+					segments.push_back(Segment{byte, 0});
+				}
+				started = true;
+				break;
+			default:
+				break;
+		}
+		byte += word.length;
+	}
+	segments.back().nBytes = nBytes - segments.back().begin;
+}
+
+bool R3BParallelDecoder::DecodeEvent(unsigned char* data, int nBytes) {
+	if(fDecoders.size() > 1 && (size_t)nBytes >= fMinParallelBytes) Split(data, nBytes, fSegments, fSkipFiller);
+	else fSegments.assign(1, Segment{0, nBytes});
+	R3BAlpideDecoder& own = *fDecoders[0];
+	if(fSegments.size() == 1) {
+		++fNSerial;
+		own.SetHitLimit(fHitLimit);
+		const bool ok = own.DecodeEvent(data, nBytes);
+		fResult = &own.GetHits();
+		return ok;
+	}
+
+	++fNParallel;
+	fJobs.clear();
+	for(const Segment& segment : fSegments) fJobs.push_back(Job{data + segment.begin, segment.nBytes});
+	Run();
+
+	fHits.Clear();
+	bool ok = true;
+	for(size_t i=0; i<fJobs.size(); ++i) {
+		fHits.Append(fJobHits[i]);
+		ok = ok && fJobOk[i];
+	}
+	fResult = &fHits;
+	return ok;
+}
+
+void R3BParallelDecoder::DecodeEvents(unsigned char* const* data, const int* nBytes, size_t n) {
+	fNBatched += n;
+	fJobs.clear();
+	for(size_t i=0; i<n; ++i) fJobs.push_back(Job{data[i], nBytes[i]});
+	Run();
+	fHits.Clear();
+	fResult = &fHits; // nothing left suspended
+}
+
+void R3BParallelDecoder::Run() {
+	fDecoders[0]->SetHitLimit(0); // it takes jobs like the workers
+	if(fJobHits.size() < fJobs.size()) fJobHits.resize(fJobs.size());
+	fJobOk.assign(fJobs.size(), 1);
+	fNext.store(0, memory_order_relaxed);
+	{
+		lock_guard<mutex> lock(fMutex);
+		fNDone = 0;
+		++fGeneration;
+		fOpen = true;
+	}
+	fWake.notify_all();
+	Work(0);
+	{
+		unique_lock<mutex> lock(fMutex);
+		fDone.wait(lock, [&]() {return fNDone == fJobs.size() && fNActive == 0;});
+		fOpen = false; // a worker waking only now must not touch the next jobs
+	}
+}
+
+bool R3BParallelDecoder::ResumeEvent() {
+	const bool ok = fDecoders[0]->ResumeEvent();
+	fResult = &fDecoders[0]->GetHits();
+	return ok;
+}
+
+R3BHitBuffer R3BParallelDecoder::TakeHits() {
+	if(fResult != &fHits) {
+		R3BHitBuffer hits = fDecoders[0]->TakeHits();
+		fResult = &fDecoders[0]->GetHits();
+		return hits;
+	}
+	/* the merged buffer goes, a spare of the caller's decoder takes its place */
+	R3BHitBuffer hits(std::move(fHits));
+	fHits = fDecoders[0]->TakeHits();
+	fHits.Clear();
+	return hits;
+}
+
+void R3BParallelDecoder::Work(unsigned index) {
+	R3BAlpideDecoder& decoder = *fDecoders[index];
+	size_t nDone = 0;
+	for(size_t i; (i = fNext.fetch_add(1, memory_order_relaxed)) < fJobs.size(); ++nDone) {
+		const Job& job = fJobs[i];
+		fJobOk[i] = decoder.DecodeEvent(job.data, job.nBytes);
+		// swap buffers with the decoder, both keep their capacity
+		decoder.RecycleHits(std::move(fJobHits[i]));
+		fJobHits[i] = decoder.TakeHits();
+	}
+	lock_guard<mutex> lock(fMutex);
+	fNDone += nDone;
+	if(index > 0) --fNActive;
+	if(fNDone == fJobs.size() && fNActive == 0) fDone.notify_one();
+}
+
+void R3BParallelDecoder::WorkerLoop(unsigned index) {
+	uint64_t generation = 0;
+	for(;;) {
+		{
+			unique_lock<mutex> lock(fMutex);
+			fWake.wait(lock, [&]() {return fQuit || (fOpen && fGeneration != generation);});
+			if(fQuit) return;
+			generation = fGeneration;
+			++fNActive; // the caller waits for this one before the next buffer
+		}
+		Work(index);
+	}
+}
+
+R3BDecodeErrors R3BParallelDecoder::GetErrors() const {
+	R3BDecodeErrors errors = fDecoders[0]->GetErrors();
+	for(size_t i=1; i<fDecoders.size(); ++i) errors.Merge(fDecoders[i]->GetErrors());
+	return errors;
+}
@@ -0,0 +1,123 @@
+#ifndef R3B_PARALLELDECODER_H
+#define R3B_PARALLELDECODER_H
+
+/* >> Multi-chip MOSAIC buffers decoded one chip per thread
+ * A buffer holding the events of several chips is cut in front of every chip
+ * header and empty frame. The segments are decoded at the same time, each by
+ * the R3BAlpideDecoder of the thread which picked it, so no decoder state is
+ * shared. The hits are then appended in the order the chips came in the
+ * buffer, with the same result as one decoder over the whole buffer. One
+ * exception: there a bad word drops the rest of the buffer, here only the rest
+ * of its chip's segment.
+ * Buffers below SetMinParallelBytes() or with a single chip event, as MOSAIC
+ * sends one chip per ReadEventData, are decoded on the calling thread, exactly
+ * as by R3BAlpideDecoder. The interface is the same too, but the hit limit
+ * (SetHitLimit / IsSuspended / ResumeEvent) only holds for those: a buffer
+ * decoded in parallel is decoded at once.
+ * Consecutive single-chip buffers go side by side through DecodeEvents()
+ * instead, one whole buffer per thread: R3BScanPipeline batches them so. */
+
+#include "R3BAlpideDecoder.h"
+#include "R3BHitBuffer.h"
+#include "R3BDecodeErrors.h"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class R3BParallelDecoder {
+public:
+	static const size_t DEFAULT_MIN_PARALLEL_BYTES = 1 << 14;
+	static const unsigned MAX_THREADS = 16; // a MOSAIC board reads out up to 16 chips
+
+	struct Segment {
+		int begin;  // byte offset in the buffer
+		int nBytes;
+	};
+
+private:
+	std::vector<std::unique_ptr<R3BAlpideDecoder>> fDecoders; // [0] belongs to the calling thread
+	std::vector<std::thread> fWorkers;
+	size_t fMinParallelBytes;
+	FillerSkipFn fSkipFiller;
+
+	struct Job {
+		unsigned char* data;
+		int nBytes;
+	};
+
+	// what is being decoded, set before the workers are woken
+	std::vector<Segment> fSegments;
+	std::vector<Job> fJobs;           // the segments of one buffer, or the buffers of DecodeEvents()
+	std::vector<R3BHitBuffer> fJobHits;
+	std::vector<char> fJobOk;
+	std::atomic<size_t> fNext; // next job to take
+
+	std::mutex fMutex;
+	std::condition_variable fWake;
+	std::condition_variable fDone;
+	uint64_t fGeneration; // one per parallel buffer or DecodeEvents()
+	size_t fNDone;        // jobs decoded
+	unsigned fNActive;    // workers still in the current buffer
+	bool fOpen;           // workers may join the current buffer
+	bool fQuit;
+
+	R3BHitBuffer fHits;          // merged hits of a parallel buffer
+	const R3BHitBuffer* fResult; // fHits, or the caller's decoder's own after a serial buffer
+	size_t fHitLimit;
+	uint64_t fNParallel; // buffers decoded in parallel
+	uint64_t fNSerial;
+	uint64_t fNBatched;  // buffers decoded by DecodeEvents()
+
+public:
+	/* nThreads decoders, the caller's included. 0 = one per core, up to MAX_THREADS */
+	R3BParallelDecoder(unsigned nThreads = 0);
+	~R3BParallelDecoder();
+
+	inline void SetMinParallelBytes(size_t nBytes) {fMinParallelBytes = nBytes;}
+	inline void SetBoard(uint32_t board) {for(auto& d : fDecoders) d->SetBoard(board); fHits.SetBoardIndex(board);}
+	inline void SetDecodeMode(const R3BDecodeMode& mode) {for(auto& d : fDecoders) d->SetDecodeMode(mode);}
+	inline void SetPixelMask(const R3BPixelMask* mask) {for(auto& d : fDecoders) d->SetPixelMask(mask);}
+	inline unsigned GetNThreads() const {return fDecoders.size();}
+
+	/* Same contract as R3BAlpideDecoder::DecodeEvent(): false if any chip event was bad */
+	bool DecodeEvent(unsigned char* data, int nBytes);
+	// hits of the last buffer, valid until the next DecodeEvent()
+	inline const R3BHitBuffer& GetHits() const {return *fResult;}
+
+	/* n buffers side by side, each decoded whole by one thread without a hit limit */
+	void DecodeEvents(unsigned char* const* data, const int* nBytes, size_t n);
+	// of buffer i of the last DecodeEvents(): its result, and its hits swapped with the caller's, both keep their capacity
+	inline bool IsOk(size_t i) const {return fJobOk[i];}
+	inline void SwapHits(size_t i, R3BHitBuffer& hits) {std::swap(fJobHits[i], hits);}
+
+	inline void SetHitLimit(size_t maxHits) {fHitLimit = maxHits;}
+	inline bool IsSuspended() const {return fResult != &fHits && fDecoders[0]->IsSuspended();}
+	bool ResumeEvent();
+	// as R3BAlpideDecoder, steady state without allocations when every buffer taken is recycled
+	R3BHitBuffer TakeHits();
+	inline void RecycleHits(R3BHitBuffer&& hits) {fDecoders[0]->RecycleHits(std::move(hits));}
+
+	// the counters of all threads' decoders added up; each segment counts as an event
+	R3BDecodeErrors GetErrors() const;
+	inline uint64_t GetNParallel() const {return fNParallel;}
+	inline uint64_t GetNSerial() const {return fNSerial;}
+	inline uint64_t GetNBatched() const {return fNBatched;}
+
+	/* Cuts data in front of each chip header and empty frame but the first, the
+	 * first segment starts at 0 with whatever comes before its chip header.
+	 * Only lead bytes are looked at, the words themselves aren't checked. */
+	static void Split(const unsigned char* data, int nBytes, std::vector<Segment>& segments, FillerSkipFn skipFiller);
+
+private:
+	// decodes fJobs on all threads, the caller's included, and waits for them
+	void Run();
+	void WorkerLoop(unsigned index);
+	// decodes jobs until none is left, from any thread
+	void Work(unsigned index);
+};
+
+#endif
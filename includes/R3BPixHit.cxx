@@ -1,4 +1,5 @@
 #include "R3BPixHit.h"
+#include "R3BHitBuffer.h"
 #include <iostream>
 #include <climits>
 
@@ -27,6 +28,17 @@ R3BPixHit::R3BPixHit(const R3BPixHit& rhs) :
 	fAddress(0),
 	fFlag(AlpidePixFlag::kUNKNOWN) {}
 
+R3BPixHit::R3BPixHit(const R3BPackedHit& hit, uint32_t boardIndex, uint64_t triggerTime) :
+    fBoardIndex(boardIndex),
+    fChipId(hit.GetChipId()),
+    fRegion(hit.GetRegion()),
+    fDcol(hit.GetDoubleColumn()),
+    fAddress(hit.GetAddress()),
+    fBunchCounter(0),
+    fFlag(hit.GetPixFlag()),
+	thi(triggerTime >> 32),
+	tlo(triggerTime & 0xffffffff) {}
+
 R3BPixHit& R3BPixHit::operator=(const R3BPixHit& rhs) {
 	fBoardIndex   = rhs.fBoardIndex;
 	fChipId       = rhs.fChipId;
@@ -41,8 +53,8 @@ R3BPixHit& R3BPixHit::operator=(const R3BPixHit& rhs) {
 }
 
 void R3BPixHit::SetChipId(const uint32_t value) {
-    if(value == ILLEGAL_CHIP_ID) {
-        cerr << "R3BPixHit::SetChipId() - Warning, illegal chip id = 15" << endl;
+    if(value >= ILLEGAL_CHIP_ID) {
+        cerr << "R3BPixHit::SetChipId() - Warning, chip id > 15" << endl;
         fFlag = AlpidePixFlag::kBAD_CHIPID;
    }
    fChipId = value;
@@ -74,68 +86,20 @@ void R3BPixHit::SetAddress(const uint32_t value) {
     fAddress = value;
 }
 
-uint32_t R3BPixHit::GetChipId() const {
-	if(fChipId == ILLEGAL_CHIP_ID) 
-		cerr << "R3BPixHit::GetChipId() - Warning, illegal chip id = 15" << endl;
-	if(fFlag == AlpidePixFlag::kBAD_CHIPID) 
-		cerr << "R3BPixHit::GetChipId() - Warning, AlpidePixFlag::kBAD_CHIPID" << endl;
-	return fChipId;
-}
-
-unsigned R3BPixHit::GetRegion() const {
-	if (fRegion > common::MAX_REGION) 
-		cerr << "R3BPixHit::GetRegion() - Warning, region > 31" << endl;
-	if (fFlag == AlpidePixFlag::kBAD_REGIONID) 
-		cerr << "R3BPixHit::GetRegion() - Warning, AlpidePixFlag::kBAD_REGIONID" << endl;
-	return fRegion;
-}
-
-unsigned R3BPixHit::GetDoubleColumn() const {
-	if(fDcol > common::MAX_DCOL) 
-		cerr << "R3BPixHit::GetDoubleColumn() - Warning, double column > 511" << endl;
-	if(fFlag == AlpidePixFlag::kBAD_DCOLID) 
-		cerr << "R3BPixHit::GetDoubleColumn() - Warning, AlpidePixFlag::kBAD_DCOLID" << endl;
-	return fDcol;
-}
-
-unsigned R3BPixHit::GetAddress() const {
-	if(fAddress > common::MAX_ADDR) 
-		cerr << "R3BPixHit::GetAddress() - Warning, address > 1023" << endl;
-	if(fFlag == AlpidePixFlag::kBAD_ADDRESS) 
-		cerr << "R3BPixHit::GetAddress() - Warning, AlpidePixFlag::kBAD_ADDRESS" << endl;
-    return fAddress;
-}
-
-AlpidePixFlag R3BPixHit::GetPixFlag() const {
-        if (fFlag == AlpidePixFlag::kBAD_ADDRESS) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kBAD_ADDRESS" << endl;
-        if (fFlag == AlpidePixFlag::kBAD_DCOLID) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kBAD_DCOLID" << endl;
-        if (fFlag == AlpidePixFlag::kBAD_REGIONID) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kBAD_REGIONID" << endl;
-        if (fFlag == AlpidePixFlag::kBAD_CHIPID) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kBAD_CHIPID" << endl;
-        if (fFlag == AlpidePixFlag::kSTUCK) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kSTUCK" << endl;
-        if (fFlag == AlpidePixFlag::kDEAD) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kDEAD" << endl;
-        if (fFlag == AlpidePixFlag::kINEFFICIENT) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kINEFFICIENT" << endl;
-        if (fFlag == AlpidePixFlag::kHOT) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kHOT" << endl;
-        if (fFlag == AlpidePixFlag::kUNKNOWN) 
-            cerr << "R3BPixHit::GetPixFlag() - Warning, AlpidePixFlag::kUNKNOWN" << endl;
-    return fFlag;
-}
+/* The getters only return: the decoder counts bad hits (R3BDecodeErrors) and the flag tells about them */
+uint32_t R3BPixHit::GetChipId() const {return fChipId;}
+unsigned R3BPixHit::GetRegion() const {return fRegion;}
+unsigned R3BPixHit::GetDoubleColumn() const {return fDcol;}
+unsigned R3BPixHit::GetAddress() const {return fAddress;}
+AlpidePixFlag R3BPixHit::GetPixFlag() const {return fFlag;}
 
 bool R3BPixHit::IsPixHitCorrupted() const {
     if((int)GetPixFlag()) return true;
     return false;
 }
 
+// meaningless for kBAD_ADDRESS / kBAD_DCOLID hits
 unsigned R3BPixHit::GetColumn() const {
-    if((fFlag == AlpidePixFlag::kBAD_ADDRESS) || (fFlag == AlpidePixFlag::kBAD_DCOLID))
-        cerr << "R3BPixHit::GetColumn() - Warning, return value probably meaningless" << endl;
     unsigned column = fDcol * 2;
     int leftRight = (((fAddress%4)==1 || ((fAddress%4)==2)) ? 1 : 0);
     column += leftRight;
@@ -143,8 +107,6 @@ unsigned R3BPixHit::GetColumn() const {
 }
 
 unsigned R3BPixHit::GetRow() const {
-    if(fFlag == AlpidePixFlag::kBAD_ADDRESS)
-        cerr << "R3BPixHit::GetRow() - Warning, return value probably meaningless" << endl;
     unsigned row = fAddress / 2; // This is OK for the top-right and the bottom-left pixel within a group of 4
     if((fAddress % 4) == 3) row -=1;
     if((fAddress % 4) == 0) row +=1;
@@ -30,9 +30,11 @@ enum class AlpidePixFlag {
 	kUNKNOWN = 9
 };
 
+class R3BPackedHit;
+
 class R3BPixHit {
 	uint32_t fBoardIndex;   // index of the MOSAIC board which the chip belongs to
-    uint32_t fChipId;       // id of the chip to which belong the hit pixel (!= 15)
+    uint32_t fChipId;       // id of the chip to which belong the hit pixel, 4 bits in the data: [0, 15]
     uint32_t fRegion;       // region id in the range [0, 31]
     uint32_t fDcol;         // double column id in the range [0, 511]
     uint32_t fAddress;      // index (address) of the pixel in the double column in the range [0, 1023]
@@ -44,13 +46,14 @@ class R3BPixHit {
     uint32_t tlo;
 
     // illegal chip id, used for initialization
-    static const uint32_t ILLEGAL_CHIP_ID = 15;   // i.e. 0b1111
+    static const uint32_t ILLEGAL_CHIP_ID = 16;   // one past the 4 bits of the chip header
 	static const uint32_t ILLEGAL_REGION  = 2048;
 	static const uint32_t ILLEGAL_ADDRESS = 4096;
 
 public:
     R3BPixHit();
     R3BPixHit(const R3BPixHit&); //non-default
+    R3BPixHit(const R3BPackedHit& hit, uint32_t boardIndex, uint64_t triggerTime); // view of a packed hit, no checks
     R3BPixHit& operator=(const R3BPixHit& obj);
 
     void SetChipId(const uint32_t value);
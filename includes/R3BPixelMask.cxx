@@ -0,0 +1,174 @@
+#include "R3BPixelMask.h"
+#include "R3BHitBuffer.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+/* bit of (row, col) in its chip's bitmap */
+static inline uint32_t GetBitIndex(int row, int col) {
+	return (uint32_t)col / 2 << 10 | AlpideAddress(row, col);
+}
+
+R3BPixelMask::R3BPixelMask(const R3BPixelMask& other) {
+	*this = other;
+}
+
+R3BPixelMask& R3BPixelMask::operator=(const R3BPixelMask& other) {
+	if(this == &other) return *this;
+	Clear();
+	Merge(other);
+	return *this;
+}
+
+uint64_t* R3BPixelMask::GetOrAllocate(int chipId) {
+	if(!fBits[chipId]) fBits[chipId].reset(new uint64_t[N_WORDS]());
+	return fBits[chipId].get();
+}
+
+void R3BPixelMask::Set(int chipId, int row, int col, bool masked) {
+	if(chipId < 0 || chipId >= N_CHIPS || row < 0 || row >= N_ROWS || col < 0 || col >= N_COLS) {
+		cerr << "R3BPixelMask::Set() - bad pixel " << chipId << " / " << row << " / " << col << endl;
+		return;
+	}
+	if(!masked && !fBits[chipId]) return;
+	const uint32_t i = GetBitIndex(row, col);
+	uint64_t& word = GetOrAllocate(chipId)[i >> 6];
+	if(masked) word |= 1ull << (i & 63);
+	else word &= ~(1ull << (i & 63));
+}
+
+bool R3BPixelMask::Test(int chipId, int row, int col) const {
+	if(chipId < 0 || chipId >= N_CHIPS || row < 0 || row >= N_ROWS || col < 0 || col >= N_COLS) return false;
+	const uint64_t* bits = fBits[chipId].get();
+	if(!bits) return false;
+	const uint32_t i = GetBitIndex(row, col);
+	return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+size_t R3BPixelMask::Count(int chipId) const {
+	if(chipId < 0 || chipId >= N_CHIPS || !fBits[chipId]) return 0;
+	size_t n = 0;
+	for(size_t w=0; w<N_WORDS; ++w) n += __builtin_popcountll(fBits[chipId][w]);
+	return n;
+}
+
+size_t R3BPixelMask::Count() const {
+	size_t n = 0;
+	for(int chipId=0; chipId<N_CHIPS; ++chipId) n += Count(chipId);
+	return n;
+}
+
+void R3BPixelMask::Merge(const R3BPixelMask& other) {
+	for(int chipId=0; chipId<N_CHIPS; ++chipId) {
+		const uint64_t* src = other.fBits[chipId].get();
+		if(!src) continue;
+		uint64_t* dst = GetOrAllocate(chipId);
+		for(size_t w=0; w<N_WORDS; ++w) dst[w] |= src[w];
+	}
+}
+
+void R3BPixelMask::Clear() {
+	for(auto& bits : fBits) bits.reset();
+}
+
+bool R3BPixelMask::Save(const string& fileName) const {
+	FILE* f = fopen(fileName.c_str(), "wb");
+	if(!f) {
+		cerr << "R3BPixelMask::Save() - cannot create " << fileName << " : " << strerror(errno) << endl;
+		return false;
+	}
+	uint32_t nChips = 0;
+	for(int chipId=0; chipId<N_CHIPS; ++chipId) if(Count(chipId)) ++nChips;
+	const uint32_t header[3] = {MAGIC, VERSION, nChips};
+	fwrite(header, sizeof(header), 1, f);
+
+	vector<uint16_t> index;
+	vector<uint64_t> words;
+	for(int chipId=0; chipId<N_CHIPS; ++chipId) {
+		if(!Count(chipId)) continue;
+		index.clear();
+		words.clear();
+		for(size_t w=0; w<N_WORDS; ++w) {
+			if(!fBits[chipId][w]) continue;
+			index.push_back(w);
+			words.push_back(fBits[chipId][w]);
+		}
+		const uint32_t record[2] = {(uint32_t)chipId, (uint32_t)words.size()};
+		fwrite(record, sizeof(record), 1, f);
+		index.resize((index.size() + 3) / 4 * 4, 0); // to 8 bytes
+		fwrite(index.data(), sizeof(uint16_t), index.size(), f);
+		fwrite(words.data(), sizeof(uint64_t), words.size(), f);
+	}
+	const bool ok = !ferror(f);
+	if(fclose(f) != 0 || !ok) {
+		cerr << "R3BPixelMask::Save() - error writing " << fileName << endl;
+		return false;
+	}
+	return true;
+}
+
+bool R3BPixelMask::Load(const string& fileName) {
+	FILE* f = fopen(fileName.c_str(), "rb");
+	if(!f) {
+		cerr << "R3BPixelMask::Load() - cannot open " << fileName << " : " << strerror(errno) << endl;
+		return false;
+	}
+	Clear();
+	bool ok = false;
+	uint32_t header[3];
+	if(fread(header, sizeof(header), 1, f) != 1 || header[0] != MAGIC || header[1] != VERSION) {
+		cerr << "R3BPixelMask::Load() - " << fileName << " is not a pixel mask file" << endl;
+	}
+	else {
+		vector<uint16_t> index;
+		uint32_t nRead = 0;
+		for(; nRead<header[2]; ++nRead) {
+			uint32_t record[2];
+			if(fread(record, sizeof(record), 1, f) != 1 || record[0] >= (uint32_t)N_CHIPS || record[1] > N_WORDS) break;
+			index.resize((record[1] + 3) / 4 * 4);
+			if(fread(index.data(), sizeof(uint16_t), index.size(), f) != index.size()) break;
+			uint64_t* bits = GetOrAllocate(record[0]);
+			uint32_t w = 0;
+			for(; w<record[1]; ++w) {
+				uint64_t word;
+				if(index[w] >= N_WORDS || fread(&word, sizeof(word), 1, f) != 1) break;
+				bits[index[w]] |= word;
+			}
+			if(w != record[1]) break;
+		}
+		ok = nRead == header[2];
+		if(!ok) cerr << "R3BPixelMask::Load() - " << fileName << " is truncated or corrupt" << endl;
+	}
+	fclose(f);
+	if(!ok) Clear();
+	return ok;
+}
+
+AlpidePixFlag R3BPixelClassification::GetPixFlag(int chipId, int row, int col) const {
+	if(hot.Test(chipId, row, col)) return AlpidePixFlag::kHOT;
+	if(dead.Test(chipId, row, col)) return AlpidePixFlag::kDEAD;
+	if(inefficient.Test(chipId, row, col)) return AlpidePixFlag::kINEFFICIENT;
+	return AlpidePixFlag::kOK;
+}
+
+void R3BPixelClassification::Print() const {
+	printf("R3BPixelClassification : %lu dead, %lu inefficient, %lu hot pixels\n",
+		(unsigned long)dead.Count(), (unsigned long)inefficient.Count(), (unsigned long)hot.Count());
+	for(int chipId=0; chipId<R3BPixelMask::N_CHIPS; ++chipId) {
+		const size_t nDead = dead.Count(chipId), nIneff = inefficient.Count(chipId), nHot = hot.Count(chipId);
+		if(nDead + nIneff + nHot == 0) continue;
+		printf("R3BPixelClassification : chip %2d | dead %lu inefficient %lu hot %lu\n", chipId,
+			(unsigned long)nDead, (unsigned long)nIneff, (unsigned long)nHot);
+	}
+}
+
+bool R3BPixelClassification::Write(const string& base) const {
+	bool ok = dead.Save(base + "_dead.mask");
+	ok = inefficient.Save(base + "_inefficient.mask") && ok;
+	ok = hot.Save(base + "_hot.mask") && ok;
+	return ok;
+}
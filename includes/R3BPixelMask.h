@@ -0,0 +1,81 @@
+#ifndef R3B_PIXELMASK_H
+#define R3B_PIXELMASK_H
+
+/* >> One bit per pixel and chip, for masking and the pixel classes of a scan
+ * A chip's 512 x 1024 pixels take 64 kB, allocated when its first pixel is set.
+ * The bits are laid out by double column and address, as the data words carry
+ * them, so R3BAlpideDecoder drops a masked pixel with one bit test.
+ * File, native byte order:
+ *   "R3BM", version, number of chip records (uint32_t each)
+ *   per chip with pixels set: chip id, number n of non-zero 64-bit words,
+ *   n word indices (uint16_t, padded to 8 bytes), the n words */
+
+#include "R3BPixHit.h"
+#include <array>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+class R3BPixelMask {
+public:
+	static const int N_CHIPS = 16;    // chip id is 4 bits
+	static const int N_ROWS  = 512;
+	static const int N_COLS  = 1024;
+	static const uint32_t N_DCOLS = 512;
+	static const uint32_t N_ADDR  = 1024; // addresses per double column
+	static const size_t N_WORDS = (size_t)N_DCOLS * N_ADDR / 64; // per chip
+	static const uint32_t MAGIC = 0x4d423352; // "R3BM"
+	static const uint32_t VERSION = 1;
+
+private:
+	std::array<std::unique_ptr<uint64_t[]>, N_CHIPS> fBits;
+
+public:
+	R3BPixelMask() = default;
+	R3BPixelMask(const R3BPixelMask& other);
+	R3BPixelMask& operator=(const R3BPixelMask& other);
+	R3BPixelMask(R3BPixelMask&&) = default;
+	R3BPixelMask& operator=(R3BPixelMask&&) = default;
+
+	void Set(int chipId, int row, int col, bool masked = true);
+	bool Test(int chipId, int row, int col) const;
+
+	/* hot path: the chip's bits, nullptr when none of its pixels is set */
+	inline const uint64_t* GetBits(uint32_t chipId) const {return chipId < (uint32_t)N_CHIPS ? fBits[chipId].get() : nullptr;}
+	// dcol < N_DCOLS, address < N_ADDR
+	static inline bool TestBit(const uint64_t* bits, uint32_t dcol, uint32_t address) {
+		const uint32_t i = dcol << 10 | address;
+		return (bits[i >> 6] >> (i & 63)) & 1;
+	}
+
+	size_t Count(int chipId) const;
+	size_t Count() const;
+	inline bool IsEmpty() const {return Count() == 0;}
+	// sets every pixel set in other
+	void Merge(const R3BPixelMask& other);
+	void Clear();
+
+	/* false with a message if the file can't be written / read or isn't a mask.
+	 * Load() replaces the current bits. */
+	bool Save(const std::string& fileName) const;
+	bool Load(const std::string& fileName);
+
+private:
+	uint64_t* GetOrAllocate(int chipId);
+};
+
+/* The pixels R3BSCurveAccumulator::Classify() found bad, each in one class at most */
+struct R3BPixelClassification {
+	R3BPixelMask dead;        // kDEAD: no hit at any charge
+	R3BPixelMask inefficient; // kINEFFICIENT: below the efficiency cut at the highest charge
+	R3BPixelMask hot;         // kHOT: fires without injection, or more often than injected
+
+	// kDEAD, kINEFFICIENT, kHOT, or kOK for the other pixels
+	AlpidePixFlag GetPixFlag(int chipId, int row, int col) const;
+	void Print() const;
+	/* <base>_dead.mask, <base>_inefficient.mask and <base>_hot.mask */
+	bool Write(const std::string& base) const;
+};
+
+#endif
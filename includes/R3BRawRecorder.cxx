@@ -0,0 +1,89 @@
+#include "R3BRawRecorder.h"
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <iostream>
+
+using namespace std;
+
+const char R3BRawFileHeader::MAGIC[8] = {'R', '3', 'B', 'R', 'A', 'W', '0', '1'};
+
+R3BRawRecorder::R3BRawRecorder() :
+	fFile(nullptr),
+	fNRecords(0),
+	fNBytes(0) {}
+
+R3BRawRecorder::~R3BRawRecorder() {
+	Close();
+}
+
+void R3BRawRecorder::Open(const string& fileName, int chargeStart, int chargeStep, int nSteps, int colStride) {
+	Close();
+	fFile = fopen(fileName.c_str(), "wb");
+	if(!fFile) {
+		throw runtime_error("R3BRawRecorder::Open() - cannot create " + fileName + " : " + strerror(errno));
+	}
+	setvbuf(fFile, nullptr, _IOFBF, WRITE_BUFFER);
+	fFileName = fileName;
+	fNRecords = 0;
+
+	R3BRawFileHeader header;
+	memcpy(header.magic, R3BRawFileHeader::MAGIC, sizeof(header.magic));
+	header.chargeStart = chargeStart;
+	header.chargeStep  = chargeStep;
+	header.nSteps      = nSteps;
+	header.colStride   = colStride;
+	if(fwrite(&header, sizeof(header), 1, fFile) != 1) {
+		throw runtime_error("R3BRawRecorder::Open() - cannot write " + fileName);
+	}
+	fNBytes = sizeof(header);
+}
+
+void R3BRawRecorder::Close() {
+	if(!fFile) return;
+	if(fclose(fFile) != 0) {
+		cerr << "R3BRawRecorder::Close() - error closing " << fFileName << " : " << strerror(errno) << endl;
+	}
+	fFile = nullptr;
+}
+
+void R3BRawRecorder::Sync() {
+	if(!fFile) return;
+	if(fflush(fFile) != 0) {
+		throw runtime_error("R3BRawRecorder::Sync() - cannot write " + fFileName + " : " + strerror(errno));
+	}
+}
+
+void R3BRawRecorder::Write(R3BRawRecord::Kind kind, const R3BScanContext& ctx, int flag, uint32_t nBytes, const unsigned char* data) {
+	if(!fFile) return;
+	R3BRawRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.kind     = kind;
+	rec.chipId   = ctx.chipId;
+	rec.row      = ctx.row;
+	rec.step     = ctx.step;
+	rec.charge   = ctx.charge;
+	rec.colPhase = ctx.colPhase;
+	rec.flag     = flag;
+	rec.nBytes   = nBytes;
+
+	static const unsigned char zeros[8] = {0};
+	const size_t padding = data ? R3BRawRecord::Padded(nBytes) - nBytes : 0;
+	bool ok = fwrite(&rec, sizeof(rec), 1, fFile) == 1;
+	if(data && nBytes) ok = ok && fwrite(data, 1, nBytes, fFile) == nBytes;
+	if(padding) ok = ok && fwrite(zeros, 1, padding, fFile) == padding;
+	if(!ok) {
+		throw runtime_error("R3BRawRecorder::Write() - cannot write " + fFileName + " : " + strerror(errno));
+	}
+	++fNRecords;
+	fNBytes += sizeof(rec) + (data ? R3BRawRecord::Padded(nBytes) : 0);
+}
+
+void R3BRawRecorder::WriteEvent(const unsigned char* data, int nBytes, int flag, const R3BScanContext& ctx) {
+	if(nBytes < 0) nBytes = 0;
+	Write(R3BRawRecord::kEVENT, ctx, flag, nBytes, data);
+}
+
+void R3BRawRecorder::BeginRow(const R3BScanContext& ctx) {Write(R3BRawRecord::kROW_BEGIN, ctx, 0, 0, nullptr);}
+void R3BRawRecorder::BeginStep(const R3BScanContext& ctx, int nInj) {Write(R3BRawRecord::kSTEP, ctx, 0, nInj, nullptr);}
+void R3BRawRecorder::EndRow(const R3BScanContext& ctx) {Write(R3BRawRecord::kROW_END, ctx, 0, 0, nullptr);}
@@ -0,0 +1,87 @@
+#ifndef R3B_RAWRECORDER_H
+#define R3B_RAWRECORDER_H
+
+/* >> Raw MOSAIC buffers of a scan, as read, for offline replay (R3BRawReplay)
+ * File layout, native byte order:
+ *   R3BRawFileHeader
+ *   R3BRawRecord [+ payload padded to 8 bytes]  ...
+ * Every ReadEventData() result is a kEVENT record with its flag and the buffer;
+ * the row/step markers the sinks see are records of their own, so a replay
+ * drives a sink through exactly the same calls as the scan did. */
+
+#include "R3BScanContext.h"
+#include <cstdio>
+#include <string>
+#include <stdint.h>
+
+struct R3BRawFileHeader {
+	char magic[8];       // R3BRawFileHeader::MAGIC
+	int32_t chargeStart; // scan parameters, to set up the sinks again
+	int32_t chargeStep;
+	int32_t nSteps;
+	int32_t colStride;
+
+	static const char MAGIC[8];
+};
+
+struct R3BRawRecord {
+	enum Kind : uint8_t {
+		kEVENT,
+		kROW_BEGIN,
+		kSTEP,
+		kROW_END
+	};
+
+	uint8_t kind;
+	uint8_t reserved0;
+	int16_t chipId;
+	int16_t row;
+	int16_t step;
+	int32_t charge;
+	int16_t colPhase;
+	int16_t reserved1;
+	int32_t flag;    // ReadEventData() return value, kEVENT only
+	uint32_t nBytes; // payload bytes for kEVENT, injections for kSTEP
+
+	inline R3BScanContext GetContext() const {return R3BScanContext{chipId, row, step, charge, colPhase};}
+	// payload size in the file
+	inline static size_t Padded(size_t nBytes) {return (nBytes + 7) & ~(size_t)7;}
+};
+
+static_assert(sizeof(R3BRawFileHeader) == 24, "R3BRawFileHeader layout");
+static_assert(sizeof(R3BRawRecord) == 24, "R3BRawRecord layout");
+
+class R3BRawRecorder {
+public:
+	static const size_t WRITE_BUFFER = 1 << 22; /* stdio buffer, 4 MB */
+
+private:
+	FILE* fFile;
+	std::string fFileName;
+	uint64_t fNRecords;
+	uint64_t fNBytes;
+
+public:
+	R3BRawRecorder();
+	~R3BRawRecorder();
+
+	/* Throws std::runtime_error if the file can't be created */
+	void Open(const std::string& fileName, int chargeStart, int chargeStep, int nSteps, int colStride);
+	void Close();
+	inline bool IsOpen() const {return fFile != nullptr;}
+	// the records written so far to the file; stdio locks the stream, any thread may call it
+	void Sync();
+
+	void WriteEvent(const unsigned char* data, int nBytes, int flag, const R3BScanContext& ctx);
+	void BeginRow(const R3BScanContext& ctx);
+	void BeginStep(const R3BScanContext& ctx, int nInj);
+	void EndRow(const R3BScanContext& ctx);
+
+	inline uint64_t GetNRecords() const {return fNRecords;}
+	inline uint64_t GetNBytes() const {return fNBytes;}
+
+private:
+	void Write(R3BRawRecord::Kind kind, const R3BScanContext& ctx, int flag, uint32_t nBytes, const unsigned char* data);
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include "R3BRawReplay.h"
+#include "R3BScanSink.h"
+#include "R3BScanPipeline.h"
+#include "R3BParallelDecoder.h"
+#include "AlpideDictionary.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+R3BRawReplay::R3BRawReplay() :
+	fMap(nullptr),
+	fSize(0),
+	fPos(0),
+	fPixelMask(nullptr) {
+		memset(&fHeader, 0, sizeof(fHeader));
+	}
+
+R3BRawReplay::~R3BRawReplay() {
+	Close();
+}
+
+bool R3BRawReplay::Open(const string& fileName) {
+	Close();
+	const int fd = open(fileName.c_str(), O_RDONLY);
+	if(fd < 0) {
+		cerr << "R3BRawReplay::Open() - cannot open " << fileName << " : " << strerror(errno) << endl;
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(R3BRawFileHeader)) {
+		cerr << "R3BRawReplay::Open() - " << fileName << " is too short for a raw file" << endl;
+		close(fd);
+		return false;
+	}
+	// writable private mapping: the decoder takes non-const buffers, nothing goes back to the file
+	void* map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		cerr << "R3BRawReplay::Open() - cannot map " << fileName << " : " << strerror(errno) << endl;
+		return false;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	fMap = static_cast<unsigned char*>(map);
+	fSize = st.st_size;
+	fFileName = fileName;
+
+	memcpy(&fHeader, fMap, sizeof(fHeader));
+	if(memcmp(fHeader.magic, R3BRawFileHeader::MAGIC, sizeof(fHeader.magic)) != 0) {
+		cerr << "R3BRawReplay::Open() - " << fileName << " is not a raw scan file" << endl;
+		Close();
+		return false;
+	}
+	Rewind();
+	return true;
+}
+
+void R3BRawReplay::Close() {
+	if(fMap) munmap(fMap, fSize);
+	fMap = nullptr;
+	fSize = 0;
+	fPos = 0;
+}
+
+bool R3BRawReplay::Next(Entry& entry) {
+	if(!fMap || fPos + sizeof(R3BRawRecord) > fSize) return false;
+	const R3BRawRecord* rec = reinterpret_cast<const R3BRawRecord*>(fMap + fPos);
+	size_t next = fPos + sizeof(R3BRawRecord);
+	entry.record = rec;
+	entry.data = nullptr;
+	if(rec->kind == R3BRawRecord::kEVENT) {
+		if(next + rec->nBytes > fSize) {
+			cerr << "R3BRawReplay::Next() - " << fFileName << " truncated at byte " << fPos << endl;
+			return false;
+		}
+		entry.data = fMap + next;
+		next += R3BRawRecord::Padded(rec->nBytes);
+	}
+	fPos = next;
+	return true;
+}
+
+R3BRawReplay::Stats R3BRawReplay::Run(R3BScanSink& sink, bool pipelined, size_t hitLimit, size_t nBuffers, unsigned decodeThreads) {
+	Stats stats{0, 0, 0, 0, 0, 0.};
+	const auto t0 = chrono::steady_clock::now();
+
+	/* the pipeline recycles its own raw buffers, the mapped data is copied in */
+	size_t bufferSize = 0;
+	Entry entry;
+	if(pipelined) {
+		Rewind();
+		while(Next(entry)) if(entry.data) bufferSize = max(bufferSize, (size_t)entry.record->nBytes);
+	}
+	unique_ptr<R3BScanPipeline> pipeline;
+	if(pipelined) {
+		pipeline.reset(new R3BScanPipeline(sink, nBuffers, max(bufferSize, (size_t)1), hitLimit, decodeThreads));
+		pipeline->SetDecodeMode(fDecodeMode);
+		pipeline->SetPixelMask(fPixelMask);
+		pipeline->Start();
+	}
+	R3BParallelDecoder decoder(pipeline ? 1 : decodeThreads);
+	decoder.SetHitLimit(hitLimit);
+	decoder.SetDecodeMode(fDecodeMode);
+	decoder.SetPixelMask(fPixelMask);
+	bool rowOk = false;
+
+	Rewind();
+	while(Next(entry)) {
+		const R3BRawRecord& rec = *entry.record;
+		const R3BScanContext ctx = rec.GetContext();
+		++stats.nRecords;
+		switch(rec.kind) {
+			case R3BRawRecord::kROW_BEGIN:
+				if(pipeline) pipeline->BeginRow(ctx);
+				else rowOk = sink.BeginRow(ctx) || rowOk;
+				break;
+			case R3BRawRecord::kSTEP:
+				if(pipeline) pipeline->BeginStep(ctx, rec.nBytes);
+				else if(rowOk) sink.BeginStep(ctx, rec.nBytes);
+				break;
+			case R3BRawRecord::kROW_END:
+				if(pipeline) pipeline->EndRow(ctx);
+				else if(rowOk) sink.EndRow(ctx);
+				rowOk = false;
+				break;
+			case R3BRawRecord::kEVENT:
+				if(rec.flag == MosaicDict::kTRGRECORDER_EVENT) {++stats.nTrgRecorder; break;}
+				if(rec.flag == MosaicDict::kEMPTY_EVENT) {++stats.nEmpty; break;}
+				++stats.nData;
+				stats.nDataBytes += rec.nBytes;
+				if(pipeline) {
+					unsigned char* buffer = pipeline->AcquireBuffer();
+					memcpy(buffer, entry.data, rec.nBytes);
+					pipeline->PushEvent(buffer, rec.nBytes, ctx);
+					break;
+				}
+				if(!rowOk) break;
+				decoder.DecodeEvent(entry.data, rec.nBytes);
+				sink.Fill(decoder.GetHits(), ctx);
+				while(decoder.IsSuspended()) {
+					decoder.ResumeEvent();
+					sink.Fill(decoder.GetHits(), ctx);
+				}
+				break;
+			default:
+				cerr << "R3BRawReplay::Run() - unknown record kind " << (int)rec.kind << ", stopping" << endl;
+				fPos = fSize;
+				break;
+		}
+	}
+	if(pipeline) {
+		pipeline->Stop();
+		pipeline->PrintStats();
+	}
+	(pipeline ? pipeline->GetDecodeErrors() : decoder.GetErrors()).Print();
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+	return stats;
+}
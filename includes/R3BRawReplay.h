@@ -0,0 +1,67 @@
+#ifndef R3B_RAWREPLAY_H
+#define R3B_RAWREPLAY_H
+
+/* >> Offline replay of a file written by R3BRawRecorder
+ * The file is memory-mapped (private, copy-on-write), records are walked in
+ * place. Run() feeds the data events to the decoder and the hits to a sink with
+ * the recorded markers, serially or through R3BScanPipeline, as fast as the CPU
+ * allows - no board needed. */
+
+#include "R3BRawRecorder.h"
+#include "R3BAlpideDecoder.h"
+#include <string>
+#include <stdint.h>
+
+class R3BScanSink;
+
+class R3BRawReplay {
+public:
+	struct Entry {
+		const R3BRawRecord* record;
+		unsigned char* data; // kEVENT payload, nullptr otherwise
+	};
+
+	struct Stats {
+		uint64_t nRecords;
+		uint64_t nData;        // data events decoded
+		uint64_t nEmpty;       // empty events
+		uint64_t nTrgRecorder; // trigger recorder events
+		uint64_t nDataBytes;   // bytes decoded
+		double seconds;
+	};
+
+private:
+	unsigned char* fMap;
+	size_t fSize;
+	size_t fPos;
+	std::string fFileName;
+	R3BRawFileHeader fHeader;
+	R3BDecodeMode fDecodeMode;
+	const R3BPixelMask* fPixelMask;
+
+public:
+	R3BRawReplay();
+	~R3BRawReplay();
+
+	/* false (with a message) if the file can't be mapped or isn't a raw file */
+	bool Open(const std::string& fileName);
+	void Close();
+
+	inline const R3BRawFileHeader& GetHeader() const {return fHeader;}
+	// the decoder variant Run() uses, full validation by default
+	inline void SetDecodeMode(const R3BDecodeMode& mode) {fDecodeMode = mode;}
+	// hits of these pixels are dropped while decoding, not owned
+	inline void SetPixelMask(const R3BPixelMask* mask) {fPixelMask = mask;}
+	inline size_t GetSize() const {return fSize;}
+
+	inline void Rewind() {fPos = sizeof(R3BRawFileHeader);}
+	// false at the end of the file, or at a truncated record
+	bool Next(Entry& entry);
+
+	/* Replays the whole file into the sink, the sink isn't terminated.
+	 * decodeThreads > 1 decodes the chips of multi-chip buffers side by side, pipelined
+	 * also consecutive buffers, up to nBuffers/2 at once, see R3BScanPipeline */
+	Stats Run(R3BScanSink& sink, bool pipelined = false, size_t hitLimit = 1 << 16, size_t nBuffers = 8, unsigned decodeThreads = 1);
+};
+
+#endif
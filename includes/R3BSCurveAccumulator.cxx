@@ -0,0 +1,254 @@
+#include "R3BSCurveAccumulator.h"
+#include "R3BHitBuffer.h"
+#include "R3BScanJournal.h"
+#include "TFile.h"
+#include "TTree.h"
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+R3BSCurveAccumulator::R3BSCurveAccumulator() :
+	fChargeStart(0),
+	fChargeStep(1),
+	fNSteps(0),
+	fStep(0),
+	fColStride(1),
+	fColPhase(0),
+	fNCounted(0),
+	fNStray(0),
+	fNRejected(0),
+	fFile(nullptr),
+	fTree(nullptr),
+	fSuccessfulInit(false),
+	fAppendEntries(-1),
+	fTreeChipId(-1),
+	fTreeRow(-1),
+	fTreeColStride(1),
+	fTreeChargeAddr(&fTreeCharge),
+	fTreeNInjAddr(&fTreeNInj),
+	fTreeCountsAddr(&fTreeCounts) {
+		fNInjChip.fill(0);
+	}
+
+R3BSCurveAccumulator::~R3BSCurveAccumulator() {
+	if(fFile) delete fFile; // owns fTree
+}
+
+void R3BSCurveAccumulator::Init(int chargeStart, int chargeStep, int nSteps, int colStride) {
+	if(fOutFileName.empty()) {
+		throw runtime_error("R3BSCurveAccumulator::Init() - empty output name! Please use SetFileName() first.");
+	}
+	if(nSteps <= 0) {
+		throw runtime_error("R3BSCurveAccumulator::Init() - no charge steps.");
+	}
+	fChargeStart = chargeStart;
+	fChargeStep  = chargeStep;
+	fNSteps      = nSteps;
+	fColStride   = colStride > 0 ? colStride : 1;
+
+	fFile = new TFile(fOutFileName.c_str(), fAppendEntries >= 0 ? "UPDATE" : "RECREATE");
+	if(fFile->IsZombie()) {
+		cerr << "R3BSCurveAccumulator::Init() - cannot open " << fOutFileName << endl;
+		delete fFile;
+		fFile = nullptr;
+		return;
+	}
+	if(fAppendEntries >= 0 && !R3BScanJournal::ReopenTree(fFile, "SCurveTree", fAppendEntries, fTree)) {
+		delete fFile;
+		fFile = nullptr;
+		return;
+	}
+	if(fTree) {
+		fTree->SetBranchAddress("CHIP_ID", &fTreeChipId);
+		fTree->SetBranchAddress("ROW", &fTreeRow);
+		fTree->SetBranchAddress("COL_STRIDE", &fTreeColStride);
+		fTree->SetBranchAddress("CHARGE", &fTreeChargeAddr);
+		fTree->SetBranchAddress("N_INJ", &fTreeNInjAddr);
+		fTree->SetBranchAddress("COUNTS", &fTreeCountsAddr);
+		ReadBack();
+	}
+	else {
+		fTree = new TTree("SCurveTree", "SCurveTree");
+		fTree->Branch("CHIP_ID", &fTreeChipId);
+		fTree->Branch("ROW", &fTreeRow);
+		fTree->Branch("COL_STRIDE", &fTreeColStride);
+		fTree->Branch("CHARGE", &fTreeCharge);
+		fTree->Branch("N_INJ", &fTreeNInj);
+		fTree->Branch("COUNTS", &fTreeCounts);
+	}
+	fTree->SetDirectory(fFile);
+
+	fTreeCharge.resize(fNSteps);
+	for(int i=0; i<fNSteps; ++i) fTreeCharge[i] = GetCharge(i);
+	fSuccessfulInit = true;
+}
+
+void R3BSCurveAccumulator::ReadBack() {
+	int nRows = 0;
+	for(Long64_t i=0; i<fTree->GetEntries(); ++i) {
+		fTree->GetEntry(i);
+		if(fTreeChipId < 0 || fTreeChipId >= N_CHIPS || fTreeRow < 0 || fTreeRow >= N_ROWS
+			|| fTreeColStride != fColStride || fTreeCounts.size() != (size_t)fNSteps * N_COLS) {
+			cerr << "R3BSCurveAccumulator::ReadBack() - entry " << i << " doesn't match the scan, skipped" << endl;
+			continue;
+		}
+		if(fRows[fTreeChipId].empty()) fRows[fTreeChipId].resize(N_ROWS);
+		RowCounts& rc = fRows[fTreeChipId][fTreeRow];
+		rc.counts = fTreeCounts;
+		rc.nInj = fTreeNInj;
+		rc.colStride = fTreeColStride;
+		++nRows;
+	}
+	cout << "R3BSCurveAccumulator : " << nRows << " rows read back from " << fOutFileName << endl;
+}
+
+void R3BSCurveAccumulator::BeginRow(int chipId, int row, int colPhase) {
+	if(chipId < 0 || chipId >= N_CHIPS || row < 0 || row >= N_ROWS) {
+		cerr << "R3BSCurveAccumulator::BeginRow() - bad chip " << chipId << " / row " << row << endl;
+		return;
+	}
+	if(fRows[chipId].empty()) fRows[chipId].resize(N_ROWS);
+	RowCounts& rc = fRows[chipId][row];
+	if(!rc.IsScanned()) {
+		rc.counts.assign((size_t)fNSteps * N_COLS, 0);
+		rc.nInj.assign((size_t)fColStride * fNSteps, 0);
+		rc.colStride = fColStride;
+	}
+	fColPhase = colPhase % fColStride;
+	if(!fActive[chipId].test(row)) {
+		fActive[chipId].set(row);
+		fActiveList.emplace_back(chipId, row);
+	}
+}
+
+void R3BSCurveAccumulator::SetStep(int step) {
+	if(step < 0 || step >= fNSteps) {
+		cerr << "R3BSCurveAccumulator::SetStep() - step " << step << " out of range" << endl;
+		return;
+	}
+	fStep = step;
+}
+
+void R3BSCurveAccumulator::AddInjections(int nInj) {
+	const size_t offset = (size_t)fColPhase * fNSteps + fStep;
+	uint32_t chips = 0;
+	for(auto& [chipId, row] : fActiveList) {
+		fRows[chipId][row].nInj[offset] += nInj;
+		chips |= 1u << chipId;
+	}
+	for(int chipId=0; chipId<N_CHIPS; ++chipId) if(chips >> chipId & 1) fNInjChip[chipId] += nInj;
+}
+
+void R3BSCurveAccumulator::Fill(const R3BHitBuffer& hits) {
+	const size_t offset = (size_t)fStep * N_COLS;
+	for(size_t i=0; i<hits.Size(); ++i) {
+		if(hits.GetPixFlag(i) != AlpidePixFlag::kOK) {
+			++fNRejected;
+			continue;
+		}
+		const uint32_t chipId = hits.GetChipId(i);
+		const uint32_t row = hits.GetRow(i);
+		const uint32_t col = hits.GetColumn(i);
+		if(row >= (uint32_t)N_ROWS || col >= (uint32_t)N_COLS) { // unchecked with DecodeValidation below kFULL
+			++fNRejected;
+			continue;
+		}
+		if(!fActive[chipId].test(row) || (int)(col % fColStride) != fColPhase) {
+			++fNStray;
+			vector<uint16_t>& stray = fStray[chipId];
+			if(stray.empty()) stray.assign((size_t)N_ROWS * N_COLS, 0);
+			uint16_t& n = stray[(size_t)row * N_COLS + col];
+			if(n != UINT16_MAX) ++n;
+			continue;
+		}
+		uint16_t& count = fRows[chipId][row].counts[offset + col];
+		if(count != UINT16_MAX) ++count;
+		++fNCounted;
+	}
+}
+
+void R3BSCurveAccumulator::EndRow() {
+	for(auto& [chipId, row] : fActiveList) {
+		fActive[chipId].reset(row);
+		if(!fTree || fColPhase != fColStride - 1) continue;
+		const RowCounts& rc = fRows[chipId][row];
+		fTreeChipId = chipId;
+		fTreeRow    = row;
+		fTreeColStride = fColStride;
+		fTreeNInj   = rc.nInj;
+		fTreeCounts = rc.counts;
+		fTree->Fill();
+	}
+	fActiveList.clear();
+}
+
+void R3BSCurveAccumulator::Checkpoint(R3BScanJournal& journal) {
+	if(!fTree) return;
+	fTree->AutoSave("SaveSelf;FlushBaskets");
+	journal.SetEntries(fOutFileName, fTree->GetEntries());
+}
+
+void R3BSCurveAccumulator::Terminate() {
+	if(!fActiveList.empty()) EndRow();
+	if(!fFile || !fTree) return;
+	fFile->cd();
+	fTree->Write();
+	fFile->Close();
+	cout << "R3BSCurveAccumulator::Terminate() - " << fNCounted << " hits counted, "
+		<< fNStray << " outside the pulsed rows, " << fNRejected << " flagged bad" << endl;
+}
+
+const R3BSCurveAccumulator::RowCounts* R3BSCurveAccumulator::GetRow(int chipId, int row) const {
+	if(chipId < 0 || chipId >= N_CHIPS || row < 0 || row >= N_ROWS) return nullptr;
+	if(fRows[chipId].empty() || !fRows[chipId][row].IsScanned()) return nullptr;
+	return &fRows[chipId][row];
+}
+
+vector<int> R3BSCurveAccumulator::GetScannedChips() const {
+	vector<int> chips;
+	for(int chipId=0; chipId<N_CHIPS; ++chipId) {
+		if(!fRows[chipId].empty()) chips.push_back(chipId);
+	}
+	return chips;
+}
+
+R3BPixelClassification R3BSCurveAccumulator::Classify(const PixelCuts& cuts, const R3BPixelMask* masked) const {
+	R3BPixelClassification classes;
+	for(int chipId=0; chipId<N_CHIPS; ++chipId) {
+		/* hot: firing without injection, in any row */
+		const vector<uint16_t>& stray = fStray[chipId];
+		const double maxStray = cuts.maxFakeRate * fNInjChip[chipId];
+		if(!stray.empty() && fNInjChip[chipId]) {
+			for(int row=0; row<N_ROWS; ++row) {
+				for(int col=0; col<N_COLS; ++col) {
+					const uint16_t n = stray[(size_t)row * N_COLS + col];
+					if(n >= cuts.minFakeHits && n > maxStray) classes.hot.Set(chipId, row, col);
+				}
+			}
+		}
+		if(fRows[chipId].empty()) continue;
+		for(int row=0; row<N_ROWS; ++row) {
+			const RowCounts& rc = fRows[chipId][row];
+			if(!rc.IsScanned()) continue;
+			for(int col=0; col<N_COLS; ++col) {
+				if(classes.hot.Test(chipId, row, col) || (masked && masked->Test(chipId, row, col))) continue;
+				uint32_t total = 0;
+				int top = -1; // highest step pulsed
+				bool over = false;
+				for(int step=0; step<fNSteps; ++step) {
+					const uint16_t nInj = rc.GetNInj(step, col);
+					const uint16_t n = rc.counts[(size_t)step * N_COLS + col];
+					total += n;
+					if(nInj) top = step;
+					if(n > nInj) over = true;
+				}
+				if(top < 0) continue; // column phase never pulsed
+				if(over) classes.hot.Set(chipId, row, col);
+				else if(total == 0) classes.dead.Set(chipId, row, col);
+				else if(rc.counts[(size_t)top * N_COLS + col] < cuts.minEfficiency * rc.GetNInj(top, col)) classes.inefficient.Set(chipId, row, col);
+			}
+		}
+	}
+	return classes;
+}
@@ -0,0 +1,149 @@
+#ifndef R3B_SCURVEACCUMULATOR_H
+#define R3B_SCURVEACCUMULATOR_H
+
+/* >> In-memory S-curve sink
+ * A threshold scan only needs the number of hits per (chip, row, col, charge step).
+ * Instead of one TTree entry per hit, the decoded hits are counted straight into a
+ * dense uint16_t array per scanned row, laid out [step][col]. The number of
+ * injections per step is kept next to it, so efficiency = counts / injections.
+ * Only hits of the rows declared active with BeginRow() are counted, anything
+ * else (noise, masked pixels leaking) is only tallied.
+ * With a column stride > 1 a row is pulsed in colStride stages, one column
+ * phase each; injections are then counted per phase.
+ * Every finished row is written as one TTree entry:
+ *   CHIP_ID, ROW, COL_STRIDE, CHARGE[nSteps], N_INJ[colStride*nSteps], COUNTS[nSteps*1024]
+ * The counts stay in memory after the row is written, Analyse() and Classify()
+ * work from them: 2*nSteps*1024 bytes per scanned row, 53 MB per chip for all
+ * 512 rows at 51 steps, up to 16 chips per board.
+ * A resumed scan reads the rows of the journal back from the file and appends.
+ * The stray hits are counted per pixel as well, against the injections sent while
+ * a row of their chip was pulsed: the fake hit rate Classify() finds hot pixels by. */
+
+#include "Common.h"
+#include "R3BScanSink.h"
+#include "R3BPixelMask.h"
+#include <vector>
+#include <array>
+#include <bitset>
+#include <string>
+#include <stdint.h>
+
+class R3BHitBuffer;
+class TTree;
+class TFile;
+
+class R3BSCurveAccumulator : public R3BScanSink {
+public:
+	static const int N_CHIPS = 16;   // chip id is 4 bits
+	static const int N_ROWS  = 512;
+	static const int N_COLS  = 1024;
+
+	struct RowCounts {
+		std::vector<uint16_t> counts; // [step][col]
+		std::vector<uint16_t> nInj;   // [phase][step], injections sent at that step
+		int colStride = 1;            // column phases, col % colStride
+		inline bool IsScanned() const {return !counts.empty();}
+		inline uint16_t GetNInj(int step, int col) const {return nInj[(size_t)(col % colStride) * (nInj.size() / colStride) + step];}
+	};
+
+	/* Classify() */
+	struct PixelCuts {
+		double minEfficiency = 0.5; // hits / injections at the highest charge pulsed, below: kINEFFICIENT
+		double maxFakeRate = 1e-4;  // stray hits per injection of the chip, above: kHOT
+		uint32_t minFakeHits = 3;   // and at least that many stray hits
+	};
+
+private:
+	int fChargeStart;  // charge of step 0
+	int fChargeStep;   // charge increment per step
+	int fNSteps;       // number of charge steps (inclusive of both ends)
+	int fStep;         // current step
+	int fColStride;    // column phases per row
+
+	std::array<std::vector<RowCounts>, N_CHIPS> fRows; // [chip][row], allocated on first use
+	std::array<std::bitset<N_ROWS>, N_CHIPS> fActive;  // rows currently pulsed, per chip
+	std::vector<std::pair<int,int>> fActiveList;       // same, as (chip,row) for the per-step loops
+	int fColPhase;                                     // pulsed columns of the active rows
+
+	uint64_t fNCounted;  // hits counted in an active row
+	uint64_t fNStray;    // valid hits outside the active rows
+	uint64_t fNRejected; // hits with a bad flag
+	std::array<std::vector<uint16_t>, N_CHIPS> fStray; // [row*N_COLS + col] hits outside the pulsed rows, allocated on first use
+	std::array<uint64_t, N_CHIPS> fNInjChip;           // injections sent while a row of the chip was pulsed
+
+	TFile* fFile;
+	TTree* fTree;
+	std::string fOutFileName;
+	bool fSuccessfulInit;
+	long fAppendEntries; // >= 0: rows of an earlier run to read back, see SetAppend()
+
+	// TTree entry buffers
+	int fTreeChipId;
+	int fTreeRow;
+	int fTreeColStride;
+	std::vector<int> fTreeCharge;
+	std::vector<uint16_t> fTreeNInj;
+	std::vector<uint16_t> fTreeCounts;
+	std::vector<int>* fTreeChargeAddr; // branch addresses of a reopened TTree
+	std::vector<uint16_t>* fTreeNInjAddr;
+	std::vector<uint16_t>* fTreeCountsAddr;
+
+public:
+	R3BSCurveAccumulator();
+	~R3BSCurveAccumulator() override;
+
+	inline void SetFileName(const std::string& fileName) {fOutFileName = fileName;}
+	inline const std::string& GetFileName() const {return fOutFileName;}
+	// before Init(): reopen the file, take its first nEntries rows as scanned and append, -1 recreates it
+	inline void SetAppend(long nEntries) {fAppendEntries = nEntries;}
+
+	// charge of step i is chargeStart + i*chargeStep, i in [0, nSteps)
+	void Init(int chargeStart, int chargeStep, int nSteps, int colStride = 1);
+	inline bool IsInitOk() const {return fSuccessfulInit;}
+
+	// declares columns colPhase + k*colStride of (chip,row) as pulsed until the next EndRow()
+	void BeginRow(int chipId, int row, int colPhase = 0);
+	void SetStep(int step);
+	// number of charge injections sent at the current step, to all active rows
+	void AddInjections(int nInj);
+
+	void Fill(const R3BHitBuffer& hits);
+
+	// deactivates the active rows, writes one entry per row once its last column phase is done
+	void EndRow();
+	void Checkpoint(R3BScanJournal& journal) override;
+	void Terminate() override;
+
+	/* R3BScanSink */
+	inline bool BeginRow(const R3BScanContext& ctx) override {BeginRow(ctx.chipId, ctx.row, ctx.colPhase); return true;}
+	inline void BeginStep(const R3BScanContext& ctx, int nInj) override {SetStep(ctx.step); AddInjections(nInj);}
+	inline void Fill(const R3BHitBuffer& hits, const R3BScanContext&) override {Fill(hits);}
+	inline void EndRow(const R3BScanContext&) override {EndRow();}
+
+	inline int GetNSteps() const {return fNSteps;}
+	inline int GetColStride() const {return fColStride;}
+	inline int GetCharge(int step) const {return fChargeStart + step*fChargeStep;}
+	// nullptr when the row wasn't scanned
+	const RowCounts* GetRow(int chipId, int row) const;
+	std::vector<int> GetScannedChips() const;
+
+	inline uint64_t GetNCounted() const {return fNCounted;}
+	inline uint64_t GetNStray() const {return fNStray;}
+	inline uint64_t GetNRejected() const {return fNRejected;}
+	inline uint64_t GetNInjections(int chipId) const {return fNInjChip[chipId & 0xf];}
+
+private:
+	// the rows of the reopened fTree back into fRows
+	void ReadBack();
+
+public:
+
+	/* After the scan: hot from the stray hits, then from the scanned rows' counts
+	 * dead (no hit at any step), hot (more hits than injections at a step) or
+	 * inefficient (below minEfficiency at the highest charge pulsed). The pixels
+	 * masked while decoding can't be measured, they are left out. */
+	R3BPixelClassification Classify(const PixelCuts& cuts, const R3BPixelMask* masked = nullptr) const;
+	inline R3BPixelClassification Classify() const {return Classify(PixelCuts());}
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "R3BSCurveFitter.h"
+#include "R3BSCurveAccumulator.h"
+#include "TFile.h"
+#include "TH1F.h"
+#include "TH2F.h"
+#include <atomic>
+#include <thread>
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+R3BSCurveFitter::R3BSCurveFitter() :
+	fMethod(SCurveMethod::kESTIMATE),
+	fNThreads(0),
+	fMinTurnOn(1) {}
+
+/* Mean and RMS of the derivative of the S-curve, taken between consecutive steps */
+SCurveStatus R3BSCurveFitter::Estimate(const double* charge, const double* eff, int n, float& threshold, float& noise) {
+	if(n < 2) return SCurveStatus::kNO_TURNON;
+	double sum = 0., sumQ = 0., sumQ2 = 0.;
+	for(int i=0; i+1<n; ++i) {
+		const double dEff = eff[i+1] - eff[i];
+		const double q = 0.5 * (charge[i] + charge[i+1]);
+		sum   += dEff;
+		sumQ  += dEff * q;
+		sumQ2 += dEff * q * q;
+	}
+	if(sum <= 0.) return SCurveStatus::kNO_TURNON;
+	const double mean = sumQ / sum;
+	const double var = sumQ2 / sum - mean * mean;
+	threshold = mean;
+	// a step-like curve has no measurable width, take the step spacing as upper bound
+	noise = var > 0. ? sqrt(var) : 0.5 * (charge[n-1] - charge[0]) / (n - 1);
+	return SCurveStatus::kOK;
+}
+
+/* Levenberg-Marquardt on the two erf parameters, starting from Estimate() */
+SCurveStatus R3BSCurveFitter::Fit(const double* charge, const double* eff, int n, float& threshold, float& noise) {
+	SCurveStatus status = Estimate(charge, eff, n, threshold, noise);
+	if(status != SCurveStatus::kOK) return status;
+
+	const double sqrt2 = sqrt(2.);
+	double thr = threshold, sig = max((double)noise, 1e-3);
+	auto chi2 = [&](double t, double s) {
+		double c = 0.;
+		for(int i=0; i<n; ++i) {
+			const double r = eff[i] - 0.5 * (1. + erf((charge[i] - t) / (sqrt2 * s)));
+			c += r * r;
+		}
+		return c;
+	};
+	double lambda = 1e-3;
+	double current = chi2(thr, sig);
+	for(int iter=0; iter<50; ++iter) {
+		// J^T J and J^T r for (thr, sig)
+		double a00 = 0., a01 = 0., a11 = 0., b0 = 0., b1 = 0.;
+		for(int i=0; i<n; ++i) {
+			const double z = (charge[i] - thr) / (sqrt2 * sig);
+			const double model = 0.5 * (1. + erf(z));
+			const double g = exp(-z * z) / (sqrt(M_PI) * sqrt2 * sig); // d(model)/dq
+			const double dThr = -g;
+			const double dSig = -g * (charge[i] - thr) / sig;
+			const double r = eff[i] - model;
+			a00 += dThr * dThr; a01 += dThr * dSig; a11 += dSig * dSig;
+			b0  += dThr * r;    b1  += dSig * r;
+		}
+		const double m00 = a00 * (1. + lambda), m11 = a11 * (1. + lambda);
+		const double det = m00 * m11 - a01 * a01;
+		if(det == 0. || !isfinite(det)) break;
+		const double stepThr = ( m11 * b0 - a01 * b1) / det;
+		const double stepSig = (-a01 * b0 + m00 * b1) / det;
+		const double newThr = thr + stepThr, newSig = sig + stepSig;
+		const double next = newSig > 0. ? chi2(newThr, newSig) : INFINITY;
+		if(next < current) {
+			thr = newThr; sig = newSig;
+			lambda *= 0.1;
+			const bool converged = (current - next) < 1e-9 * (current + 1e-12);
+			current = next;
+			if(converged) break;
+		}
+		else {
+			lambda *= 10.;
+			if(lambda > 1e6) break;
+		}
+	}
+	if(!isfinite(thr) || !isfinite(sig) || thr < charge[0] || thr > charge[n-1]) return SCurveStatus::kFIT_FAILED;
+	threshold = thr;
+	noise = sig;
+	return SCurveStatus::kOK;
+}
+
+void R3BSCurveFitter::ProcessRow(const R3BSCurveAccumulator& scurves, ChipResult& result, int row) const {
+	const R3BSCurveAccumulator::RowCounts* rc = scurves.GetRow(result.chipId, row);
+	if(!rc) return; // stays kNOT_SCANNED
+
+	// only the steps which were actually injected, per column phase
+	const int nSteps = scurves.GetNSteps();
+	vector<int> steps;
+	vector<double> charge, eff;
+	for(int phase=0; phase<rc->colStride; ++phase) {
+		steps.clear();
+		charge.clear();
+		for(int step=0; step<nSteps; ++step) {
+			if(!rc->GetNInj(step, phase)) continue;
+			steps.push_back(step);
+			charge.push_back(scurves.GetCharge(step));
+		}
+		const int n = steps.size();
+		eff.resize(n);
+
+		for(int col=phase; col<N_COLS; col+=rc->colStride) {
+			const size_t idx = (size_t)row * N_COLS + col;
+			int total = 0;
+			for(int i=0; i<n; ++i) {
+				const uint16_t c = rc->counts[(size_t)steps[i] * N_COLS + col];
+				eff[i] = (double)c / rc->GetNInj(steps[i], col);
+				total += c;
+			}
+			float thr = 0.f, sig = 0.f;
+			SCurveStatus status;
+			if(n == 0) status = SCurveStatus::kNOT_SCANNED; // phase never pulsed
+			else if(total == 0) status = SCurveStatus::kNO_HITS;
+			else if(rc->counts[(size_t)steps[n-1] * N_COLS + col] < fMinTurnOn) status = SCurveStatus::kNO_TURNON;
+			else if(fMethod == SCurveMethod::kFIT) status = Fit(charge.data(), eff.data(), n, thr, sig);
+			else status = Estimate(charge.data(), eff.data(), n, thr, sig);
+
+			if(status == SCurveStatus::kFIT_FAILED) Estimate(charge.data(), eff.data(), n, thr, sig);
+			result.status[idx] = status;
+			result.threshold[idx] = thr;
+			result.noise[idx] = sig;
+		}
+	}
+}
+
+void R3BSCurveFitter::Summarise(ChipResult& result) {
+	Summary& s = result.summary;
+	s = Summary{0, 0, 0., 0., 0., 0.};
+	double t2 = 0., n2 = 0.;
+	for(size_t i=0; i<result.status.size(); ++i) {
+		if(result.status[i] == SCurveStatus::kNOT_SCANNED) continue;
+		if(result.status[i] != SCurveStatus::kOK) {++s.nFailed; continue;}
+		++s.nOk;
+		s.thresholdMean += result.threshold[i]; t2 += (double)result.threshold[i] * result.threshold[i];
+		s.noiseMean     += result.noise[i];     n2 += (double)result.noise[i] * result.noise[i];
+	}
+	if(!s.nOk) return;
+	s.thresholdMean /= s.nOk;
+	s.noiseMean     /= s.nOk;
+	s.thresholdRms = sqrt(max(0., t2 / s.nOk - s.thresholdMean * s.thresholdMean));
+	s.noiseRms     = sqrt(max(0., n2 / s.nOk - s.noiseMean * s.noiseMean));
+}
+
+void R3BSCurveFitter::Process(const R3BSCurveAccumulator& scurves) {
+	fResults.clear();
+	for(int chipId : scurves.GetScannedChips()) {
+		ChipResult result;
+		result.chipId = chipId;
+		result.threshold.assign((size_t)N_ROWS * N_COLS, 0.f);
+		result.noise.assign((size_t)N_ROWS * N_COLS, 0.f);
+		result.status.assign((size_t)N_ROWS * N_COLS, SCurveStatus::kNOT_SCANNED);
+		fResults.emplace_back(std::move(result));
+	}
+	if(fResults.empty()) return;
+
+	// work items are (chip, row), handed out through one atomic counter
+	const int nItems = fResults.size() * N_ROWS;
+	atomic<int> next(0);
+	auto worker = [&]() {
+		for(int item = next++; item < nItems; item = next++) {
+			ProcessRow(scurves, fResults[item / N_ROWS], item % N_ROWS);
+		}
+	};
+	unsigned nThreads = fNThreads ? fNThreads : max(1u, thread::hardware_concurrency());
+	vector<thread> pool;
+	for(unsigned i=1; i<nThreads; ++i) pool.emplace_back(worker);
+	worker();
+	for(auto& t : pool) t.join();
+
+	for(auto& result : fResults) Summarise(result);
+}
+
+void R3BSCurveFitter::Print() const {
+	for(const auto& r : fResults) {
+		const Summary& s = r.summary;
+		printf("R3BSCurveFitter : chip %2d | %6d ok, %6d failed | threshold %7.2f +- %6.2f | noise %6.2f +- %6.2f\n",
+			r.chipId, s.nOk, s.nFailed, s.thresholdMean, s.thresholdRms, s.noiseMean, s.noiseRms);
+	}
+}
+
+void R3BSCurveFitter::Write(const string& fileName) const {
+	TFile file(fileName.c_str(), "RECREATE");
+	if(file.IsZombie()) {
+		cerr << "R3BSCurveFitter::Write() - cannot open " << fileName << endl;
+		return;
+	}
+	for(const auto& r : fResults) {
+		const string chip = "_chip" + to_string(r.chipId);
+		TH2F thrMap(("threshold" + chip).c_str(), ("Threshold" + chip + ";column;row").c_str(), N_COLS, 0, N_COLS, N_ROWS, 0, N_ROWS);
+		TH2F noiseMap(("noise" + chip).c_str(), ("Noise" + chip + ";column;row").c_str(), N_COLS, 0, N_COLS, N_ROWS, 0, N_ROWS);
+		TH2F statusMap(("status" + chip).c_str(), ("SCurveStatus" + chip + ";column;row").c_str(), N_COLS, 0, N_COLS, N_ROWS, 0, N_ROWS);
+		TH1F thrDist(("thresholdDist" + chip).c_str(), ("Threshold" + chip + ";charge [DAC]").c_str(), 500, 0, 250);
+		TH1F noiseDist(("noiseDist" + chip).c_str(), ("Noise" + chip + ";charge [DAC]").c_str(), 400, 0, 40);
+		for(int row=0; row<N_ROWS; ++row) {
+			for(int col=0; col<N_COLS; ++col) {
+				const size_t idx = (size_t)row * N_COLS + col;
+				statusMap.SetBinContent(col+1, row+1, (int)r.status[idx]);
+				if(r.status[idx] != SCurveStatus::kOK) continue;
+				thrMap.SetBinContent(col+1, row+1, r.threshold[idx]);
+				noiseMap.SetBinContent(col+1, row+1, r.noise[idx]);
+				thrDist.Fill(r.threshold[idx]);
+				noiseDist.Fill(r.noise[idx]);
+			}
+		}
+		file.cd();
+		thrMap.Write(); noiseMap.Write(); statusMap.Write();
+		thrDist.Write(); noiseDist.Write();
+	}
+	file.Close();
+}
@@ -0,0 +1,86 @@
+#ifndef R3B_SCURVEFITTER_H
+#define R3B_SCURVEFITTER_H
+
+/* >> Per-pixel S-curve analysis of an R3BSCurveAccumulator
+ * The response of a pixel to an injected charge q is an erf S-curve
+ *   eff(q) = 0.5 * (1 + erf((q - threshold) / (sqrt(2) * noise)))
+ * kESTIMATE (default) takes threshold and noise as mean and RMS of the
+ * derivative d(eff)/dq, closed form and a single pass over the steps.
+ * kFIT refines that estimate with a Levenberg-Marquardt least squares fit.
+ * Rows are spread over a pool of threads, results are per chip maps of
+ * 512 x 1024 floats in charge (DAC) units, plus summary statistics. */
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+class R3BSCurveAccumulator;
+
+enum class SCurveMethod {
+	kESTIMATE,
+	kFIT
+};
+
+enum class SCurveStatus : uint8_t {
+	kOK = 0,
+	kNOT_SCANNED = 1, // row never pulsed
+	kNO_HITS = 2,     // no response at any charge
+	kNO_TURNON = 3,   // already fully efficient at the first step, or never reaches it
+	kFIT_FAILED = 4   // kFIT didn't converge, the estimate is kept
+};
+
+class R3BSCurveFitter {
+public:
+	static const int N_ROWS = 512;
+	static const int N_COLS = 1024;
+
+	struct Summary {
+		int nOk;
+		int nFailed;           // everything scanned but not kOK
+		double thresholdMean;
+		double thresholdRms;
+		double noiseMean;
+		double noiseRms;
+	};
+
+	struct ChipResult {
+		int chipId;
+		std::vector<float> threshold;      // [row*N_COLS + col]
+		std::vector<float> noise;          // [row*N_COLS + col]
+		std::vector<SCurveStatus> status;  // [row*N_COLS + col]
+		Summary summary;
+	};
+
+private:
+	SCurveMethod fMethod;
+	unsigned fNThreads;     // 0 = one per hardware thread
+	int fMinTurnOn;         // minimum number of counts at the highest charge to be analysed
+	std::vector<ChipResult> fResults;
+
+public:
+	R3BSCurveFitter();
+
+	inline void SetMethod(SCurveMethod method) {fMethod = method;}
+	inline void SetNThreads(unsigned nThreads) {fNThreads = nThreads;}
+	inline void SetMinTurnOn(int minCounts) {fMinTurnOn = minCounts;}
+
+	// analyses all the rows of every chip found in the accumulator
+	void Process(const R3BSCurveAccumulator& scurves);
+
+	inline const std::vector<ChipResult>& GetResults() const {return fResults;}
+
+	// threshold/noise maps and distributions per chip, one file
+	void Write(const std::string& fileName) const;
+	void Print() const;
+
+	/* Single pixel, steps with no injections are skipped. Returns the status,
+	 * threshold and noise are only meaningful with kOK */
+	static SCurveStatus Estimate(const double* charge, const double* eff, int n, float& threshold, float& noise);
+	static SCurveStatus Fit(const double* charge, const double* eff, int n, float& threshold, float& noise);
+
+private:
+	void ProcessRow(const R3BSCurveAccumulator& scurves, ChipResult& result, int row) const;
+	static void Summarise(ChipResult& result);
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef R3B_SPSCRING_H
+#define R3B_SPSCRING_H
+
+/* >> Bounded lock-free single-producer/single-consumer ring
+ * Exactly one thread pushes and exactly one thread pops. Capacity is rounded
+ * up to a power of two. Push()/Pop() wait (spin, then yield, then short sleeps)
+ * when the ring is full/empty, which is what gives the pipeline its backpressure.
+ * Occupancy counters are kept by the producer and the consumer on their own
+ * cache lines, and can be read from any thread. */
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <stdint.h>
+#include <stddef.h>
+
+template<class T>
+class R3BSPSCRing {
+	std::vector<T> fSlots;
+	size_t fMask;
+
+	alignas(64) std::atomic<size_t> fHead; // next slot to pop, written by the consumer
+	std::atomic<uint64_t> fNEmptyWaits;    // Pop() found the ring empty
+
+	alignas(64) std::atomic<size_t> fTail; // next slot to push, written by the producer
+	std::atomic<uint64_t> fNPushed;
+	std::atomic<uint64_t> fNFullStalls;    // Push() found the ring full
+	std::atomic<uint64_t> fOccupancySum;   // ring size seen at each push
+	std::atomic<size_t> fHighWater;
+
+	static size_t RoundUp(size_t n) {
+		size_t c = 2;
+		while(c < n) c <<= 1;
+		return c;
+	}
+
+	static void Backoff(unsigned& spins) {
+		if(++spins < 64) return;
+		if(spins < 128) std::this_thread::yield();
+		else std::this_thread::sleep_for(std::chrono::microseconds(20));
+	}
+
+public:
+	explicit R3BSPSCRing(size_t capacity) :
+		fSlots(RoundUp(capacity)),
+		fMask(fSlots.size() - 1),
+		fHead(0), fNEmptyWaits(0),
+		fTail(0), fNPushed(0), fNFullStalls(0), fOccupancySum(0), fHighWater(0) {}
+
+	R3BSPSCRing(const R3BSPSCRing&) = delete;
+	R3BSPSCRing& operator=(const R3BSPSCRing&) = delete;
+
+	inline size_t Capacity() const {return fSlots.size();}
+	inline size_t Size() const {return fTail.load(std::memory_order_acquire) - fHead.load(std::memory_order_acquire);}
+
+	bool TryPush(T&& value) {
+		const size_t tail = fTail.load(std::memory_order_relaxed);
+		const size_t size = tail - fHead.load(std::memory_order_acquire);
+		if(size >= fSlots.size()) return false;
+		fSlots[tail & fMask] = std::move(value);
+		fTail.store(tail + 1, std::memory_order_release);
+
+		fNPushed.store(fNPushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		fOccupancySum.store(fOccupancySum.load(std::memory_order_relaxed) + size + 1, std::memory_order_relaxed);
+		if(size + 1 > fHighWater.load(std::memory_order_relaxed)) fHighWater.store(size + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool TryPop(T& value) {
+		const size_t head = fHead.load(std::memory_order_relaxed);
+		if(head == fTail.load(std::memory_order_acquire)) return false;
+		value = std::move(fSlots[head & fMask]);
+		fHead.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	void Push(T&& value) {
+		if(TryPush(std::move(value))) return;
+		fNFullStalls.fetch_add(1, std::memory_order_relaxed);
+		unsigned spins = 0;
+		while(!TryPush(std::move(value))) Backoff(spins);
+	}
+
+	void Pop(T& value) {
+		if(TryPop(value)) return;
+		fNEmptyWaits.fetch_add(1, std::memory_order_relaxed);
+		unsigned spins = 0;
+		while(!TryPop(value)) Backoff(spins);
+	}
+
+	inline uint64_t GetNPushed() const {return fNPushed.load(std::memory_order_relaxed);}
+	inline uint64_t GetNFullStalls() const {return fNFullStalls.load(std::memory_order_relaxed);}
+	inline uint64_t GetNEmptyWaits() const {return fNEmptyWaits.load(std::memory_order_relaxed);}
+	inline size_t GetHighWater() const {return fHighWater.load(std::memory_order_relaxed);}
+	inline double GetMeanOccupancy() const {
+		const uint64_t n = GetNPushed();
+		return n ? (double)fOccupancySum.load(std::memory_order_relaxed) / n : 0.;
+	}
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include "R3BScanBackend.h"
+#include "TDevice.h"
+#include "TAlpide.h"
+#include "TReadoutBoardMOSAIC.h"
+
+R3BMosaicBackend::R3BMosaicBackend(TDevice* device, TReadoutBoardMOSAIC* board) :
+	fDevice(device),
+	fBoard(board) {}
+
+bool R3BMosaicBackend::IsValidChipId(int chipId) {return fDevice->IsValidChipId(chipId);}
+
+int R3BMosaicBackend::ReadRegister(int chipId, AlpideRegister reg, uint16_t& value) {
+	return fDevice->GetChip(chipId)->ReadRegister(reg, value, true, true);
+}
+
+int R3BMosaicBackend::WriteRegister(int chipId, AlpideRegister reg, uint16_t value) {
+	return fDevice->GetChip(chipId)->WriteRegister(reg, value);
+}
+
+void R3BMosaicBackend::WritePixRegAll(int chipId, AlpidePixConfigReg reg, bool value) {
+	fDevice->GetChip(chipId)->WritePixRegAll(reg, value);
+}
+
+void R3BMosaicBackend::WritePixRegRow(int chipId, AlpidePixConfigReg reg, bool value, int row) {
+	fDevice->GetChip(chipId)->WritePixRegRow(reg, value, row);
+}
+
+void R3BMosaicBackend::WritePixRegSingle(int chipId, AlpidePixConfigReg reg, bool value, int row, int col) {
+	fDevice->GetChip(chipId)->WritePixRegSingle(reg, value, row, col);
+}
+
+void R3BMosaicBackend::StartRun() {fBoard->StartRun();}
+void R3BMosaicBackend::StopRun() {fBoard->StopRun();}
+int R3BMosaicBackend::Trigger(int nTriggers) {return fBoard->Trigger(nTriggers);}
+int R3BMosaicBackend::ReadEventData(int& nBytes, unsigned char* buffer) {return fBoard->ReadEventData(nBytes, buffer);}
@@ -0,0 +1,58 @@
+#ifndef R3B_SCANBACKEND_H
+#define R3B_SCANBACKEND_H
+
+/* >> What R3BThresholdScan needs from the hardware
+ * R3BMosaicBackend forwards to a TDevice / TReadoutBoardMOSAIC pair, the real
+ * thing. R3BSimBackend (R3BSimBackend.h) synthesizes the data streams instead,
+ * so the scan loop runs without a board. */
+
+#include "AlpideDictionary.h"
+#include <stdint.h>
+
+class TDevice;
+class TReadoutBoardMOSAIC;
+
+class R3BScanBackend {
+public:
+	virtual ~R3BScanBackend() {}
+
+	virtual bool IsValidChipId(int chipId) = 0;
+
+	virtual int ReadRegister(int chipId, AlpideRegister reg, uint16_t& value) = 0;
+	virtual int WriteRegister(int chipId, AlpideRegister reg, uint16_t value) = 0;
+	virtual void WritePixRegAll(int chipId, AlpidePixConfigReg reg, bool value) = 0;
+	virtual void WritePixRegRow(int chipId, AlpidePixConfigReg reg, bool value, int row) = 0;
+	virtual void WritePixRegSingle(int chipId, AlpidePixConfigReg reg, bool value, int row, int col) = 0;
+
+	virtual void StartRun() = 0;
+	virtual void StopRun() = 0;
+	virtual int Trigger(int nTriggers) = 0;
+	// same contract as TReadoutBoardMOSAIC::ReadEventData()
+	virtual int ReadEventData(int& nBytes, unsigned char* buffer) = 0;
+};
+
+/* Not owning, like R3BThresholdScan itself */
+class R3BMosaicBackend : public R3BScanBackend {
+	TDevice* fDevice;
+	TReadoutBoardMOSAIC* fBoard;
+
+public:
+	R3BMosaicBackend(TDevice* device, TReadoutBoardMOSAIC* board);
+
+	inline void Set(TDevice* device, TReadoutBoardMOSAIC* board) {fDevice = device; fBoard = board;}
+	inline TDevice* GetDevice() const {return fDevice;}
+	inline TReadoutBoardMOSAIC* GetBoard() const {return fBoard;}
+
+	bool IsValidChipId(int chipId) override;
+	int ReadRegister(int chipId, AlpideRegister reg, uint16_t& value) override;
+	int WriteRegister(int chipId, AlpideRegister reg, uint16_t value) override;
+	void WritePixRegAll(int chipId, AlpidePixConfigReg reg, bool value) override;
+	void WritePixRegRow(int chipId, AlpidePixConfigReg reg, bool value, int row) override;
+	void WritePixRegSingle(int chipId, AlpidePixConfigReg reg, bool value, int row, int col) override;
+	void StartRun() override;
+	void StopRun() override;
+	int Trigger(int nTriggers) override;
+	int ReadEventData(int& nBytes, unsigned char* buffer) override;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef R3B_SCANCONTEXT_H
+#define R3B_SCANCONTEXT_H
+
+/* Where the scan stands when a buffer is read: which chip and row are pulsed,
+ * at which charge step. Travels along with the data to the sinks.
+ * chipId is ALL_CHIPS when several chips are pulsed at once, row is ALL_ROWS
+ * when several rows are (the hits carry their own row). */
+struct R3BScanContext {
+	static const int ALL_CHIPS = -1;
+	static const int ALL_ROWS  = -1;
+
+	int chipId;
+	int row;
+	int step;
+	int charge;       // injected charge, VPULSEH - VPULSEL
+	int colPhase = 0; // pulsed columns are colPhase + k*colStride, see R3BInjectionPattern
+};
+
+#endif
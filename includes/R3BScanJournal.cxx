@@ -0,0 +1,166 @@
+#include "R3BScanJournal.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TKey.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+using namespace std;
+
+bool R3BScanJournal::Params::operator==(const Params& o) const {
+	return chargeStart == o.chargeStart && chargeStep == o.chargeStep && nSteps == o.nSteps
+		&& rowsPerStage == o.rowsPerStage && colStride == o.colStride && output == o.output && allChips == o.allChips;
+}
+
+R3BScanJournal::R3BScanJournal() :
+	fNResumes(0) {}
+
+void R3BScanJournal::Clear() {
+	fParams = Params();
+	fNResumes = 0;
+	for(auto& done : fDone) done.reset();
+	fEntries.clear();
+}
+
+int R3BScanJournal::GetNDone() const {
+	int n = 0;
+	for(auto& done : fDone) n += done.count();
+	return n;
+}
+
+long R3BScanJournal::GetEntries(const string& fileName) const {
+	auto it = fEntries.find(fileName);
+	return it == fEntries.end() ? -1 : it->second;
+}
+
+bool R3BScanJournal::Exists() const {
+	return bool(ifstream(fFileName));
+}
+
+bool R3BScanJournal::Load() {
+	Clear();
+	ifstream in(fFileName);
+	if(!in) return false;
+	string line, key;
+	int version = 0;
+	if(!getline(in, line) || !(istringstream(line) >> key >> version) || key != "R3BScanJournal" || version != VERSION) {
+		cerr << "R3BScanJournal::Load() - " << fFileName << " is not a scan journal" << endl;
+		return false;
+	}
+	bool ok = true;
+	while(ok && getline(in, line)) {
+		istringstream s(line);
+		if(!(s >> key)) continue;
+		if(key == "params") {
+			ok = bool(s >> fParams.chargeStart >> fParams.chargeStep >> fParams.nSteps
+				>> fParams.rowsPerStage >> fParams.colStride >> fParams.output >> fParams.allChips);
+		}
+		else if(key == "resumes") ok = bool(s >> fNResumes);
+		else if(key == "entries") {
+			long n;
+			string fileName;
+			ok = bool(s >> n) && getline(s >> ws, fileName) && !fileName.empty();
+			if(ok) fEntries[fileName] = n;
+		}
+		else if(key == "done") {
+			int chipId;
+			string hex;
+			ok = bool(s >> chipId >> hex) && chipId >= 0 && chipId < N_CHIPS && hex.size() == N_ROWS / 4;
+			for(size_t i=0; ok && i<hex.size(); ++i) {
+				const char c = hex[i];
+				const int nibble = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+				ok = nibble >= 0;
+				for(int b=0; ok && b<4; ++b) if(nibble >> b & 1) fDone[chipId].set(4*i + b);
+			}
+		}
+		else ok = false;
+	}
+	if(!ok) {
+		cerr << "R3BScanJournal::Load() - " << fFileName << " is corrupt : " << line << endl;
+		Clear();
+	}
+	return ok;
+}
+
+bool R3BScanJournal::Commit() const {
+	const string tmpName = fFileName + ".tmp";
+	FILE* f = fopen(tmpName.c_str(), "w");
+	if(!f) {
+		cerr << "R3BScanJournal::Commit() - cannot create " << tmpName << " : " << strerror(errno) << endl;
+		return false;
+	}
+	fprintf(f, "R3BScanJournal %d\n", VERSION);
+	fprintf(f, "params %d %d %d %d %d %d %d\n", fParams.chargeStart, fParams.chargeStep, fParams.nSteps,
+		fParams.rowsPerStage, fParams.colStride, fParams.output, (int)fParams.allChips);
+	fprintf(f, "resumes %d\n", fNResumes);
+	for(auto& [fileName, n] : fEntries) fprintf(f, "entries %ld %s\n", n, fileName.c_str());
+	char hex[N_ROWS / 4 + 1];
+	hex[N_ROWS / 4] = '\0';
+	for(int chipId=0; chipId<N_CHIPS; ++chipId) {
+		if(fDone[chipId].none()) continue;
+		for(int i=0; i<N_ROWS/4; ++i) {
+			int nibble = 0;
+			for(int b=0; b<4; ++b) nibble |= fDone[chipId].test(4*i + b) << b;
+			hex[i] = "0123456789abcdef"[nibble];
+		}
+		fprintf(f, "done %d %s\n", chipId, hex);
+	}
+	const bool ok = !ferror(f);
+	if(fclose(f) != 0 || !ok || rename(tmpName.c_str(), fFileName.c_str()) != 0) {
+		cerr << "R3BScanJournal::Commit() - error writing " << fFileName << " : " << strerror(errno) << endl;
+		return false;
+	}
+	return true;
+}
+
+bool R3BScanJournal::ReopenTree(TFile* file, const char* name, long nEntries, TTree*& tree) {
+	tree = nullptr;
+	file->GetObject(name, tree);
+	const long nHeld = tree ? tree->GetEntries() : 0;
+	if(nHeld < nEntries) {
+		cerr << "R3BScanJournal::ReopenTree() - " << file->GetName() << " holds " << nHeld << " of the "
+			<< nEntries << " entries of the finished rows, it can't be resumed" << endl;
+		delete tree;
+		tree = nullptr;
+		return false;
+	}
+	if(!tree) {
+		cerr << "R3BScanJournal::ReopenTree() - no " << name << " in " << file->GetName() << ", starting it again" << endl;
+		return true;
+	}
+	if(nHeld == nEntries) return true;
+
+	/* the unfinished row's entries: copy the rest and drop every cycle of the old header */
+	file->cd();
+	TTree* kept = tree->CloneTree(nEntries);
+	delete tree;
+	tree = kept;
+	for(TKey* key; (key = file->GetKey(name));) {
+		key->Delete();
+		file->GetListOfKeys()->Remove(key);
+		delete key;
+	}
+	kept->SetDirectory(file);
+	cout << "R3BScanJournal : " << file->GetName() << " reopened at entry " << nEntries << endl;
+	return true;
+}
+
+/* Only rows in their last column phase are complete at the next EndRow */
+bool R3BJournalSink::BeginRow(const R3BScanContext& ctx) {
+	const bool ok = fSink.BeginRow(ctx);
+	if(ok && ctx.colPhase == fJournal.GetParams().colStride - 1) fRows.emplace_back(ctx.chipId, ctx.row);
+	return ok;
+}
+
+void R3BJournalSink::EndRow(const R3BScanContext& ctx) {
+	fSink.EndRow(ctx);
+	if(fRows.empty()) return;
+	fSink.Checkpoint(fJournal);
+	for(auto& [chipId, row] : fRows) fJournal.MarkDone(chipId, row);
+	fRows.clear();
+	fJournal.Commit();
+}
@@ -0,0 +1,106 @@
+#ifndef R3B_SCANJOURNAL_H
+#define R3B_SCANJOURNAL_H
+
+/* >> Progress of a scan, to resume it after a crash
+ * One journal per board, <output base>.journal. A (chip, row) is done once its
+ * last column phase ended and the sinks made its data durable (Checkpoint()).
+ * Next to the finished rows the journal keeps the entries each consolidated
+ * output file held at that point: a resumed scan reopens the file, drops what
+ * the unfinished row had written after it and appends.
+ * The file is rewritten as a whole after each finished row, to a temporary
+ * file renamed over the old one, so it is never seen half written. Text:
+ *   R3BScanJournal <version>
+ *   params <chargeStart> <chargeStep> <nSteps> <rowsPerStage> <colStride> <output> <allChips>
+ *   resumes <n>
+ *   entries <n> <file>           one per consolidated output file
+ *   done <chip> <512 bits as hex> one per chip with finished rows, row 0 first */
+
+#include "R3BScanSink.h"
+#include <array>
+#include <bitset>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class TFile;
+class TTree;
+
+class R3BScanJournal {
+public:
+	static const int N_CHIPS = 16; // chip id is 4 bits
+	static const int N_ROWS  = 512;
+	static const int VERSION = 1;
+
+	/* what the rows were scanned with, a resume has to use the same */
+	struct Params {
+		int chargeStart = 0;
+		int chargeStep = 0;
+		int nSteps = 0;
+		int rowsPerStage = 1;
+		int colStride = 1;
+		int output = 0; // ScanOutput
+		bool allChips = false;
+		bool operator==(const Params& o) const;
+		inline bool operator!=(const Params& o) const {return !(*this == o);}
+	};
+
+private:
+	std::string fFileName;
+	Params fParams;
+	int fNResumes;
+	std::array<std::bitset<N_ROWS>, N_CHIPS> fDone;
+	std::map<std::string, long> fEntries; // by output file name
+
+public:
+	R3BScanJournal();
+
+	inline void SetFileName(const std::string& fileName) {fFileName = fileName;}
+	inline const std::string& GetFileName() const {return fFileName;}
+	inline void SetParams(const Params& params) {fParams = params;}
+	inline const Params& GetParams() const {return fParams;}
+
+	// a journal file is there to load, readable or not
+	bool Exists() const;
+	/* false if there is no journal or it can't be read, the journal is then empty */
+	bool Load();
+	/* writes the whole journal, false if it couldn't */
+	bool Commit() const;
+	void Clear();
+
+	inline bool IsDone(int chipId, int row) const {return fDone[chipId & 0xf].test(row);}
+	inline void MarkDone(int chipId, int row) {fDone[chipId & 0xf].set(row);}
+	int GetNDone() const;
+
+	/* entries of a consolidated output at the last finished row, -1 if it has none yet */
+	long GetEntries(const std::string& fileName) const;
+	inline void SetEntries(const std::string& fileName, long nEntries) {fEntries[fileName] = nEntries;}
+
+	inline int GetNResumes() const {return fNResumes;}
+	inline void AddResume() {++fNResumes;}
+
+	/* The TTree of a consolidated output reopened for appending, cut back to the
+	 * nEntries it held at the last finished row, tree is nullptr if the file has
+	 * none yet. False if it holds fewer: rows the journal has as done are lost
+	 * from it, the scan can't be resumed on that file. */
+	static bool ReopenTree(TFile* file, const char* name, long nEntries, TTree*& tree);
+};
+
+/* Marks the rows done in the journal once the sink it wraps has ended and
+ * checkpointed them. Runs on the sink's thread, as the sink does. */
+class R3BJournalSink : public R3BScanSink {
+	R3BScanSink& fSink;
+	R3BScanJournal& fJournal;
+	std::vector<std::pair<int,int>> fRows; // (chip, row) in their last column phase since the last EndRow
+
+public:
+	R3BJournalSink(R3BScanSink& sink, R3BScanJournal& journal) : fSink(sink), fJournal(journal) {}
+
+	bool BeginRow(const R3BScanContext& ctx) override;
+	void BeginStep(const R3BScanContext& ctx, int nInj) override {fSink.BeginStep(ctx, nInj);}
+	void Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) override {fSink.Fill(hits, ctx);}
+	void EndRow(const R3BScanContext& ctx) override;
+	void Terminate() override {fSink.Terminate();}
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "R3BScanPipeline.h"
+#include "R3BScanSink.h"
+#include "R3BParallelDecoder.h"
+#include <iostream>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+static const size_t MARKER_SLOTS = 4096; // row/step markers queued on top of the data buffers
+
+R3BScanPipeline::R3BScanPipeline(R3BScanSink& sink, size_t nBuffers, size_t bufferSize, size_t hitLimit, unsigned decodeThreads) :
+	fSink(sink),
+	fHitLimit(hitLimit),
+	fDecodeThreads(decodeThreads),
+	fPixelMask(nullptr),
+	fRawRing(nBuffers + MARKER_SLOTS),
+	fFreeRaw(nBuffers),
+	fBatchRing(nBuffers + MARKER_SLOTS),
+	fFreeHits(nBuffers),
+	fRunning(false) {
+		for(size_t i=0; i<nBuffers; ++i) {
+			fRawPool.emplace_back(new unsigned char[bufferSize]);
+			fFreeRaw.Push(fRawPool.back().get());
+			fHitPool.emplace_back(new R3BHitBuffer());
+			fFreeHits.Push(fHitPool.back().get());
+		}
+	}
+
+R3BScanPipeline::~R3BScanPipeline() {
+	if(!fRunning) return;
+	try {
+		Stop();
+	}
+	catch(exception& e) {
+		cerr << "R3BScanPipeline::~R3BScanPipeline() - " << e.what() << endl;
+	}
+}
+
+void R3BScanPipeline::Start() {
+	if(fRunning) return;
+	fRunning = true;
+	fDecoderThread = thread(&R3BScanPipeline::DecoderLoop, this);
+	fSinkThread = thread(&R3BScanPipeline::SinkLoop, this);
+}
+
+void R3BScanPipeline::Stop() {
+	if(!fRunning) return;
+	PushMarker(Kind::kSTOP, R3BScanContext{-1, -1, -1, 0});
+	fDecoderThread.join();
+	fSinkThread.join();
+	fRunning = false;
+	if(fDecoderError) rethrow_exception(fDecoderError);
+	if(fSinkError) rethrow_exception(fSinkError);
+}
+
+unsigned char* R3BScanPipeline::AcquireBuffer() {
+	unsigned char* data = nullptr;
+	fFreeRaw.Pop(data);
+	return data;
+}
+
+void R3BScanPipeline::PushEvent(unsigned char* data, int nBytes, const R3BScanContext& ctx) {
+	fRawRing.Push(RawEvent{Kind::kDATA, data, nBytes, 0, ctx});
+}
+
+void R3BScanPipeline::PushMarker(Kind kind, const R3BScanContext& ctx, int nInj) {
+	fRawRing.Push(RawEvent{kind, nullptr, 0, nInj, ctx});
+}
+
+void R3BScanPipeline::BeginRow(const R3BScanContext& ctx) {PushMarker(Kind::kROW_BEGIN, ctx);}
+void R3BScanPipeline::BeginStep(const R3BScanContext& ctx, int nInj) {PushMarker(Kind::kSTEP, ctx, nInj);}
+void R3BScanPipeline::EndRow(const R3BScanContext& ctx) {PushMarker(Kind::kROW_END, ctx);}
+
+/* Decoder stage: raw buffer -> pooled hit buffer(s), markers go straight through.
+ * With several threads the data buffers already queued behind the first one,
+ * up to one per thread, are decoded side by side and forwarded in their order. */
+void R3BScanPipeline::DecoderLoop() {
+	R3BParallelDecoder decoder(fDecodeThreads);
+	decoder.SetHitLimit(fHitLimit);
+	decoder.SetDecodeMode(fDecodeMode);
+	decoder.SetPixelMask(fPixelMask);
+	// half of the raw buffers at most, the reader fills the others meanwhile
+	const size_t maxBatch = max<size_t>(1, min<size_t>(decoder.GetNThreads(), fRawPool.size() / 2));
+	vector<RawEvent> batch;
+	vector<unsigned char*> batchData;
+	vector<int> batchBytes;
+	RawEvent next;
+	bool pending = false; // next was popped behind a batch and is still to be handled
+
+	// the decoder's buffer is swapped with a pooled one, both sides keep their capacity
+	auto forward = [&](const R3BScanContext& ctx) {
+		R3BHitBuffer* hits = nullptr;
+		fFreeHits.Pop(hits);
+		decoder.RecycleHits(std::move(*hits));
+		*hits = decoder.TakeHits();
+		fBatchRing.Push(Batch{Kind::kDATA, hits, 0, ctx});
+	};
+
+	for(;;) {
+		RawEvent ev;
+		if(pending) ev = next;
+		else fRawRing.Pop(ev);
+		pending = false;
+		if(ev.kind != Kind::kDATA) {
+			fBatchRing.Push(Batch{ev.kind, nullptr, ev.nInj, ev.ctx});
+			if(ev.kind == Kind::kSTOP) {
+				fDecodeErrors = decoder.GetErrors(); // Stop() joins before anyone reads it
+				return;
+			}
+			continue;
+		}
+		batch.assign(1, ev);
+		while(batch.size() < maxBatch && fRawRing.TryPop(next)) {
+			if(next.kind != Kind::kDATA) {
+				pending = true;
+				break;
+			}
+			batch.push_back(next);
+		}
+		if(!fDecoderError) {
+			try {
+				if(batch.size() == 1) {
+					decoder.DecodeEvent(ev.data, ev.nBytes);
+					forward(ev.ctx);
+					while(decoder.IsSuspended()) {
+						decoder.ResumeEvent();
+						forward(ev.ctx);
+					}
+				}
+				else {
+					batchData.clear();
+					batchBytes.clear();
+					for(const RawEvent& e : batch) {
+						batchData.push_back(e.data);
+						batchBytes.push_back(e.nBytes);
+					}
+					decoder.DecodeEvents(batchData.data(), batchBytes.data(), batch.size());
+					for(size_t i=0; i<batch.size(); ++i) {
+						R3BHitBuffer* hits = nullptr;
+						fFreeHits.Pop(hits);
+						decoder.SwapHits(i, *hits);
+						fBatchRing.Push(Batch{Kind::kDATA, hits, 0, batch[i].ctx});
+					}
+				}
+			}
+			catch(...) {
+				fDecoderError = current_exception(); // keep draining so the reader never blocks
+			}
+		}
+		for(RawEvent& e : batch) fFreeRaw.Push(std::move(e.data));
+	}
+}
+
+/* Sink stage: everything reaches the R3BScanSink in the order it was read */
+void R3BScanPipeline::SinkLoop() {
+	bool rowOk = false;
+	for(;;) {
+		Batch batch;
+		fBatchRing.Pop(batch);
+		if(batch.kind == Kind::kSTOP) return;
+		try {
+			if(!fSinkError) {
+				switch(batch.kind) {
+					case Kind::kROW_BEGIN: rowOk = fSink.BeginRow(batch.ctx) || rowOk; break; // once per pulsed chip
+					case Kind::kSTEP:      if(rowOk) fSink.BeginStep(batch.ctx, batch.nInj); break;
+					case Kind::kDATA:      if(rowOk) fSink.Fill(*batch.hits, batch.ctx); break;
+					case Kind::kROW_END:   if(rowOk) fSink.EndRow(batch.ctx); rowOk = false; break;
+					default: break;
+				}
+			}
+		}
+		catch(...) {
+			fSinkError = current_exception();
+		}
+		if(batch.hits) fFreeHits.Push(std::move(batch.hits));
+	}
+}
+
+template<class T>
+R3BScanPipeline::StageStats R3BScanPipeline::MakeStats(const char* name, const R3BSPSCRing<T>& ring) {
+	return StageStats{name, ring.Capacity(), ring.Size(), ring.GetHighWater(), ring.GetMeanOccupancy(),
+		ring.GetNPushed(), ring.GetNFullStalls(), ring.GetNEmptyWaits()};
+}
+
+vector<R3BScanPipeline::StageStats> R3BScanPipeline::GetStats() const {
+	return {
+		MakeStats("reader->decoder", fRawRing),
+		MakeStats("decoder->sink", fBatchRing),
+		MakeStats("free raw buffers", fFreeRaw),
+		MakeStats("free hit buffers", fFreeHits)
+	};
+}
+
+void R3BScanPipeline::PrintStats() const {
+	printf("R3BScanPipeline : %-16s %8s %8s %10s %10s %10s %10s\n", "ring", "size", "max", "mean occ", "pushed", "full", "empty");
+	for(const auto& s : GetStats()) {
+		printf("R3BScanPipeline : %-16s %8zu %8zu %10.2f %10lu %10lu %10lu\n", s.name, s.size, s.highWater, s.meanOccupancy,
+			(unsigned long)s.nPushed, (unsigned long)s.nFullStalls, (unsigned long)s.nEmptyWaits);
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef R3B_SCANPIPELINE_H
+#define R3B_SCANPIPELINE_H
+
+/* >> Three-stage readout pipeline
+ *   reader (thread calling Go)  --raw ring-->  decoder thread(s)  --batch ring-->  sink thread
+ * The reader fills raw buffers taken from a preallocated pool and pushes them
+ * along with row/step markers. The decoder thread decodes each buffer into a
+ * pooled R3BHitBuffer and sends the raw buffer back to the reader. The sink
+ * thread hands the hit buffers to an R3BScanSink and sends them back to the
+ * decoder. All links are bounded SPSC rings, so a slow stage blocks the ones
+ * upstream of it instead of growing memory. GetStats() tells which stage that is. */
+
+#include "R3BSPSCRing.h"
+#include "R3BScanContext.h"
+#include "R3BHitBuffer.h"
+#include "R3BAlpideDecoder.h"
+#include "R3BDecodeErrors.h"
+#include <memory>
+#include <vector>
+#include <thread>
+#include <exception>
+#include <stdint.h>
+
+class R3BScanSink;
+
+class R3BScanPipeline {
+public:
+	enum class Kind : uint8_t {
+		kDATA,
+		kROW_BEGIN,
+		kSTEP,
+		kROW_END,
+		kSTOP
+	};
+
+	struct StageStats {
+		const char* name;
+		size_t capacity;
+		size_t size;
+		size_t highWater;
+		double meanOccupancy; // ring size seen by the producer, averaged over its pushes
+		uint64_t nPushed;
+		uint64_t nFullStalls; // producer had to wait: the downstream stage is the bottleneck
+		uint64_t nEmptyWaits; // consumer had to wait: the upstream stage is the bottleneck
+	};
+
+private:
+	struct RawEvent {
+		Kind kind;
+		unsigned char* data;
+		int nBytes;
+		int nInj;
+		R3BScanContext ctx;
+	};
+	struct Batch {
+		Kind kind;
+		R3BHitBuffer* hits;
+		int nInj;
+		R3BScanContext ctx;
+	};
+
+	R3BScanSink& fSink;
+	size_t fHitLimit;
+	unsigned fDecodeThreads;
+	R3BDecodeMode fDecodeMode;
+	const R3BPixelMask* fPixelMask;
+
+	std::vector<std::unique_ptr<unsigned char[]>> fRawPool;
+	std::vector<std::unique_ptr<R3BHitBuffer>> fHitPool;
+
+	R3BSPSCRing<RawEvent> fRawRing;          // reader  -> decoder
+	R3BSPSCRing<unsigned char*> fFreeRaw;    // decoder -> reader
+	R3BSPSCRing<Batch> fBatchRing;           // decoder -> sink
+	R3BSPSCRing<R3BHitBuffer*> fFreeHits;    // sink    -> decoder
+
+	std::thread fDecoderThread;
+	std::thread fSinkThread;
+	bool fRunning;
+
+	std::exception_ptr fDecoderError;
+	std::exception_ptr fSinkError;
+
+	R3BDecodeErrors fDecodeErrors; // of the decoder thread, set when it stops
+
+public:
+	/* nBuffers raw buffers of bufferSize bytes, the same number of hit buffers.
+	 * decodeThreads > 1: the decoder stage splits multi-chip buffers and decodes
+	 * consecutive buffers side by side, see R3BParallelDecoder. Those are decoded
+	 * whole, the hit limit only bounds a buffer decoded alone. */
+	R3BScanPipeline(R3BScanSink& sink, size_t nBuffers, size_t bufferSize, size_t hitLimit, unsigned decodeThreads = 1);
+	~R3BScanPipeline();
+
+	// the decoder variant, before Start()
+	inline void SetDecodeMode(const R3BDecodeMode& mode) {fDecodeMode = mode;}
+	// not owned, must outlive the pipeline
+	inline void SetPixelMask(const R3BPixelMask* mask) {fPixelMask = mask;}
+	void Start();
+	/* Drains all stages and joins the threads. Rethrows the first exception
+	 * raised in the decoder or sink thread. */
+	void Stop();
+
+	/* Reader stage, all from the thread driving the board */
+	unsigned char* AcquireBuffer(); // blocks until a buffer is free again
+	void PushEvent(unsigned char* data, int nBytes, const R3BScanContext& ctx);
+	void BeginRow(const R3BScanContext& ctx);
+	void BeginStep(const R3BScanContext& ctx, int nInj);
+	void EndRow(const R3BScanContext& ctx);
+
+	std::vector<StageStats> GetStats() const;
+	// after Stop()
+	inline const R3BDecodeErrors& GetDecodeErrors() const {return fDecodeErrors;}
+	void PrintStats() const;
+
+private:
+	void PushMarker(Kind kind, const R3BScanContext& ctx, int nInj = 0);
+	void DecoderLoop();
+	void SinkLoop();
+
+	template<class T>
+	static StageStats MakeStats(const char* name, const R3BSPSCRing<T>& ring);
+};
+
+#endif
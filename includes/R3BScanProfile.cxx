@@ -0,0 +1,148 @@
+#include "R3BScanProfile.h"
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+const char* GetScanStageName(ScanStage stage) {
+	switch(stage) {
+		case ScanStage::kSETUP:     return "setup";
+		case ScanStage::kPIXCONFIG: return "pixconfig";
+		case ScanStage::kREGISTER:  return "register";
+		case ScanStage::kTRIGGER:   return "trigger";
+		case ScanStage::kREAD:      return "read";
+		case ScanStage::kDECODE:    return "decode";
+		case ScanStage::kFILL:      return "fill";
+		case ScanStage::kRECORD:    return "record";
+		case ScanStage::kCLOSE:     return "close";
+		case ScanStage::kANALYSE:   return "analyse";
+		default:                    return "unknown";
+	}
+}
+
+void R3BScanProfile::Histogram::Add(uint64_t ns) {
+	int bin = ns ? 64 - __builtin_clzll(ns) : 0;
+	bins[bin < N_BINS ? bin : N_BINS-1]++;
+}
+
+R3BScanProfile::R3BScanProfile() :
+	fChip(nullptr),
+	fRow(nullptr) {}
+
+void R3BScanProfile::Clear() {
+	fStages = {};
+	fCounters = Counters();
+	fChips.clear();
+	fRows.clear();
+	fChip = nullptr;
+	fRow = nullptr;
+}
+
+void R3BScanProfile::SetRow(int chipId, int row) {
+	fChip = &fChips[chipId];
+	fRow = &fRows[make_pair(chipId, row)];
+}
+
+void R3BScanProfile::EndRow() {
+	fChip = nullptr;
+	fRow = nullptr;
+}
+
+void R3BScanProfile::Add(ScanStage stage, uint64_t ns) {
+	const int i = static_cast<int>(stage);
+	fStages[i].Add(ns);
+	if(fChip) {
+		fChip->stages[i].Add(ns);
+		fChip->latency[i].Add(ns);
+	}
+	if(fRow) fRow->stages[i].Add(ns);
+}
+
+void R3BScanProfile::Count(uint64_t nEvents, uint64_t nBytes, uint64_t nHits) {
+	for(Counters* c : {&fCounters, fChip ? &fChip->counters : nullptr, fRow ? &fRow->counters : nullptr}) {
+		if(!c) continue;
+		c->nEvents += nEvents;
+		c->nBytes += nBytes;
+		c->nHits += nHits;
+	}
+}
+
+/* "stage": {"n": .., "ns": .., "max_ns": ..} for the stages which were timed */
+static void WriteStages(FILE* f, const array<R3BScanProfile::Stat, R3BScanProfile::N_STAGES>& stages) {
+	fprintf(f, "{");
+	bool first = true;
+	for(int i=0; i<R3BScanProfile::N_STAGES; ++i) {
+		if(!stages[i].n) continue;
+		fprintf(f, "%s\"%s\": {\"n\": %lu, \"ns\": %lu, \"max_ns\": %lu}", first ? "" : ", ", GetScanStageName(static_cast<ScanStage>(i)),
+			(unsigned long)stages[i].n, (unsigned long)stages[i].ns, (unsigned long)stages[i].maxNs);
+		first = false;
+	}
+	fprintf(f, "}");
+}
+
+static void WriteCounters(FILE* f, const R3BScanProfile::Counters& c) {
+	fprintf(f, "{\"events\": %lu, \"bytes\": %lu, \"hits\": %lu}", (unsigned long)c.nEvents, (unsigned long)c.nBytes, (unsigned long)c.nHits);
+}
+
+bool R3BScanProfile::Write(const string& fileName) const {
+#ifdef R3B_NO_PROFILE
+	return true; // nothing timed, no report
+#endif
+	FILE* f = fopen(fileName.c_str(), "w");
+	if(!f) {
+		cerr << "R3BScanProfile::Write() - can't open " << fileName << endl;
+		return false;
+	}
+	fprintf(f, "{\n  \"histogram\": \"bin i counts latencies in [2^(i-1), 2^i) ns\",\n  \"stages\": ");
+	WriteStages(f, fStages);
+	fprintf(f, ",\n  \"counters\": ");
+	WriteCounters(f, fCounters);
+	fprintf(f, ",\n  \"chips\": [");
+	bool first = true;
+	for(auto& [chipId, chip] : fChips) {
+		fprintf(f, "%s\n    {\"chip\": %d, \"stages\": ", first ? "" : ",", chipId);
+		WriteStages(f, chip.stages);
+		fprintf(f, ", \"counters\": ");
+		WriteCounters(f, chip.counters);
+		fprintf(f, ", \"latency\": {");
+		bool firstStage = true;
+		for(int i=0; i<N_STAGES; ++i) {
+			if(!chip.stages[i].n) continue;
+			int last = N_BINS;
+			while(last > 0 && !chip.latency[i].bins[last-1]) --last;
+			fprintf(f, "%s\"%s\": [", firstStage ? "" : ", ", GetScanStageName(static_cast<ScanStage>(i)));
+			for(int b=0; b<last; ++b) fprintf(f, "%s%lu", b ? ", " : "", (unsigned long)chip.latency[i].bins[b]);
+			fprintf(f, "]");
+			firstStage = false;
+		}
+		fprintf(f, "}}");
+		first = false;
+	}
+	fprintf(f, "\n  ],\n  \"rows\": [");
+	first = true;
+	for(auto& [key, row] : fRows) {
+		fprintf(f, "%s\n    {\"chip\": %d, \"row\": %d, \"stages\": ", first ? "" : ",", key.first, key.second);
+		WriteStages(f, row.stages);
+		fprintf(f, ", \"counters\": ");
+		WriteCounters(f, row.counters);
+		fprintf(f, "}");
+		first = false;
+	}
+	fprintf(f, "\n  ]\n}\n");
+	const bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+void R3BScanProfile::Print() const {
+	uint64_t total = 0;
+	for(auto& s : fStages) total += s.ns;
+	if(!total) return;
+	printf("R3BScanProfile : %-10s %12s %10s %10s %7s\n", "stage", "calls", "total s", "mean us", "share");
+	for(int i=0; i<N_STAGES; ++i) {
+		const Stat& s = fStages[i];
+		if(!s.n) continue;
+		printf("R3BScanProfile : %-10s %12lu %10.3f %10.2f %6.1f%%\n", GetScanStageName(static_cast<ScanStage>(i)),
+			(unsigned long)s.n, s.ns * 1e-9, s.ns * 1e-3 / s.n, 100. * s.ns / total);
+	}
+}
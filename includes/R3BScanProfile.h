@@ -0,0 +1,128 @@
+#ifndef R3B_SCANPROFILE_H
+#define R3B_SCANPROFILE_H
+
+/* >> Where a scan spends its time
+ * Scoped timers around the hardware calls, the decoder and the output, summed
+ * per stage for the whole scan, per chip (with a log2 latency histogram) and
+ * per row. The row is the one SetRow() was last called with: R3BThresholdScan
+ * passes the first row pulsed at each stage, and chip -1 when all chips are
+ * pulsed together (R3BScanContext::ALL_CHIPS).
+ * Only the thread calling Go() is timed: in pipelined mode decoding and filling
+ * run elsewhere, R3BScanPipeline::PrintStats() covers them.
+ *
+ * Built with R3B_NO_PROFILE (make PROFILE=0) the R3B_PROFILE_* macros expand to
+ * nothing, Print() and Write() then have nothing to report and stay silent. */
+
+#include <array>
+#include <map>
+#include <string>
+#include <chrono>
+#include <utility>
+#include <stdint.h>
+
+enum class ScanStage {
+	kSETUP,     // board and chip configuration, before the scan
+	kPIXCONFIG, // WritePixRegAll/Row/Single
+	kREGISTER,  // ReadRegister/WriteRegister
+	kTRIGGER,
+	kREAD,      // ReadEventData
+	kDECODE,
+	kFILL,      // sink Fill, TTree::Fill for the hit outputs
+	kRECORD,    // R3BRawRecorder
+	kCLOSE,     // sink EndRow/Terminate, TFile::Write/Close
+	kANALYSE,
+	kN_STAGES
+};
+
+const char* GetScanStageName(ScanStage stage);
+
+class R3BScanProfile {
+public:
+	static const int N_STAGES = static_cast<int>(ScanStage::kN_STAGES);
+	static const int N_BINS = 40; // bin i: [2^(i-1), 2^i) ns, bin 0: 0 ns
+
+	struct Stat {
+		uint64_t n = 0;
+		uint64_t ns = 0;
+		uint64_t maxNs = 0;
+		inline void Add(uint64_t t) {++n; ns += t; if(t > maxNs) maxNs = t;}
+	};
+	struct Histogram {
+		std::array<uint64_t, N_BINS> bins{};
+		void Add(uint64_t ns);
+	};
+	struct Counters {
+		uint64_t nEvents = 0; // ReadEventData calls with data
+		uint64_t nBytes = 0;  // raw bytes read
+		uint64_t nHits = 0;   // decoded hits
+	};
+	struct Row {
+		std::array<Stat, N_STAGES> stages;
+		Counters counters;
+	};
+	struct Chip {
+		std::array<Stat, N_STAGES> stages;
+		std::array<Histogram, N_STAGES> latency;
+		Counters counters;
+	};
+
+private:
+	std::array<Stat, N_STAGES> fStages;
+	Counters fCounters;
+	std::map<int, Chip> fChips;
+	std::map<std::pair<int,int>, Row> fRows;
+	Chip* fChip; // current, nullptr outside of a row
+	Row* fRow;
+
+public:
+	R3BScanProfile();
+
+	void Clear();
+	// following Add/Count go to this chip and row too
+	void SetRow(int chipId, int row);
+	void EndRow();
+
+	void Add(ScanStage stage, uint64_t ns);
+	void Count(uint64_t nEvents, uint64_t nBytes, uint64_t nHits);
+
+	inline const Stat& GetStat(ScanStage stage) const {return fStages[static_cast<int>(stage)];}
+	inline const Counters& GetCounters() const {return fCounters;}
+
+	/* JSON report, returns false if nothing could be written. No file with R3B_NO_PROFILE */
+	bool Write(const std::string& fileName) const;
+	void Print() const;
+};
+
+/* Adds its lifetime to a stage of the profile */
+class R3BScopedTimer {
+	R3BScanProfile& fProfile;
+	ScanStage fStage;
+	std::chrono::steady_clock::time_point fStart;
+
+public:
+	inline R3BScopedTimer(R3BScanProfile& profile, ScanStage stage) :
+		fProfile(profile),
+		fStage(stage),
+		fStart(std::chrono::steady_clock::now()) {}
+	inline ~R3BScopedTimer() {
+		fProfile.Add(fStage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - fStart).count());
+	}
+};
+
+#ifndef R3B_NO_PROFILE
+#define R3B_PROFILE_CAT_(a, b) a##b
+#define R3B_PROFILE_CAT(a, b) R3B_PROFILE_CAT_(a, b)
+#define R3B_PROFILE_SCOPE(profile, stage) R3BScopedTimer R3B_PROFILE_CAT(r3bTimer, __LINE__)(profile, stage)
+#define R3B_PROFILE_ADD(profile, stage, ns) (profile).Add(stage, ns)
+#define R3B_PROFILE_COUNT(profile, nEvents, nBytes, nHits) (profile).Count(nEvents, nBytes, nHits)
+#define R3B_PROFILE_ROW(profile, chipId, row) (profile).SetRow(chipId, row)
+#define R3B_PROFILE_END_ROW(profile) (profile).EndRow()
+#else
+#define R3B_PROFILE_SCOPE(profile, stage)
+#define R3B_PROFILE_ADD(profile, stage, ns)
+#define R3B_PROFILE_COUNT(profile, nEvents, nBytes, nHits)
+#define R3B_PROFILE_ROW(profile, chipId, row)
+#define R3B_PROFILE_END_ROW(profile)
+#endif
+
+#endif
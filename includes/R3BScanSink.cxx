@@ -0,0 +1,201 @@
+#include "R3BScanSink.h"
+#include "R3BStorePixHit.h"
+#include "R3BHitBuffer.h"
+#include "R3BScanJournal.h"
+#include "R3BLmdWriter.h"
+#include "R3BRawRecorder.h"
+#include "TTree.h"
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+/* Each sink only gets the rows it took, as if it were the scan's only sink */
+bool R3BTeeSink::BeginRow(const R3BScanContext& ctx) {
+	fFirstOk = fFirst.BeginRow(ctx) || fFirstOk;
+	fSecondOk = fSecond.BeginRow(ctx) || fSecondOk;
+	return fFirstOk || fSecondOk;
+}
+
+void R3BTeeSink::BeginStep(const R3BScanContext& ctx, int nInj) {
+	if(fFirstOk) fFirst.BeginStep(ctx, nInj);
+	if(fSecondOk) fSecond.BeginStep(ctx, nInj);
+}
+
+void R3BTeeSink::Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) {
+	if(fFirstOk) fFirst.Fill(hits, ctx);
+	if(fSecondOk) fSecond.Fill(hits, ctx);
+}
+
+void R3BTeeSink::EndRow(const R3BScanContext& ctx) {
+	if(fFirstOk) fFirst.EndRow(ctx);
+	if(fSecondOk) fSecond.EndRow(ctx);
+	fFirstOk = fSecondOk = false;
+}
+
+void R3BTeeSink::Checkpoint(R3BScanJournal& journal) {
+	fFirst.Checkpoint(journal);
+	fSecond.Checkpoint(journal);
+}
+
+void R3BTeeSink::Terminate() {
+	fFirst.Terminate();
+	fSecond.Terminate();
+}
+
+R3BStorePixHit::Settings R3BHitFileSink::DefaultSettings() {
+	R3BStorePixHit::Settings settings;
+	settings.compression = COMPRESSION;
+	settings.basketSize = BASKET_SIZE;
+	settings.queueDepth = QUEUE_DEPTH;
+	return settings;
+}
+
+/* the LMD writer runs on the sink's thread, the recorder may not: see R3BRawRecorder::Sync() */
+void R3BRawSyncSink::Checkpoint(R3BScanJournal& journal) {
+	if(fLmd) fLmd->Sync();
+	if(fRecorder) fRecorder->Sync();
+	fSink.Checkpoint(journal);
+}
+
+R3BHitTreeSink::R3BHitTreeSink(const string& prefix) :
+	fPrefix(prefix),
+	fChargeInj(0) {
+		fSettings.queueDepth = R3BHitFileSink::QUEUE_DEPTH;
+	}
+
+R3BHitTreeSink::~R3BHitTreeSink() = default; // the stores wait for their writers
+
+bool R3BHitTreeSink::BeginRow(const R3BScanContext& ctx) {
+	string rowFileName = fPrefix + string("_chip") + to_string(ctx.chipId) + string("_row") + to_string(ctx.row);
+	if(ctx.colPhase > 0) rowFileName += string("_phase") + to_string(ctx.colPhase);
+	rowFileName += string(".root");
+	cout << "\n\nrowFileName = " << rowFileName << endl << endl; 
+	unique_ptr<R3BStorePixHit> store(new R3BStorePixHit());
+	store->SetFileName(rowFileName);
+	store->SetSettings(fSettings);
+	store->AddColumn("CHARGE_INJ", &fChargeInj);
+	store->Init();
+	if(!store->IsInitOk()) {
+		cerr << "R3BHitTreeSink::BeginRow() - R3BStorePixHit uninitialized. ChipID = " << ctx.chipId << ", Row = " << ctx.row << endl;
+		return false;
+	}
+	fStores[make_pair(ctx.chipId, ctx.row)] = std::move(store);
+	return true;
+}
+
+/* Every chip's hits go to the file of its own row */
+void R3BHitTreeSink::Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) {
+	fChargeInj = ctx.charge;
+	if(fStores.size() == 1) fStores.begin()->second->Fill(hits);
+	else for(auto& [key, store] : fStores) store->Fill(hits, key.first, key.second);
+}
+
+/* Rows ended earlier whose files are closed by now are let go of */
+void R3BHitTreeSink::EndRow(const R3BScanContext&) {
+	for(auto it = fClosing.begin(); it != fClosing.end();) {
+		if(!(*it)->IsClosed()) {
+			++it;
+			continue;
+		}
+		(*it)->Wait(); // rethrows a write error
+		it = fClosing.erase(it);
+	}
+	for(auto& [key, store] : fStores) {
+		store->Terminate(); // writes and saves the rootfile, on the writer thread
+		fClosing.push_back(std::move(store));
+	}
+	fStores.clear();
+}
+
+/* The row files have nothing to append to, they only have to be closed */
+void R3BHitTreeSink::Checkpoint(R3BScanJournal&) {
+	for(auto& store : fClosing) store->Wait(); // rethrows a write error
+	fClosing.clear();
+}
+
+void R3BHitTreeSink::Terminate() {
+	for(auto& [key, store] : fStores) fClosing.push_back(std::move(store));
+	fStores.clear();
+	for(auto& store : fClosing) store->Terminate();
+	for(auto& store : fClosing) store->Wait();
+	fClosing.clear();
+}
+
+R3BHitFileSink::R3BHitFileSink(const string& prefix, Scope scope) :
+	fPrefix(prefix),
+	fScope(scope),
+	fSettings(DefaultSettings()),
+	fResume(nullptr),
+	fRowInj(0),
+	fChargeInj(0) {}
+
+R3BHitFileSink::~R3BHitFileSink() {
+	try {
+		Terminate();
+	}
+	catch(exception& e) {
+		cerr << "R3BHitFileSink::~R3BHitFileSink() - " << e.what() << endl;
+	}
+}
+
+R3BStorePixHit* R3BHitFileSink::Open(const string& fileName) {
+	cout << "R3BHitFileSink : writing " << fileName << endl;
+	unique_ptr<R3BStorePixHit> store(new R3BStorePixHit());
+	store->SetFileName(fileName);
+	store->SetSettings(fSettings);
+	store->SetCyclicAutoSave(AUTO_SAVE);
+	const long nEntries = fResume ? fResume->GetEntries(fileName) : -1;
+	store->SetAppend(nEntries);
+	const int basketSize = fSettings.basketSize > 0 ? fSettings.basketSize : BASKET_SIZE;
+	store->AddColumn("ROW_INJ", &fRowInj, basketSize);
+	store->AddColumn("CHARGE_INJ", &fChargeInj, basketSize);
+	store->Init();
+	if(!store->IsInitOk() && nEntries >= 0) {
+		/* skipping the row would leave the finished ones missing from the file */
+		throw runtime_error("R3BHitFileSink::Open() - cannot append to " + fileName + ", the scan can't be resumed.");
+	}
+	if(!store->IsInitOk()) {
+		cerr << "R3BHitFileSink::Open() - R3BStorePixHit uninitialized. File = " << fileName << endl;
+		return nullptr;
+	}
+	return store.release();
+}
+
+bool R3BHitFileSink::BeginRow(const R3BScanContext& ctx) {
+	const int key = fScope == Scope::kSCAN ? -1 : ctx.chipId;
+	if(fStores.count(key)) return true;
+	R3BStorePixHit* store = Open(fScope == Scope::kSCAN ? fPrefix + string("_hits.root")
+		: fPrefix + string("_chip") + to_string(ctx.chipId) + string(".root"));
+	if(!store) return false;
+	fStores[key].reset(store);
+	return true;
+}
+
+/* In kCHIP scope every chip's hits go to its own file */
+void R3BHitFileSink::Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) {
+	fRowInj = ctx.row;
+	fChargeInj = ctx.charge;
+	if(fScope == Scope::kSCAN || ctx.chipId != R3BScanContext::ALL_CHIPS) {
+		auto it = fStores.find(fScope == Scope::kSCAN ? -1 : ctx.chipId);
+		if(it != fStores.end()) it->second->Fill(hits);
+	}
+	else for(auto& [chipId, store] : fStores) store->Fill(hits, chipId);
+}
+
+/* The files stay open for the next row */
+void R3BHitFileSink::EndRow(const R3BScanContext&) {}
+
+void R3BHitFileSink::Checkpoint(R3BScanJournal& journal) {
+	for(auto& [chipId, store] : fStores) journal.SetEntries(store->GetFileName(), store->Checkpoint());
+}
+
+/* All files are closed side by side, each by its writer thread */
+void R3BHitFileSink::Terminate() {
+	for(auto& [chipId, store] : fStores) store->Terminate(); // writes and saves the rootfile
+	for(auto& [chipId, store] : fStores) {
+		store->PrintQueueStats();
+		store->Wait();
+	}
+	fStores.clear();
+}
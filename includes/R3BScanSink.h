@@ -0,0 +1,162 @@
+#ifndef R3B_SCANSINK_H
+#define R3B_SCANSINK_H
+
+/* >> Destination of the decoded hits of a scan
+ * R3BThresholdScan::Go() drives a sink row by row:
+ *   BeginRow... -> (BeginStep -> Fill...)... -> EndRow, and Terminate once at the end.
+ * BeginRow is called once per pulsed (chip, row); when several chips or rows are
+ * pulsed at once the other calls carry R3BScanContext::ALL_CHIPS / ALL_ROWS, the
+ * buffers hold hits of all of them and EndRow ends every row begun since the
+ * last EndRow. With a column stride the same row is begun once per column phase.
+ * Calls always come from one thread, not necessarily the one running Go().
+ * With a journal, Checkpoint follows the EndRow of finished rows, see R3BScanJournal. */
+
+#include "R3BScanContext.h"
+#include "R3BStorePixHit.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class R3BHitBuffer;
+class R3BScanJournal;
+class R3BLmdWriter;
+class R3BRawRecorder;
+
+class R3BScanSink {
+public:
+	virtual ~R3BScanSink() {}
+
+	// false if the sink can't take the row, the row is then skipped
+	virtual bool BeginRow(const R3BScanContext& ctx) = 0;
+	// nInj charge injections are sent at this step
+	virtual void BeginStep(const R3BScanContext& ctx, int nInj) {(void)ctx; (void)nInj;}
+	virtual void Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) = 0;
+	virtual void EndRow(const R3BScanContext& ctx) = 0;
+	// everything filled so far to disk, and into the journal what a resume needs to append to it
+	virtual void Checkpoint(R3BScanJournal& journal) {(void)journal;}
+	virtual void Terminate() {}
+};
+
+/* Takes every row and drops the hits: timing the decoder alone, or when the
+ * raw data is the output (ScanOutput::kLMD) */
+class R3BNullSink : public R3BScanSink {
+public:
+	bool BeginRow(const R3BScanContext&) override {return true;}
+	void Fill(const R3BHitBuffer&, const R3BScanContext&) override {}
+	void EndRow(const R3BScanContext&) override {}
+};
+
+/* Passes every call on to two sinks, e.g. the hit files and a R3BStreamSink.
+ * A row is taken if either of them takes it, the steps, hits and end of the
+ * row only go to the sink(s) which took it. */
+class R3BTeeSink : public R3BScanSink {
+	R3BScanSink& fFirst;
+	R3BScanSink& fSecond;
+	bool fFirstOk;  // took a row since the last EndRow, only then it sees the steps and hits
+	bool fSecondOk;
+
+public:
+	R3BTeeSink(R3BScanSink& first, R3BScanSink& second) : fFirst(first), fSecond(second), fFirstOk(false), fSecondOk(false) {}
+
+	bool BeginRow(const R3BScanContext& ctx) override;
+	void BeginStep(const R3BScanContext& ctx, int nInj) override;
+	void Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) override;
+	void EndRow(const R3BScanContext& ctx) override;
+	void Checkpoint(R3BScanJournal& journal) override;
+	void Terminate() override;
+};
+
+/* The raw outputs Go() writes itself, R3BLmdWriter and R3BRawRecorder, go to
+ * disk ahead of each checkpoint of the sink it wraps, so a row the journal has
+ * as done is in them too. Either may be nullptr. */
+class R3BRawSyncSink : public R3BScanSink {
+	R3BScanSink& fSink;
+	R3BLmdWriter* fLmd;
+	R3BRawRecorder* fRecorder;
+
+public:
+	R3BRawSyncSink(R3BScanSink& sink, R3BLmdWriter* lmd, R3BRawRecorder* recorder) : fSink(sink), fLmd(lmd), fRecorder(recorder) {}
+
+	bool BeginRow(const R3BScanContext& ctx) override {return fSink.BeginRow(ctx);}
+	void BeginStep(const R3BScanContext& ctx, int nInj) override {fSink.BeginStep(ctx, nInj);}
+	void Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) override {fSink.Fill(hits, ctx);}
+	void EndRow(const R3BScanContext& ctx) override {fSink.EndRow(ctx);}
+	void Checkpoint(R3BScanJournal& journal) override;
+	void Terminate() override {fSink.Terminate();}
+};
+
+/* Every hit as a TTree entry with its injected charge, one file per (chip, row):
+ * <prefix>_chip<N>_row<M>.root, with _phase<K> appended for column phases K > 0.
+ * A row's files are closed by their writer threads while the next row is scanned,
+ * with a journal Checkpoint() waits for them: a row is done once its files are. */
+class R3BHitTreeSink : public R3BScanSink {
+	std::string fPrefix;
+	R3BStorePixHit::Settings fSettings;
+	std::map<std::pair<int,int>, std::unique_ptr<R3BStorePixHit>> fStores; // open row files by (chip, row)
+	std::vector<std::unique_ptr<R3BStorePixHit>> fClosing;                  // rows ended, files still being written
+	int fChargeInj; // CHARGE_INJ column
+
+public:
+	R3BHitTreeSink(const std::string& prefix);
+	~R3BHitTreeSink();
+
+	// for the files opened from now on
+	inline void SetStoreSettings(const R3BStorePixHit::Settings& settings) {fSettings = settings;}
+
+	bool BeginRow(const R3BScanContext& ctx) override;
+	void Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) override;
+	void EndRow(const R3BScanContext& ctx) override;
+	void Checkpoint(R3BScanJournal& journal) override;
+	void Terminate() override;
+};
+
+/* Every hit as a TTree entry in one file per chip, <prefix>_chip<N>.root, or
+ * in one file for the whole scan, <prefix>_hits.root. The scanned row and the
+ * injected charge are columns ROW_INJ and CHARGE_INJ next to the hit's ROW/COL.
+ * ROW_INJ is -1 when several rows were pulsed at once.
+ * Resumed, the files are reopened at the entries the journal has for them,
+ * BeginRow throws if one can't be: it lost rows the journal has as done. */
+class R3BHitFileSink : public R3BScanSink {
+public:
+	enum class Scope {
+		kCHIP,
+		kSCAN
+	};
+
+	static const int BASKET_SIZE  = 1 << 18; /* bytes per branch, few large baskets per file */
+	static const int COMPRESSION  = 404;     /* LZ4 level 4: hits compress well and it keeps up with the readout */
+	static const long AUTO_SAVE   = 10000000; /* entries between TTree headers written to disk */
+	static const size_t QUEUE_DEPTH = 16;    /* hit batches per file in flight to its writer thread */
+
+	// what the scan's hit files are written with unless set otherwise
+	static R3BStorePixHit::Settings DefaultSettings();
+
+private:
+	std::string fPrefix;
+	Scope fScope;
+	R3BStorePixHit::Settings fSettings;
+	const R3BScanJournal* fResume; // journal of the scan resumed, or nullptr
+	std::map<int, std::unique_ptr<R3BStorePixHit>> fStores; // by chip in kCHIP scope, a single one at -1 in kSCAN
+	int fRowInj;    // ROW_INJ column
+	int fChargeInj; // CHARGE_INJ column
+
+public:
+	R3BHitFileSink(const std::string& prefix, Scope scope);
+	~R3BHitFileSink();
+
+	inline void SetResume(const R3BScanJournal* journal) {fResume = journal;}
+	// for the files opened from now on
+	inline void SetStoreSettings(const R3BStorePixHit::Settings& settings) {fSettings = settings;}
+
+	bool BeginRow(const R3BScanContext& ctx) override;
+	void Fill(const R3BHitBuffer& hits, const R3BScanContext& ctx) override;
+	void EndRow(const R3BScanContext& ctx) override;
+	void Checkpoint(R3BScanJournal& journal) override;
+	void Terminate() override;
+
+private:
+	R3BStorePixHit* Open(const std::string& fileName);
+};
+
+#endif
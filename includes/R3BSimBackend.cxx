@@ -0,0 +1,224 @@
+#include "R3BSimBackend.h"
+#include "R3BHitBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <unistd.h>
+
+using namespace std;
+
+static const int WORDS_PER_ROW = R3BSimBackend::N_COLS / 64;
+
+R3BSimBackend::R3BSimBackend() : R3BSimBackend(Config()) {}
+
+R3BSimBackend::R3BSimBackend(const Config& config) :
+	fConfig(config),
+	fRng(config.seed),
+	fRunning(false),
+	fNTriggers(0),
+	fNHits(0) {
+		// the decoder's address -> (row, col) mapping, inverted
+		for(uint32_t address=0; address<=common::MAX_ADDR; ++address) {
+			fAddress[AlpideRow(address)][AlpideColumn(0, address)] = address;
+		}
+		normal_distribution<float> thr(fConfig.thresholdMean, fConfig.thresholdRMS);
+		normal_distribution<float> noise(fConfig.noiseMean, fConfig.noiseRMS);
+		for(const int id : fConfig.chipIds) {
+			if(id < 0 || id > 15 || FindChip(id)) {
+				cerr << "R3BSimBackend::R3BSimBackend() - bad or repeated chip id " << id << ", skipped" << endl;
+				continue;
+			}
+			Chip chip;
+			chip.id = id;
+			chip.registers[static_cast<int>(AlpideRegister::VPULSEH)] = VPULSEH;
+			chip.mask.assign(N_ROWS * WORDS_PER_ROW, ~0ull);
+			chip.pulse.assign(N_ROWS * WORDS_PER_ROW, 0ull);
+			chip.threshold.resize(N_ROWS * N_COLS);
+			chip.noise.resize(N_ROWS * N_COLS);
+			for(auto& t : chip.threshold) t = thr(fRng);
+			for(auto& n : chip.noise) n = max(noise(fRng), 1e-3f);
+			chip.bunchCounter = 0;
+			fChips.push_back(std::move(chip));
+		}
+	}
+
+R3BSimBackend::Chip* R3BSimBackend::FindChip(int chipId) {
+	for(auto& chip : fChips) if(chip.id == chipId) return &chip;
+	return nullptr;
+}
+
+const R3BSimBackend::Chip* R3BSimBackend::FindChip(int chipId) const {
+	for(auto& chip : fChips) if(chip.id == chipId) return &chip;
+	return nullptr;
+}
+
+bool R3BSimBackend::IsValidChipId(int chipId) {return FindChip(chipId) != nullptr;}
+
+int R3BSimBackend::ReadRegister(int chipId, AlpideRegister reg, uint16_t& value) {
+	Chip* chip = FindChip(chipId);
+	if(!chip) return -1;
+	auto it = chip->registers.find(static_cast<int>(reg));
+	value = it == chip->registers.end() ? 0 : it->second;
+	return 0;
+}
+
+int R3BSimBackend::WriteRegister(int chipId, AlpideRegister reg, uint16_t value) {
+	Chip* chip = FindChip(chipId);
+	if(!chip) return -1;
+	chip->registers[static_cast<int>(reg)] = value;
+	return 0;
+}
+
+vector<uint64_t>* R3BSimBackend::GetPixReg(Chip& chip, AlpidePixConfigReg reg) {
+	if(reg == AlpidePixConfigReg::MASK_ENABLE) return &chip.mask;
+	if(reg == AlpidePixConfigReg::PULSE_ENABLE) return &chip.pulse;
+	return nullptr;
+}
+
+void R3BSimBackend::WritePixRegAll(int chipId, AlpidePixConfigReg reg, bool value) {
+	Chip* chip = FindChip(chipId);
+	vector<uint64_t>* bits = chip ? GetPixReg(*chip, reg) : nullptr;
+	if(bits) fill(bits->begin(), bits->end(), value ? ~0ull : 0ull);
+}
+
+void R3BSimBackend::WritePixRegRow(int chipId, AlpidePixConfigReg reg, bool value, int row) {
+	Chip* chip = FindChip(chipId);
+	vector<uint64_t>* bits = chip ? GetPixReg(*chip, reg) : nullptr;
+	if(!bits || row < 0 || row >= N_ROWS) return;
+	fill(bits->begin() + row * WORDS_PER_ROW, bits->begin() + (row+1) * WORDS_PER_ROW, value ? ~0ull : 0ull);
+}
+
+void R3BSimBackend::WritePixRegSingle(int chipId, AlpidePixConfigReg reg, bool value, int row, int col) {
+	Chip* chip = FindChip(chipId);
+	vector<uint64_t>* bits = chip ? GetPixReg(*chip, reg) : nullptr;
+	if(!bits || row < 0 || row >= N_ROWS || col < 0 || col >= N_COLS) return;
+	uint64_t& word = (*bits)[row * WORDS_PER_ROW + col / 64];
+	if(value) word |= 1ull << (col % 64);
+	else word &= ~(1ull << (col % 64));
+}
+
+void R3BSimBackend::StartRun() {
+	fRunning = true;
+	fEvents.clear();
+}
+
+void R3BSimBackend::StopRun() {
+	fRunning = false;
+}
+
+/* pixels are row*N_COLS + col, the hits of one chip and trigger */
+int R3BSimBackend::Trigger(int nTriggers) {
+	if(fConfig.triggerLatency) usleep(fConfig.triggerLatency);
+	if(!fRunning) return 0;
+	uniform_real_distribution<double> uniform(0., 1.);
+	uniform_int_distribution<uint32_t> anyPixel(0, N_ROWS * N_COLS - 1);
+	poisson_distribution<int> nFake(fConfig.fakeHitRate * N_ROWS * N_COLS);
+	vector<uint32_t> pixels;
+
+	for(int n=0; n<nTriggers; ++n) {
+		++fNTriggers;
+		if(fConfig.triggerRecords) fEvents.push_back(Event{MosaicDict::kTRGRECORDER_EVENT, {}});
+		for(auto& chip : fChips) {
+			pixels.clear();
+			uint16_t vpulseh = 0, vpulsel = 0;
+			ReadRegister(chip.id, AlpideRegister::VPULSEH, vpulseh);
+			ReadRegister(chip.id, AlpideRegister::VPULSEL, vpulsel);
+			const float charge = (float)vpulseh - (float)vpulsel;
+
+			for(int w=0; w<(int)chip.pulse.size(); ++w) {
+				uint64_t bits = chip.pulse[w] & ~chip.mask[w];
+				while(bits) {
+					const uint32_t pixel = w * 64 + __builtin_ctzll(bits);
+					bits &= bits - 1;
+					const double p = 0.5 * erfc((chip.threshold[pixel] - charge) / (sqrt(2.f) * chip.noise[pixel]));
+					if(uniform(fRng) < p) pixels.push_back(pixel);
+				}
+			}
+			if(fConfig.fakeHitRate > 0.) {
+				for(int i = nFake(fRng); i > 0; --i) {
+					const uint32_t pixel = anyPixel(fRng);
+					if(!(chip.mask[pixel / 64] >> (pixel % 64) & 1)) pixels.push_back(pixel);
+				}
+			}
+			fNHits += pixels.size();
+
+			Event ev{pixels.empty() ? MosaicDict::kEMPTY_EVENT : DATA_EVENT, {}};
+			if(!fSpare.empty()) {
+				ev.data = std::move(fSpare.back());
+				fSpare.pop_back();
+			}
+			Encode(chip, pixels, ev.data);
+			fEvents.push_back(std::move(ev));
+		}
+	}
+	return nTriggers;
+}
+
+/* The chip's readout order: regions, then double columns, then addresses, ascending.
+ * Up to 8 consecutive addresses of a double column share a DATALONG word. */
+void R3BSimBackend::Encode(Chip& chip, vector<uint32_t>& pixels, vector<unsigned char>& out) {
+	out.clear();
+	const uint8_t bc = chip.bunchCounter++;
+	if(pixels.empty()) {
+		out.push_back(0xe0 | chip.id);
+		out.push_back(bc);
+	}
+	else {
+		// (dcol << 10 | address) sorts in readout order, regions being 16 double columns each
+		for(auto& pixel : pixels) {
+			const uint32_t row = pixel / N_COLS, col = pixel % N_COLS;
+			pixel = (col / 2) << 10 | fAddress[row][col & 1];
+		}
+		sort(pixels.begin(), pixels.end());
+		pixels.erase(unique(pixels.begin(), pixels.end()), pixels.end());
+
+		out.push_back(0xa0 | chip.id);
+		out.push_back(bc);
+		int region = -1;
+		for(size_t i=0; i<pixels.size();) {
+			const uint32_t dcol = pixels[i] >> 10, address = pixels[i] & 0x3ff;
+			if((int)(dcol / common::NDCOL_PER_REGION) != region) {
+				region = dcol / common::NDCOL_PER_REGION;
+				out.push_back(0xc0 | region);
+			}
+			const uint32_t encoder = dcol % common::NDCOL_PER_REGION;
+			uint8_t hitmap = 0;
+			size_t j = i + 1;
+			for(; j<pixels.size() && (pixels[j] >> 10) == dcol && (pixels[j] & 0x3ff) - address <= 7; ++j) {
+				hitmap |= 1 << ((pixels[j] & 0x3ff) - address - 1);
+			}
+			const uint16_t field = encoder << 10 | address;
+			out.push_back((hitmap ? 0x00 : 0x40) | field >> 8);
+			out.push_back(field & 0xff);
+			if(hitmap) out.push_back(hitmap);
+			i = j;
+		}
+		out.push_back(0xb0);
+	}
+	out.insert(out.end(), fConfig.idleBytes, 0xff);
+}
+
+int R3BSimBackend::ReadEventData(int& nBytes, unsigned char* buffer) {
+	if(fConfig.readLatency) usleep(fConfig.readLatency);
+	if(fEvents.empty()) {
+		nBytes = 0;
+		return 0; // like a readout timeout
+	}
+	Event& ev = fEvents.front();
+	nBytes = ev.data.size();
+	copy(ev.data.begin(), ev.data.end(), buffer);
+	const int flag = ev.flag;
+	fSpare.push_back(std::move(ev.data));
+	fEvents.pop_front();
+	return flag;
+}
+
+float R3BSimBackend::GetThreshold(int chipId, int row, int col) const {
+	const Chip* chip = FindChip(chipId);
+	return chip ? chip->threshold[row * N_COLS + col] : 0.f;
+}
+
+float R3BSimBackend::GetNoise(int chipId, int row, int col) const {
+	const Chip* chip = FindChip(chipId);
+	return chip ? chip->noise[row * N_COLS + col] : 0.f;
+}
@@ -0,0 +1,100 @@
+#ifndef R3B_SIMBACKEND_H
+#define R3B_SIMBACKEND_H
+
+/* >> Simulated MOSAIC board with ALPIDE chips, for running scans off the detector
+ * Every pixel gets a gaussian threshold and noise (both in charge DAC units) at
+ * construction. A Trigger() injects VPULSEH - VPULSEL into every pixel with
+ * PULSE_ENABLE set and MASK_ENABLE cleared; the pixel fires with probability
+ *   0.5 * erfc((threshold - charge) / (sqrt(2) * noise))
+ * and unmasked pixels give fake hits at fakeHitRate per trigger on top.
+ * Each trigger queues a trigger recorder event (optional) and one event per
+ * chip, encoded like the chip sends it: chip header, region headers,
+ * DATASHORT / DATALONG words, trailer (or an empty frame), then IDLE bytes.
+ * ReadEventData() hands the queued events out one by one, flagged like MOSAIC
+ * flags them, and returns 0 (timeout) once they're all read: use burst mode. */
+
+#include "R3BScanBackend.h"
+#include <vector>
+#include <deque>
+#include <random>
+#include <unordered_map>
+#include <stdint.h>
+
+class R3BSimBackend : public R3BScanBackend {
+public:
+	static const int N_ROWS = 512;
+	static const int N_COLS = 1024;
+	static const int DATA_EVENT = 1;        // ReadEventData() flag of a chip event with hits
+	static const uint16_t VPULSEH = 170;    // VPULSEH register at power-up
+
+	struct Config {
+		std::vector<int> chipIds = {0};
+		float thresholdMean = 10.f;   // DAC
+		float thresholdRMS  = 1.5f;
+		float noiseMean     = 0.5f;   // DAC, width of the S-curve
+		float noiseRMS      = 0.1f;
+		double fakeHitRate  = 1e-6;   // per unmasked pixel and trigger
+		bool triggerRecords = true;   // trigger recorder event ahead of each trigger's chip events
+		unsigned idleBytes  = 3;      // IDLE bytes after each chip event
+		unsigned triggerLatency = 0;  // us per Trigger() call
+		unsigned readLatency    = 0;  // us per ReadEventData() call
+		uint32_t seed = 1;
+	};
+
+private:
+	struct Chip {
+		int id;
+		std::unordered_map<int, uint16_t> registers;
+		std::vector<uint64_t> mask;  // [row][col/64], bit set = masked
+		std::vector<uint64_t> pulse; // [row][col/64], bit set = pulsed
+		std::vector<float> threshold; // [row][col]
+		std::vector<float> noise;
+		uint8_t bunchCounter;
+	};
+	struct Event {
+		int flag;
+		std::vector<unsigned char> data;
+	};
+
+	Config fConfig;
+	std::vector<Chip> fChips;
+	std::deque<Event> fEvents;
+	std::vector<std::vector<unsigned char>> fSpare; // recycled event buffers
+	std::mt19937_64 fRng;
+	bool fRunning;
+	uint64_t fNTriggers;
+	uint64_t fNHits;
+
+	// address inside a double column, indexed [row][col & 1]
+	uint16_t fAddress[N_ROWS][2];
+
+public:
+	R3BSimBackend();
+	R3BSimBackend(const Config& config);
+
+	bool IsValidChipId(int chipId) override;
+	int ReadRegister(int chipId, AlpideRegister reg, uint16_t& value) override;
+	int WriteRegister(int chipId, AlpideRegister reg, uint16_t value) override;
+	void WritePixRegAll(int chipId, AlpidePixConfigReg reg, bool value) override;
+	void WritePixRegRow(int chipId, AlpidePixConfigReg reg, bool value, int row) override;
+	void WritePixRegSingle(int chipId, AlpidePixConfigReg reg, bool value, int row, int col) override;
+	void StartRun() override;
+	void StopRun() override;
+	int Trigger(int nTriggers) override;
+	int ReadEventData(int& nBytes, unsigned char* buffer) override;
+
+	inline const Config& GetConfig() const {return fConfig;}
+	inline uint64_t GetNTriggers() const {return fNTriggers;}
+	inline uint64_t GetNHits() const {return fNHits;}
+	// simulated threshold / noise of a pixel, to compare the scan result against
+	float GetThreshold(int chipId, int row, int col) const;
+	float GetNoise(int chipId, int row, int col) const;
+
+private:
+	Chip* FindChip(int chipId);
+	const Chip* FindChip(int chipId) const;
+	std::vector<uint64_t>* GetPixReg(Chip& chip, AlpidePixConfigReg reg);
+	void Encode(Chip& chip, std::vector<uint32_t>& pixels, std::vector<unsigned char>& out);
+};
+
+#endif
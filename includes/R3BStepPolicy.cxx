@@ -0,0 +1,81 @@
+#include "R3BStepPolicy.h"
+#include <algorithm>
+
+using namespace std;
+
+R3BUniformSweep::R3BUniformSweep(int saturatedSteps) :
+	fNSteps(0),
+	fNext(0),
+	fSaturatedSteps(saturatedSteps > 0 ? saturatedSteps : 0),
+	fNSaturated(0) {}
+
+void R3BUniformSweep::BeginStage(int nSteps) {
+	fNSteps = nSteps;
+	fNext = 0;
+	fNSaturated = 0;
+}
+
+int R3BUniformSweep::NextStep() {
+	if(fNext >= fNSteps) return -1;
+	if(fSaturatedSteps > 0 && fNSaturated >= fSaturatedSteps) return -1;
+	return fNext++;
+}
+
+void R3BUniformSweep::Feedback(int, uint64_t nHits, uint64_t nExpected) {
+	if(nExpected > 0 && nHits >= nExpected) ++fNSaturated;
+	else fNSaturated = 0;
+}
+
+R3BAdaptiveSweep::R3BAdaptiveSweep(int coarseStride, int saturatedSteps) :
+	fCoarseStride(coarseStride > 0 ? coarseStride : 1),
+	fSaturatedSteps(saturatedSteps > 0 ? saturatedSteps : 0),
+	fNSaturated(0),
+	fRefining(false) {}
+
+void R3BAdaptiveSweep::BeginStage(int nSteps) {
+	fResponse.assign(nSteps > 0 ? nSteps : 0, kNOT_INJECTED);
+	fPending.clear();
+	fNSaturated = 0;
+	fRefining = false;
+	if(nSteps <= 0) return;
+	// the last step is always part of the coarse pass, so the range is bracketed
+	fPending.push_back(nSteps-1);
+	for(int step = ((nSteps-2) / fCoarseStride) * fCoarseStride; step >= 0; step -= fCoarseStride) fPending.push_back(step);
+}
+
+int R3BAdaptiveSweep::NextStep() {
+	if(fPending.empty() && !fRefining) {
+		fRefining = true;
+		Refine();
+	}
+	if(fPending.empty()) return -1;
+	const int step = fPending.back();
+	fPending.pop_back();
+	return step;
+}
+
+void R3BAdaptiveSweep::Feedback(int step, uint64_t nHits, uint64_t nExpected) {
+	if(step < 0 || step >= (int)fResponse.size()) return;
+	if(nHits == 0) fResponse[step] = kNONE;
+	else if(nExpected > 0 && nHits >= nExpected) fResponse[step] = kSATURATED;
+	else fResponse[step] = kPARTIAL;
+
+	if(fRefining) return;
+	fNSaturated = fResponse[step] == kSATURATED ? fNSaturated + 1 : 0;
+	// the rest of the coarse pass would only see 100% too
+	if(fSaturatedSteps > 0 && fNSaturated >= fSaturatedSteps) fPending.clear();
+}
+
+/* Fill in the fine steps between neighbouring coarse steps unless both are flat */
+void R3BAdaptiveSweep::Refine() {
+	int prev = -1;
+	for(int step=0; step<(int)fResponse.size(); ++step) {
+		if(fResponse[step] == kNOT_INJECTED) continue;
+		if(prev >= 0 && step - prev > 1) {
+			const bool flat = fResponse[prev] == fResponse[step] && fResponse[step] != kPARTIAL;
+			if(!flat) for(int fine = prev+1; fine < step; ++fine) fPending.push_back(fine);
+		}
+		prev = step;
+	}
+	reverse(fPending.begin(), fPending.end()); // NextStep() pops from the back: ascending charge
+}
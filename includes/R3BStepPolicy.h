@@ -0,0 +1,83 @@
+#ifndef R3B_STEPPOLICY_H
+#define R3B_STEPPOLICY_H
+
+/* >> Order of the charge steps injected at each scan stage
+ * Steps are indices into the fine grid chargeStart + i*chargeStep, i in [0, nSteps).
+ * A policy hands out the next step to inject until it returns -1; policies which
+ * need to see the response get, after every step, the number of hits of the
+ * pulsed pixels and the number there would be if all of them fired every time. */
+
+#include <vector>
+#include <stdint.h>
+
+class R3BStepPolicy {
+public:
+	virtual ~R3BStepPolicy() {}
+
+	virtual const char* GetName() const = 0;
+	// Feedback() is only called if true, the scan then has to count hits itself
+	virtual bool NeedsFeedback() const {return false;}
+
+	virtual void BeginStage(int nSteps) = 0;
+	// next step to inject, -1 when the stage is done
+	virtual int NextStep() = 0;
+	virtual void Feedback(int step, uint64_t nHits, uint64_t nExpected) {(void)step; (void)nHits; (void)nExpected;}
+};
+
+/* Every step in order, the reference. With saturatedSteps > 0 the stage ends
+ * once that many consecutive steps had every pulsed pixel fire every time. */
+class R3BUniformSweep : public R3BStepPolicy {
+	int fNSteps;
+	int fNext;
+	int fSaturatedSteps;
+	int fNSaturated; // consecutive saturated steps so far
+
+public:
+	R3BUniformSweep(int saturatedSteps = 0);
+
+	const char* GetName() const override {return "uniform";}
+	bool NeedsFeedback() const override {return fSaturatedSteps > 0;}
+	void BeginStage(int nSteps) override;
+	int NextStep() override;
+	void Feedback(int step, uint64_t nHits, uint64_t nExpected) override;
+};
+
+/* Coarse to fine: every coarseStride-th step first, stopping early once
+ * saturatedSteps consecutive coarse steps are saturated. Then only the steps
+ * between two coarse steps whose response differs from "no pixel fired" on
+ * both ends or "every pixel always fired" on both ends, i.e. around the
+ * turn-on of some pixel. Steps at flat 0% or 100% are never refined. */
+class R3BAdaptiveSweep : public R3BStepPolicy {
+public:
+	static const int COARSE_STRIDE   = 4;
+	static const int SATURATED_STEPS = 3;
+
+private:
+	enum Response : int8_t {
+		kNOT_INJECTED = -1,
+		kNONE,      // no hit at all
+		kPARTIAL,
+		kSATURATED  // nHits == nExpected
+	};
+
+	int fCoarseStride;
+	int fSaturatedSteps;
+	int fNSaturated;
+	bool fRefining;
+	std::vector<int8_t> fResponse; // per step
+	std::vector<int> fPending;     // steps still to inject, back() first
+
+public:
+	R3BAdaptiveSweep(int coarseStride = COARSE_STRIDE, int saturatedSteps = SATURATED_STEPS);
+
+	const char* GetName() const override {return "adaptive";}
+	bool NeedsFeedback() const override {return true;}
+	void BeginStage(int nSteps) override;
+	int NextStep() override;
+	void Feedback(int step, uint64_t nHits, uint64_t nExpected) override;
+
+private:
+	void Refine();
+};
+
+#endif
@@ -1,20 +1,29 @@
 #include "R3BStorePixHit.h"
 #include "R3BPixHit.h"
 #include "R3BAlpideDecoder.h"
+#include "R3BHitBuffer.h"
+#include "R3BScanJournal.h"
 #include "Common.h"
 #include <stdexcept>
 #include <iostream>
 #include <climits>
+#include <cstdio>
+#include <future>
 #include <string.h>
+#include "TROOT.h"
 #include "TFile.h"
 #include "TTree.h"
 using namespace std;
 
-R3BStorePixHit::R3BStorePixHit() : 
+R3BStorePixHit::R3BStorePixHit() :
 	fTree(nullptr),
 	fFile(nullptr),
 	fSuccessfulInit(false),
-	fNEntriesAutoSave(10000) {
+	fNEntriesAutoSave(10000),
+	fAppendEntries(-1),
+	fCurrent(nullptr),
+	fClosed(false),
+	fTerminated(false) {
 		fData.boardIndex = UINT_MAX;
 		fData.chipId = UINT_MAX;
 		fData.row = 0;
@@ -24,8 +33,11 @@ R3BStorePixHit::R3BStorePixHit() :
 	}
 
 R3BStorePixHit::~R3BStorePixHit() {
-	if(fFile) delete fFile;
-    if(fTree) delete fTree;
+	if(fWriter.joinable()) {
+		if(!fTerminated) Submit(Command::kCLOSE);
+		fWriter.join();
+	}
+	if(fFile) delete fFile; // owns fTree
 }
 
 void R3BStorePixHit::SetCyclicAutoSave(long nEntries) {
@@ -33,20 +45,80 @@ void R3BStorePixHit::SetCyclicAutoSave(long nEntries) {
     fNEntriesAutoSave = nEntries;
 }
 
+void R3BStorePixHit::AddColumn(const char* name, const int* src, int basketSize) {
+	if(fSuccessfulInit) throw runtime_error("R3BStorePixHit::AddColumn() - columns are added before Init().");
+	fColumns.push_back(Column{name, src, 0, basketSize});
+}
+
 void R3BStorePixHit::Init() {
     if(fOutFileName.empty())  {
         throw runtime_error("R3BStorePixHit::Init() - empty output name! Please use SetFileName() first.");
     }
+	if(!fSettings.queueDepth) {
+		fSuccessfulInit = Open();
+		return;
+	}
+	/* the file is opened, filled and closed on the writer thread */
+	if(fWriter.joinable()) return;
+	ROOT::EnableThreadSafety();
+	fQueue.reset(new R3BSPSCRing<Batch*>(fSettings.queueDepth));
+	fFree.reset(new R3BSPSCRing<Batch*>(fQueue->Capacity()));
+	for(size_t i=0; i<fQueue->Capacity(); ++i) {
+		fPool.emplace_back(new Batch());
+		fPool.back()->entries.reserve(BATCH_HITS);
+		fFree->Push(fPool.back().get());
+	}
+	promise<bool> opened;
+	future<bool> ok = opened.get_future();
+	fWriter = thread([this, &opened]() {
+		const bool ok = Open();
+		opened.set_value(ok);
+		if(ok) WriterLoop();
+		else fClosed.store(true, memory_order_release);
+	});
+	fSuccessfulInit = ok.get();
+	if(!fSuccessfulInit) {
+		fWriter.join();
+		fQueue.reset();
+		fFree.reset();
+		fPool.clear();
+	}
+}
+
+/* File and TTree, on the thread that fills them */
+bool R3BStorePixHit::Open() {
     if(!fFile || fFile->IsZombie()) {
         try {
-			fFile = new TFile(fOutFileName.c_str(), "RECREATE");
+			fFile = new TFile(fOutFileName.c_str(), fAppendEntries >= 0 ? "UPDATE" : "RECREATE");
+			if(fSettings.compression >= 0) fFile->SetCompressionSettings(fSettings.compression);
 		}
 		catch(exception& msg) {
             cerr << msg.what() << endl;
             exit(EXIT_FAILURE);
         }
+		if(fFile->IsZombie()) {
+			cerr << "R3BStorePixHit::Init() - cannot open " << fOutFileName << endl;
+			return false;
+		}
     }
 	/* The object completely owns the fTree and fFile memory */
+    if(!fTree && fAppendEntries >= 0) {
+        if(!R3BScanJournal::ReopenTree(fFile, "PixTree", fAppendEntries, fTree)) return false;
+        if(fTree) {
+            fTree->SetBranchAddress("T_HI", &fData.thi);
+            fTree->SetBranchAddress("T_LO", &fData.tlo);
+            fTree->SetBranchAddress("CHIP_ID", &fData.chipId);
+            fTree->SetBranchAddress("ROW", &fData.row);
+            fTree->SetBranchAddress("COL", &fData.col);
+            for(Column& c : fColumns) {
+                if(fTree->GetBranch(c.name.c_str())) fTree->SetBranchAddress(c.name.c_str(), &c.value);
+                else fTree->Branch(c.name.c_str(), &c.value, c.basketSize);
+            }
+            fTree->SetAutoSave(fNEntriesAutoSave);
+            if(fSettings.autoFlush) fTree->SetAutoFlush(fSettings.autoFlush);
+            fTree->SetImplicitMT(true);
+        }
+    }
     if(!fTree) {
         fTree = new TTree("PixTree", "PixTree");
 		fTree->Branch("T_HI", &fData.thi);
@@ -54,16 +126,108 @@ void R3BStorePixHit::Init() {
 		fTree->Branch("CHIP_ID", &fData.chipId);
 		fTree->Branch("ROW", &fData.row);
 		fTree->Branch("COL", &fData.col);
+		for(Column& c : fColumns) fTree->Branch(c.name.c_str(), &c.value, c.basketSize);
+		if(fSettings.basketSize > 0) fTree->SetBasketSize("*", fSettings.basketSize);
         fTree->SetAutoSave(fNEntriesAutoSave); // flush the TTree to disk every N entries
+        if(fSettings.autoFlush) fTree->SetAutoFlush(fSettings.autoFlush);
         fTree->SetDirectory(fFile);
         fTree->SetImplicitMT(true);
     }
-    fSuccessfulInit = true;
+    return true;
+}
+
+void R3BStorePixHit::TakeColumns() {
+	for(Column& c : fColumns) c.value = *c.src;
+}
+
+/* Hands the current batch to the writer, or a command after it */
+void R3BStorePixHit::Submit(Command command) {
+	if(fCurrent && !fCurrent->entries.empty()) {
+		fCurrent->command = Command::kFILL;
+		fQueue->Push(std::move(fCurrent));
+		fCurrent = nullptr;
+	}
+	if(command == Command::kFILL) return;
+	if(!fCurrent) fFree->Pop(fCurrent);
+	fCurrent->command = command;
+	fQueue->Push(std::move(fCurrent));
+	fCurrent = nullptr;
+}
+
+/* the writer stops only on Terminate() or an error */
+void R3BStorePixHit::CheckWriter() const {
+	if(!IsClosed()) return;
+	if(fWriterError) rethrow_exception(fWriterError);
+	throw runtime_error("R3BStorePixHit - " + fOutFileName + " is closed already.");
+}
+
+void R3BStorePixHit::WriterLoop() {
+	for(;;) {
+		Batch* batch;
+		fQueue->Pop(batch);
+		const Command command = batch->command;
+		if(!fWriterError) {
+			try {
+				if(command == Command::kFILL) Write(*batch);
+				else if(command == Command::kCHECKPOINT) {
+					fTree->AutoSave("SaveSelf;FlushBaskets");
+				}
+				else Close();
+			}
+			catch(...) {
+				fWriterError = current_exception(); // the rest is drained unwritten
+			}
+		}
+		if(command == Command::kCHECKPOINT) {
+			if(fWriterError) fCheckpointReply.set_exception(fWriterError);
+			else fCheckpointReply.set_value(fTree->GetEntries());
+		}
+		batch->entries.clear();
+		batch->columns.clear();
+		fFree->Push(std::move(batch));
+		if(command == Command::kCLOSE) break;
+	}
+	fClosed.store(true, memory_order_release);
+}
+
+/* Every entry of a batch has the same extra column values, a new batch starts when they change */
+void R3BStorePixHit::BeginBatchFill() {
+	CheckWriter();
+	fColumnValues.resize(fColumns.size());
+	for(size_t i=0; i<fColumns.size(); ++i) fColumnValues[i] = *fColumns[i].src;
+	if(!fCurrent || fCurrent->entries.empty()) return;
+	for(size_t i=0; i<fColumns.size(); ++i) {
+		if(fCurrent->columns[i] == fColumnValues[i]) continue;
+		Submit(Command::kFILL);
+		return;
+	}
+}
+
+void R3BStorePixHit::Append(uint32_t chipId, uint32_t row, uint32_t col) {
+	if(!fCurrent) fFree->Pop(fCurrent); // blocks while the writer is behind
+	if(fCurrent->entries.empty()) fCurrent->columns = fColumnValues;
+	fCurrent->entries.push_back(Entry{chipId, row, col});
+	if(fCurrent->entries.size() >= BATCH_HITS) Submit(Command::kFILL);
+}
+
+void R3BStorePixHit::Write(const Batch& batch) {
+	for(size_t i=0; i<fColumns.size(); ++i) fColumns[i].value = batch.columns[i];
+	for(const Entry& e : batch.entries) {
+		fData.chipId = e.chipId;
+		fData.row    = e.row;
+		fData.col    = e.col;
+		fTree->Fill();
+	}
 }
 
 void R3BStorePixHit::Fill(const R3BPixHit& hit) {
     if(!IsInitOk())
         throw runtime_error("R3BStorePixHit::Fill() - object not (successfully) initialized! Please use Init() first.");
+    if(IsAsync()) {
+        BeginBatchFill();
+        Append(hit.GetChipId(), hit.GetRow(), hit.GetColumn());
+        return;
+    }
     if(!fFile || fFile->IsZombie()) {
         fSuccessfulInit = false;
         throw runtime_error("R3BStorePixHit::Fill() - no viable output file! Please use Init() first.");
@@ -72,15 +236,29 @@ void R3BStorePixHit::Fill(const R3BPixHit& hit) {
         fSuccessfulInit = false;
         throw runtime_error("R3BStorePixHit::Fill() - no TTree! Please use Init() first.");
     }
+	TakeColumns();
 	SetDataSummary(hit);
 	fTree->Fill();
 }
 
-/* Ideally R3BStorePixHit should move the data from decoder.fHits vector */
-/* Right now, one copy is redundant */
+/* Reads the decoder's hit buffer in place, no copy of the hits is made */
 void R3BStorePixHit::Fill(const R3BAlpideDecoder& decoder) {
+	Fill(decoder.GetHits());
+}
+
+/* With the writer thread the hits are copied into batches */
+void R3BStorePixHit::Fill(const R3BHitBuffer& hits, int chipId, int row) {
 	if(!IsInitOk())
 		throw runtime_error("R3BStorePixHit::Fill() - object not (successfully) initialized! Please use Init() first.");
+	if(IsAsync()) {
+		BeginBatchFill();
+		for(size_t i=0; i<hits.Size(); ++i) {
+			if(chipId >= 0 && static_cast<int>(hits.GetChipId(i)) != chipId) continue;
+			if(row >= 0 && static_cast<int>(hits.GetRow(i)) != row) continue;
+			Append(hits.GetChipId(i), hits.GetRow(i), hits.GetColumn(i));
+		}
+		return;
+	}
 	if(!fFile || fFile->IsZombie()) {
         fSuccessfulInit = false;
         throw runtime_error("R3BStorePixHit::Fill() - no viable output file! Please use Init() first.");
@@ -89,23 +267,104 @@ void R3BStorePixHit::Fill(const R3BAlpideDecoder& decoder) {
         fSuccessfulInit = false;
         throw runtime_error("R3BStorePixHit::Fill() - no TTree! Please use Init() first.");
     }
-	for(const auto& hit : decoder.fHits) {
-		SetDataSummary(hit);
+	TakeColumns();
+	for(size_t i=0; i<hits.Size(); ++i) {
+		if(chipId >= 0 && static_cast<int>(hits.GetChipId(i)) != chipId) continue;
+		if(row >= 0 && static_cast<int>(hits.GetRow(i)) != row) continue;
+		SetDataSummary(hits, i);
 		fTree->Fill();
 	}
 }
 
-void R3BStorePixHit::Terminate() {
+long R3BStorePixHit::Checkpoint() {
+	CheckWriter();
+	if(!IsAsync()) {
+		fTree->AutoSave("SaveSelf;FlushBaskets");
+		return fTree->GetEntries();
+	}
+	fCheckpointReply = promise<long>(); // the writer only touches it after the Submit below
+	future<long> reply = fCheckpointReply.get_future();
+	Submit(Command::kCHECKPOINT);
+	return reply.get(); // rethrows a write error
+}
+
+/* Writes and saves the rootfile, the file deletes the TTree. Once only. */
+void R3BStorePixHit::Close() {
+	if(!fTree) return;
     fTree->Write();
 	fFile->Write();
     fFile->Close();
+    fTree = nullptr;
+}
+
+void R3BStorePixHit::Terminate() {
+	if(fTerminated) return;
+	fTerminated = true;
+	if(!IsAsync()) {
+		Close();
+		fClosed.store(true, memory_order_release); // as the writer does
+		return;
+	}
+	Submit(Command::kCLOSE);
+}
+
+void R3BStorePixHit::Wait() {
+	if(!fWriter.joinable()) return;
+	if(!fTerminated) Terminate();
+	fWriter.join();
+	if(fWriterError) rethrow_exception(fWriterError);
+}
+
+R3BStorePixHit::QueueStats R3BStorePixHit::GetQueueStats() const {
+	if(!fQueue) return QueueStats{0, 0, 0, 0., 0, 0};
+	return QueueStats{fQueue->Capacity(), fQueue->Size(), fQueue->GetHighWater(), fQueue->GetMeanOccupancy(),
+		fQueue->GetNPushed(), fFree->GetNEmptyWaits()};
+}
+
+void R3BStorePixHit::PrintQueueStats() const {
+	if(!IsAsync()) return;
+	const QueueStats q = GetQueueStats();
+	printf("R3BStorePixHit : %s, %lu batches to the writer, queue mean %.1f / high water %lu of %lu, %lu waits for the writer\n",
+		fOutFileName.c_str(), (unsigned long)q.nBatches, q.meanOccupancy, (unsigned long)q.highWater,
+		(unsigned long)q.capacity, (unsigned long)q.nFullStalls);
 }
 
 void R3BStorePixHit::SetDataSummary(const R3BPixHit& hit) {
 	/* TODO:
-	 * Implement reader for thi & tlo 
+	 * Implement reader for thi & tlo
 	 * */
     fData.chipId   = hit.GetChipId();
     fData.row	   = hit.GetRow();
     fData.col      = hit.GetColumn();
 }
+
+void R3BStorePixHit::SetDataSummary(const R3BHitBuffer& hits, size_t i) {
+	fData.boardIndex = hits.GetBoardIndex();
+	fData.chipId     = hits.GetChipId(i);
+	fData.row        = hits.GetRow(i);
+	fData.col        = hits.GetColumn(i);
+}
+
+bool ParseStoreCompression(const string& name, int& settings) {
+	const size_t colon = name.find(':');
+	const string algorithm = name.substr(0, colon);
+	int level = algorithm == "zstd" ? 5 : 4;
+	if(colon != string::npos) {
+		try {
+			level = stoi(name.substr(colon + 1));
+		}
+		catch(exception&) {
+			return false;
+		}
+		if(level < 1 || level > 9) return false;
+	}
+	R3BStorePixHit::Compression c;
+	if(algorithm == "lz4") c = R3BStorePixHit::Compression::kLZ4;
+	else if(algorithm == "zstd") c = R3BStorePixHit::Compression::kZSTD;
+	else if(algorithm == "zlib") c = R3BStorePixHit::Compression::kZLIB;
+	else if(algorithm == "lzma") c = R3BStorePixHit::Compression::kLZMA;
+	else if(algorithm == "none") c = R3BStorePixHit::Compression::kNONE;
+	else return false;
+	settings = c == R3BStorePixHit::Compression::kNONE ? 0 : (int)c * 100 + level;
+	return true;
+}
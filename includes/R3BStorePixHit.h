@@ -3,17 +3,30 @@
 
 /* >> Martin Bajzek
  * For each hit pixel, the following information is stored:
- * chip Id, row, column, bunch crossing counter (from chip), trigger 
- * counter (from the readout board). 
- * Only valid hits (i.e. with no bad flag) are stored. See R3BPixHit.h for 
- * the list of bad flags. */
+ * chip Id, row, column, bunch crossing counter (from chip), trigger
+ * counter (from the readout board).
+ * Only valid hits (i.e. with no bad flag) are stored. See R3BPixHit.h for
+ * the list of bad flags.
+ *
+ * With a queue depth > 0 a writer thread owns the TFile: Fill() copies the hits
+ * into a batch and hands full batches over a bounded ring, the TTree is filled,
+ * compressed and written on the writer thread. Terminate() only queues the close,
+ * Wait() or the destructor waits for it. A full ring blocks Fill(), GetQueueStats()
+ * tells how often: the disk is then the limit. */
 
 #include <memory>
 #include <stdint.h>
 #include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <future>
 #include "Common.h"
+#include "R3BSPSCRing.h"
 
 class R3BPixHit;
+class R3BHitBuffer;
 class R3BAlpideDecoder;
 class TTree;
 class TFile;
@@ -32,37 +45,144 @@ public:
         uint32_t tlo;
     } TDataSummary;
 
+	/* ROOT's algorithm numbers, settings are algorithm*100 + level */
+	enum class Compression {
+		kNONE = 0,
+		kZLIB = 1,
+		kLZMA = 2,
+		kLZ4  = 4,
+		kZSTD = 5
+	};
+
+	struct Settings {
+		int compression = -1;  // ROOT compression settings, -1 keeps the file default
+		int basketSize = 0;    // bytes per branch basket, 0 keeps the ROOT default
+		long autoFlush = 0;    // TTree::SetAutoFlush(), 0 keeps the ROOT default
+		size_t queueDepth = 0; // batches in flight to the writer thread, 0 fills on the calling thread
+	};
+
+	struct QueueStats {
+		size_t capacity;
+		size_t size;          // batches waiting for the writer now
+		size_t highWater;
+		double meanOccupancy; // batches waiting, averaged over the hand-overs
+		uint64_t nBatches;
+		uint64_t nFullStalls; // Fill() waited for the writer
+	};
+
+	static const size_t BATCH_HITS = 1 << 14; /* hits per batch handed to the writer */
+
 private:
+	/* extra int column, its value is taken from src at each Fill() */
+	struct Column {
+		std::string name;
+		const int* src;
+		int value; // branch address
+		int basketSize;
+	};
+	enum class Command : uint8_t {
+		kFILL,
+		kCHECKPOINT,
+		kCLOSE
+	};
+	struct Entry {
+		uint32_t chipId;
+		uint32_t row;
+		uint32_t col;
+	};
+	struct Batch {
+		Command command;
+		std::vector<Entry> entries;
+		std::vector<int> columns; // values for all entries of the batch
+	};
+
     TTree* fTree; // the ROOT TTree container
     TFile* fFile; // Output file
 
     bool fSuccessfulInit;     // boolean to monitor the success of the initialization
     long fNEntriesAutoSave;   // max entries in the buffer after which TTree::AutoSave() is automatically used
+    Settings fSettings;
+    long fAppendEntries;      // >= 0: reopen the file and keep that many entries, see SetAppend()
 	TDataSummary fData;       // struct instance whose fields will be branch addresses for TTree
 	std::string fOutFileName; // output file name that will store the TTree
 	std::string fTreeTitle;   // title of the TTree
+	std::vector<Column> fColumns;
+
+	/* writer thread, queueDepth > 0 */
+	std::vector<std::unique_ptr<Batch>> fPool;
+	std::unique_ptr<R3BSPSCRing<Batch*>> fQueue; // Fill()  -> writer
+	std::unique_ptr<R3BSPSCRing<Batch*>> fFree;  // writer -> Fill()
+	Batch* fCurrent;                             // being filled, nullptr until the first hit
+	std::vector<int> fColumnValues;              // the columns at the current Fill(), Column::value is the writer's
+	std::thread fWriter;
+	std::atomic<bool> fClosed;                   // the file is closed, by the writer or a synchronous Terminate()
+	std::promise<long> fCheckpointReply;         // entries stored, set by the writer at kCHECKPOINT
+	std::exception_ptr fWriterError;             // read once fClosed is seen
+	bool fTerminated;
 
 public:
     R3BStorePixHit();
     ~R3BStorePixHit();
 
     // Set the name of the output ROOT TTree file, the TTree title
-    inline void SetFileName(std::string fileName) {fOutFileName = fileName;} 
-    inline void SetFileName(const char* fileName) {fOutFileName = std::string(fileName);} 
+    inline void SetFileName(std::string fileName) {fOutFileName = fileName;}
+    inline void SetFileName(const char* fileName) {fOutFileName = std::string(fileName);}
 
     // Set the number of entries to be used by TTree::AutoSave(), default 10000
     void SetCyclicAutoSave(long nEntries = 10000);
-	
+
+    // Set before Init(): basket size of every branch, file compression (e.g. 404 = LZ4 level 4)
+    inline void SetBasketSize(int bytes) {fSettings.basketSize = bytes;}
+    inline void SetCompression(int settings) {fSettings.compression = settings;}
+    inline void SetCompression(Compression algorithm, int level) {fSettings.compression = algorithm == Compression::kNONE ? 0 : (int)algorithm * 100 + level;}
+    inline void SetAutoFlush(long entries) {fSettings.autoFlush = entries;}
+    // Set before Init(): batches queued for the writer thread, 0 fills on the calling thread
+    inline void SetQueueDepth(size_t batches) {fSettings.queueDepth = batches;}
+    inline void SetSettings(const Settings& settings) {fSettings = settings;}
+    inline const Settings& GetSettings() const {return fSettings;}
+    // Set before Init(): append to the TTree of an existing file after its first nEntries entries, -1 recreates the file
+    inline void SetAppend(long nEntries) {fAppendEntries = nEntries;}
+    inline const std::string& GetFileName() const {return fOutFileName;}
+
+    // Set before Init(): extra int column, e.g. the injected charge, *src is read at each Fill()
+    void AddColumn(const char* name, const int* src, int basketSize = 32000);
+
     void Init();
     inline bool IsInitOk() const {return fSuccessfulInit;}
 
     void Fill(const R3BPixHit& hit);			// fill the ROOT TTree with the information from a hit object
 	void Fill(const R3BAlpideDecoder& decoder); // fill the ROOT TTree with the information from the decoder instance
+	void Fill(const R3BHitBuffer& hits, int chipId = -1, int row = -1); // fill the ROOT TTree with the hits of one decoded event, only of chipId/row if >= 0
 
-    void Terminate(); 
+    // Baskets and TTree header to disk, returns the entries stored so far. Waits for the writer.
+    long Checkpoint();
+    // Writes and closes the file, with a writer thread only queues the close. Later calls do nothing
+    void Terminate();
+    // Joins the writer after Terminate(), rethrows its error
+    void Wait();
+    inline bool IsClosed() const {return fClosed.load(std::memory_order_acquire);}
+
+    inline bool IsAsync() const {return fQueue != nullptr;}
+    inline size_t GetQueueDepth() const {return fQueue ? fQueue->Size() : 0;}
+    QueueStats GetQueueStats() const;
+    void PrintQueueStats() const;
 
 private:
+    bool Open();
+    void Close();
+    void WriterLoop();
+    void CheckWriter() const;
+    void BeginBatchFill();
+    void Append(uint32_t chipId, uint32_t row, uint32_t col);
+    void Write(const Batch& batch);
+    void Submit(Command command);
+    void TakeColumns();
     void SetDataSummary(const R3BPixHit& hit);
+    void SetDataSummary(const R3BHitBuffer& hits, size_t i);
 };
 
+/* lz4, zstd, zlib, lzma or none, with an optional :<level> (default 4 / 5 for zstd),
+ * to ROOT compression settings. false if the name is unknown. */
+bool ParseStoreCompression(const std::string& name, int& settings);
+
 #endif
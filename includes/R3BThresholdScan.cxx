@@ -5,31 +5,74 @@
 #include "R3BThresholdScan.h"
 #include "R3BStorePixHit.h"
 #include "R3BAlpideDecoder.h"
+#include "R3BParallelDecoder.h"
+#include "R3BPixelMask.h"
+#include "R3BSCurveAccumulator.h"
+#include "R3BScanSink.h"
+#include "R3BScanPipeline.h"
+#include "R3BStepPolicy.h"
+#include "R3BRawRecorder.h"
+#include "R3BScanJournal.h"
+#include "R3BLmdWriter.h"
+#include "R3BHitBuffer.h"
+#include "R3BScanBackend.h"
 #include "TFile.h"
 #include "TTree.h"
-#include <cassert>
+#include <stdexcept>
+#include <algorithm>
 
 using namespace std;
 
-#if 0
-#define WRITE_WR
-#endif
-
 R3BThresholdScan::R3BThresholdScan() :
     device(nullptr),
 	board(nullptr),
+	backend(nullptr),
     chargeStart(CHARGE_START),
     chargeStop(CHARGE_STOP),
     nSteps(N_STEPS), 
     nTrigs(N_TRIGS_READOUT),
+    burst(false),
+    nInjections(N_TRIGS_SEND),
+    hitLimit(HIT_LIMIT),
+    outputMode(ScanOutput::kHITS),
+    storeSettings(R3BHitFileSink::DefaultSettings()),
+    pipelined(false),
+    allChips(false),
+    pattern(),
+    stepPolicy(new R3BUniformSweep()),
+    decodeThreads(1),
+    journaled(false),
+    resume(false),
+    streamTransport(StreamTransport::kAUTO),
+    streamPolicy(StreamPolicy::kDROP),
+    stopFlag(nullptr),
+    rowsDone(nullptr),
     fileName("") {}
 
 R3BThresholdScan::R3BThresholdScan(TDevice* device) :
     device(device),
+	board(nullptr),
+	backend(nullptr),
     chargeStart(CHARGE_START),
     chargeStop(CHARGE_STOP),
     nSteps(N_STEPS),
     nTrigs(N_TRIGS_READOUT),
+    burst(false),
+    nInjections(N_TRIGS_SEND),
+    hitLimit(HIT_LIMIT),
+    outputMode(ScanOutput::kHITS),
+    storeSettings(R3BHitFileSink::DefaultSettings()),
+    pipelined(false),
+    allChips(false),
+    pattern(),
+    stepPolicy(new R3BUniformSweep()),
+    decodeThreads(1),
+    journaled(false),
+    resume(false),
+    streamTransport(StreamTransport::kAUTO),
+    streamPolicy(StreamPolicy::kDROP),
+    stopFlag(nullptr),
+    rowsDone(nullptr),
 	fileName("") {
 		int nBoards = device->GetNBoards(false);
 		if(!nBoards) {
@@ -46,10 +89,28 @@ R3BThresholdScan::R3BThresholdScan(TDevice* device) :
 
 R3BThresholdScan::R3BThresholdScan(shared_ptr<TDevice> device) :
     device(device.get()),
+	board(nullptr),
+	backend(nullptr),
     chargeStart(CHARGE_START),
     chargeStop(CHARGE_STOP),
     nSteps(N_STEPS),
     nTrigs(N_TRIGS_READOUT),
+    burst(false),
+    nInjections(N_TRIGS_SEND),
+    hitLimit(HIT_LIMIT),
+    outputMode(ScanOutput::kHITS),
+    storeSettings(R3BHitFileSink::DefaultSettings()),
+    pipelined(false),
+    allChips(false),
+    pattern(),
+    stepPolicy(new R3BUniformSweep()),
+    decodeThreads(1),
+    journaled(false),
+    resume(false),
+    streamTransport(StreamTransport::kAUTO),
+    streamPolicy(StreamPolicy::kDROP),
+    stopFlag(nullptr),
+    rowsDone(nullptr),
 	fileName("") {
 		int nBoards = device->GetNBoards(false);
 		if(!nBoards) {
@@ -64,11 +125,18 @@ R3BThresholdScan::R3BThresholdScan(shared_ptr<TDevice> device) :
 		FindValidChips();
 	}
 
+R3BThresholdScan::~R3BThresholdScan() = default;
+
 void R3BThresholdScan::FindValidChips() {
 	validChips.clear();
-	for(int chipId=0; chipId<12; ++chipId) {
+	R3BScanBackend* hw = GetBackend();
+	if(!hw) {
+		cerr << "R3BThresholdScan::FindValidChips() : no device handle or backend set.\n";
+		return;
+	}
+	for(int chipId=0; chipId<16; ++chipId) { // chip id is 4 bits
 		try {
-			if(device->IsValidChipId(chipId)) validChips.insert(chipId);
+			if(hw->IsValidChipId(chipId)) validChips.insert(chipId);
 		} catch(exception& e) {}
 	}
 	printf("R3BThresholdScan::FindValidChips() : found %d working chips.", validChips.size());
@@ -99,10 +167,40 @@ void R3BThresholdScan::SetChargeParams(int chargeStart, int chargeStop, int nSte
 }
 
 void R3BThresholdScan::SetNTrigs(unsigned nTrigs) {this->nTrigs = (int)nTrigs;}
+void R3BThresholdScan::SetBurst(bool burst, unsigned nInjections) {
+	this->burst = burst;
+	this->nInjections = nInjections > 0 ? (int)nInjections : 1;
+}
+void R3BThresholdScan::SetHitLimit(size_t hitLimit) {this->hitLimit = hitLimit;}
+void R3BThresholdScan::SetDecodeThreads(unsigned nThreads) {decodeThreads = nThreads ? nThreads : 1;}
 
 TDevice* R3BThresholdScan::GetDevice() const { return device; }
 TReadoutBoardMOSAIC* R3BThresholdScan::GetBoard() const { return board; }
+
+void R3BThresholdScan::SetBackend(R3BScanBackend* backend) {
+	this->backend = backend;
+	if(backend) FindValidChips();
+}
+
+R3BScanBackend* R3BThresholdScan::GetBackend() {
+	if(backend) return backend;
+	if(!device || !board) return nullptr;
+	if(!mosaic) mosaic.reset(new R3BMosaicBackend(device, board));
+	else mosaic->Set(device, board); // SetDevice() / SetBoard() may have been called since
+	return mosaic.get();
+}
 string R3BThresholdScan::GetFileName() const { return fileName; }
+
+/* fileName without .root, "scan" when no file name was set */
+string R3BThresholdScan::GetOutputBase() const {
+	string base = fileName.empty() ? string("scan") : fileName;
+	const string ext = ".root";
+	if(base.size() > ext.size() && base.compare(base.size() - ext.size(), ext.size(), ext) == 0)
+		base.erase(base.size() - ext.size());
+	return base;
+}
+
+string R3BThresholdScan::GetOutputName(const string& suffix) const { return GetOutputBase() + suffix + ".root"; }
 tuple<int,int,int> R3BThresholdScan::GetChargeParams() const { return make_tuple(chargeStart, chargeStop, nSteps); }
 
 void R3BThresholdScan::FixParams() {
@@ -117,154 +215,450 @@ void R3BThresholdScan::FixParams() {
 }
 
 void R3BThresholdScan::DeactiveAllChips() {
+	R3B_PROFILE_SCOPE(profile, ScanStage::kPIXCONFIG);
+	R3BScanBackend* hw = GetBackend();
 	for(int chipId : validChips) {
-		device->GetChip(chipId)->WritePixRegAll(AlpidePixConfigReg::MASK_ENABLE, true);
-		device->GetChip(chipId)->WritePixRegAll(AlpidePixConfigReg::PULSE_ENABLE, false);
-	}
-}
-
-void R3BThresholdScan::ActivateNextRow(const int chipId, const int row) {
-    assert((row < MAX_ROWS) && (row >= 0));
-    assert(device->IsValidChipId(chipId));
-
-    /* Mask the previous (i-1)-th row */
-	if(row > 0) {
-		device->GetChip(chipId)->WritePixRegRow(AlpidePixConfigReg::MASK_ENABLE, true, row-1);
-		device->GetChip(chipId)->WritePixRegRow(AlpidePixConfigReg::PULSE_ENABLE, false, row-1);
+		hw->WritePixRegAll(chipId, AlpidePixConfigReg::MASK_ENABLE, true);
+		hw->WritePixRegAll(chipId, AlpidePixConfigReg::PULSE_ENABLE, false);
 	}
-    /* Unmask the i-th row */
-    device->GetChip(chipId)->WritePixRegRow(AlpidePixConfigReg::MASK_ENABLE, false, row);
-    device->GetChip(chipId)->WritePixRegRow(AlpidePixConfigReg::PULSE_ENABLE, true, row);
 }
 
 void R3BThresholdScan::Init() {
-	if(!board) {
+	R3BScanBackend* hw = GetBackend();
+	if(!hw) {
 		cerr << __PRETTY_FUNCTION__ << " , board not initialized!"; abort();
 	}
 	try {
-		board->StartRun();
+		hw->StartRun();
 	}
 	catch(exception& e) {
 		cerr << e.what() << " , in the call to: " << __PRETTY_FUNCTION__ << endl;
 	}
 }
 
+/* Valid hits of the pixels pulsed at this stage, on the chips in chipMask */
+static uint64_t CountPulsedHits(const R3BHitBuffer& hits, const R3BInjectionPattern& pattern, int stage, uint32_t chipMask) {
+	uint64_t n = 0;
+	for(size_t i=0; i<hits.Size(); ++i) {
+		if(hits.GetPixFlag(i) != AlpidePixFlag::kOK || !(chipMask & (1u << hits.GetChipId(i)))) continue;
+		if(pattern.IsPulsed(stage, hits.GetRow(i), hits.GetColumn(i))) ++n;
+	}
+	return n;
+}
+
+void R3BThresholdScan::SetStepPolicy(unique_ptr<R3BStepPolicy> policy) {
+	if(policy) stepPolicy = std::move(policy);
+}
+
 /* Main method, Init() has to be called before Go() */
 bool R3BThresholdScan::Go() {
     int nBytes;
     FixParams();
-
-	unsigned char* tempBuffer = (unsigned char*)malloc(BUFFER_SIZE);
-	R3BAlpideDecoder decoder;
+	R3BScanBackend* hw = GetBackend();
+	if(!hw) {
+		cerr << "bool R3BThresholdScan::Go() - no board or backend set." << endl;
+		return false;
+	}
+	readoutStats = ReadoutStats{0, 0, 0, 0};
+
+	/* hits of the masked pixels are dropped while decoding, see R3BPixelMask */
+	pixelMask.Clear();
+	if(!maskFile.empty()) {
+		if(!pixelMask.Load(maskFile)) {
+			cerr << "bool R3BThresholdScan::Go() - no pixel mask, giving up." << endl;
+			return false;
+		}
+		printf("R3BThresholdScan : %lu pixels masked from %s\n", (unsigned long)pixelMask.Count(), maskFile.c_str());
+	}
 
     int chargeStep = (chargeStop - chargeStart)/nSteps;
-	int chargeInj;
 
-    for(const int chipId : validChips) {
+	/* Rows finished by an earlier run of the same scan are skipped and the outputs reopened.
+	 * The journal is updated on the sink's thread from here on, the stages look at a copy. */
+	const R3BScanJournal::Params journalParams{chargeStart, chargeStep, nSteps, pattern.GetRowsPerStage(),
+		pattern.GetColStride(), static_cast<int>(outputMode), allChips};
+	bool resumed = false;
+	journal.SetFileName(GetOutputBase() + ".journal");
+	if(journaled) {
+		if(resume && journal.Exists()) {
+			if(!journal.Load()) {
+				cerr << "bool R3BThresholdScan::Go() - can't resume from " << journal.GetFileName() << ", not starting over on its outputs." << endl;
+				return false;
+			}
+			if(journal.GetParams() != journalParams) {
+				cerr << "bool R3BThresholdScan::Go() - " << journal.GetFileName() << " was scanned with other parameters, not resuming." << endl;
+				return false;
+			}
+			journal.AddResume();
+			resumed = true;
+			printf("R3BThresholdScan : resuming %s, %d rows done\n", GetOutputBase().c_str(), journal.GetNDone());
+		}
+		else {
+			if(resume) cerr << "bool R3BThresholdScan::Go() - no journal " << journal.GetFileName() << ", starting from the first row." << endl;
+			journal.Clear();
+			journal.SetParams(journalParams);
+		}
+		if(!journal.Commit()) return false;
+	}
+	else journal.Clear();
+	const R3BScanJournal finished(journal);
+	/* files that can't be appended to are continued in <name>_resume<n><ext> */
+	auto continuation = [&](const string& name, const string& ext) {
+		if(!resumed) return name + ext;
+		return name + "_resume" + to_string(journal.GetNResumes()) + ext;
+	};
+
+	/* kSCURVE: all rows of the scan are counted in memory, one entry per row in one file */
+	scurves.reset(new R3BSCurveAccumulator());
+	std::unique_ptr<R3BScanSink> hitSink;
+	R3BScanSink* sink = nullptr;
+	if(outputMode == ScanOutput::kSCURVE) {
+		scurves->SetFileName(GetOutputName("_scurves"));
+		if(resumed) scurves->SetAppend(finished.GetEntries(scurves->GetFileName()));
+		scurves->Init(chargeStart, chargeStep, nSteps+1, pattern.GetColStride());
+		if(!scurves->IsInitOk()) {
+			cerr << "bool R3BThresholdScan::Go() - R3BSCurveAccumulator uninitialized." << endl;
+			return false;
+		}
+		sink = scurves.get();
+	}
+	else if(outputMode == ScanOutput::kLMD) {
+		hitSink.reset(new R3BNullSink());
+		sink = hitSink.get();
+	}
+	else {
+		if(outputMode == ScanOutput::kHITS_CHIP || outputMode == ScanOutput::kHITS_SCAN) {
+			R3BHitFileSink* files = new R3BHitFileSink(GetOutputBase(), outputMode == ScanOutput::kHITS_CHIP ?
+				R3BHitFileSink::Scope::kCHIP : R3BHitFileSink::Scope::kSCAN);
+			files->SetStoreSettings(storeSettings);
+			if(resumed) files->SetResume(&finished);
+			hitSink.reset(files);
+		}
+		else {
+			R3BHitTreeSink* rows = new R3BHitTreeSink(GetOutputBase()); // a row file is complete or written again
+			rows->SetStoreSettings(storeSettings);
+			hitSink.reset(rows);
+		}
+		sink = hitSink.get();
+	}
+
+	/* kLMD: the chip events are the output, decoded only for a step policy that asks for the hits or the stream */
+	std::unique_ptr<R3BLmdWriter> lmd;
+	if(outputMode == ScanOutput::kLMD) {
+		lmd.reset(new R3BLmdWriter());
+		lmd->Open(continuation(GetOutputBase(), ".lmd"));
+		if(pipelined) cerr << "bool R3BThresholdScan::Go() - the LMD output is written on this thread, no pipeline." << endl;
+	}
+
+	/* every buffer read, with the markers, for R3BRawReplay */
+	std::unique_ptr<R3BRawRecorder> recorder;
+	string recordName = recordFile;
+	if(!recordFile.empty()) {
+		const size_t dot = recordFile.find_last_of('.');
+		if(dot != string::npos && recordFile.find('/', dot) == string::npos)
+			recordName = continuation(recordFile.substr(0, dot), recordFile.substr(dot));
+		else recordName = continuation(recordFile, "");
+		recorder.reset(new R3BRawRecorder());
+		recorder->Open(recordName, chargeStart, chargeStep, nSteps+1, pattern.GetColStride());
+	}
+
+	/* a row is done once the outputs have it, the stream has nothing to resume */
+	std::unique_ptr<R3BRawSyncSink> rawSyncSink;
+	std::unique_ptr<R3BJournalSink> journalSink;
+	if(journaled && (lmd || recorder)) {
+		rawSyncSink.reset(new R3BRawSyncSink(*sink, lmd.get(), recorder.get()));
+		sink = rawSyncSink.get();
+	}
+	if(journaled) {
+		journalSink.reset(new R3BJournalSink(*sink, journal));
+		sink = journalSink.get();
+	}
+
+	/* decoded hits also go out to an online consumer while the scan runs */
+	std::unique_ptr<R3BStreamSink> streamSink;
+	std::unique_ptr<R3BTeeSink> teeSink;
+	if(!streamName.empty()) {
+		streamSink.reset(new R3BStreamSink(streamName, streamTransport, streamPolicy));
+		teeSink.reset(new R3BTeeSink(*sink, *streamSink));
+		sink = teeSink.get();
+	}
+
+	/* Serial: read, decode and store one after the other on this thread.
+	 * Pipelined: this thread only drives the board, decoding and storing run on their own threads */
+	std::unique_ptr<unsigned char[]> buffer;
+	std::unique_ptr<R3BScanPipeline> pipeline;
+	R3BParallelDecoder decoder(decodeThreads); // a plain R3BAlpideDecoder with one thread
+	decoder.SetDecodeMode(decodeMode);
+	decoder.SetPixelMask(&pixelMask);
+	unsigned char* tempBuffer = nullptr;
+	/* a step policy reacting to the hits needs them decoded before the next step */
+	const bool feedback = stepPolicy->NeedsFeedback();
+	if(pipelined && feedback) {
+		cerr << "bool R3BThresholdScan::Go() - the " << stepPolicy->GetName() << " step policy needs the hits of each step, decoding on this thread." << endl;
+	}
+	if(pipelined && !feedback && !lmd) {
+		// two raw buffers per decoder thread: one batch decoded while the next one is read
+		const size_t nBuffers = max<size_t>(PIPELINE_BUFFERS, 2 * decodeThreads);
+		pipeline.reset(new R3BScanPipeline(*sink, nBuffers, BUFFER_SIZE, hitLimit, decodeThreads));
+		pipeline->SetDecodeMode(decodeMode);
+		pipeline->SetPixelMask(&pixelMask);
+		pipeline->Start();
+		tempBuffer = pipeline->AcquireBuffer();
+	}
+	else {
+		buffer.reset(new unsigned char[BUFFER_SIZE]); // freed on the error paths too
+		tempBuffer = buffer.get();
+		decoder.SetHitLimit(hitLimit);
+	}
+
+	/* One chip after the other, or every valid chip at once: the same row of all
+	 * of them is pulsed and the hits are told apart by their chip ID */
+	vector<vector<int>> chipGroups;
+	if(allChips) chipGroups.emplace_back(validChips.begin(), validChips.end());
+	else for(const int chipId : validChips) chipGroups.push_back({chipId});
+
+    for(const vector<int>& chips : chipGroups) {
         /* Go over each chip in the device instance */
-        uint16_t vpulseh = 0;
-        device->GetChip(chipId)->ReadRegister(AlpideRegister::VPULSEH, vpulseh, true, true);
-        if(vpulseh==0) vpulseh = TChipConfig::VPULSEH;
+		vector<uint16_t> vpulseh(chips.size(), 0);
+		for(size_t i=0; i<chips.size(); ++i) {
+			R3B_PROFILE_SCOPE(profile, ScanStage::kREGISTER);
+			hw->ReadRegister(chips[i], AlpideRegister::VPULSEH, vpulseh[i]);
+			if(vpulseh[i]==0) vpulseh[i] = TChipConfig::VPULSEH;
+		}
+		const int chipId = chips.size() == 1 ? chips.front() : R3BScanContext::ALL_CHIPS;
+		uint32_t chipMask = 0;
+		for(const int chip : chips) chipMask |= 1u << chip;
+		/* MOSAIC sends one data event per chip and trigger: nTrigs reads for each chip pulsed */
+		const int nReads = nTrigs * static_cast<int>(chips.size());
 
 		DeactiveAllChips();
+		int lastStage = -1; // pulsed last, its pixels are masked by the next Apply()
         
-        for(int row = 0; row < MAX_ROWS; ++row) {
-            /* Mask whole sensor except the area of interest which are rows: 
-             * [stage*nRows, stage*(nRows-1)] */
-            ActivateNextRow(chipId, row);
-			
-			R3BStorePixHit storeHits;
-			
-			/* FIXME rowFileName should be constructed from fileName field */
-			string rowFileName = string("scan") + string("_chip") + to_string(chipId)+ string("_row") + to_string(row)+ string(".root"); 
-			cout << "\n\nrowFileName = " << rowFileName << endl << endl; 
-			storeHits.SetFileName(rowFileName);
-			storeHits.Init();
-			storeHits.fTree->Branch("CHARGE_INJ", &chargeInj);
-
-			if(!storeHits.IsInitOk()) {
-				cerr << "bool R3BThresholdScan::Go() - R3BStorePixHit uninitialized. ChipID = " << chipId << ", Row = " << row << endl;
+        for(int stage = 0; stage < pattern.GetNStages() && !IsStopRequested(); ++stage) {
+            /* Mask whole sensor except the pixels of this stage, see R3BInjectionPattern */
+			const vector<int> rows = pattern.GetRows(stage);
+			const int colPhase = pattern.GetColPhase(stage);
+			/* finished in an earlier run: all column phases of these rows are in the outputs */
+			bool done = finished.GetNDone() > 0;
+			for(size_t i=0; done && i<chips.size(); ++i)
+				for(const int row : rows) done = done && finished.IsDone(chips[i], row);
+			if(done) {
+				if(rowsDone && pattern.IsLastPhase(stage)) *rowsDone += static_cast<int>(chips.size() * rows.size());
 				continue;
 			}
-            for(int step = 0; step <= nSteps; ++step) {   
-				chargeInj = chargeStart + step * chargeStep;
-
-                device->GetChip(chipId)->WriteRegister(AlpideRegister::VPULSEL, vpulseh - chargeInj);
-                board->Trigger(1);
-				
-				for(int n=0; n<nTrigs; ++n) {
-					// First call to TReadoutBoardMOSAIC::ReadEventData should poll trigger data,
-					// which extracts timestamp
-					// Subsequent calls should poll correct chip data (one call per chip) or empty-frame
-
-					int readDataFlag = board->ReadEventData(nBytes, tempBuffer);
+			if(lastStage >= 0 && lastStage != stage-1) DeactiveAllChips(); // skipped past finished stages
+			lastStage = stage;
+			bool rowOk = false;
+			R3B_PROFILE_ROW(profile, chipId, rows.front());
+			for(const int chip : chips) {
+				{
+					R3B_PROFILE_SCOPE(profile, ScanStage::kPIXCONFIG);
+					pattern.Apply(*hw, chip, stage);
+				}
+				for(const int row : rows) {
+					R3BScanContext rowCtx{chip, row, 0, chargeStart, colPhase};
+					if(recorder) recorder->BeginRow(rowCtx);
+					if(pipeline) pipeline->BeginRow(rowCtx);
+					else rowOk = sink->BeginRow(rowCtx) || rowOk;
+				}
+			}
+			/* A row every sink rejected is still pulsed and read, its hits are dropped:
+			 * the pipeline learns the sinks' answer only on its own thread, both modes do the same */
+			if(!pipeline && !rowOk) cerr << "bool R3BThresholdScan::Go() - no sink takes stage " << stage << ", its hits are dropped." << endl;
+
+			R3BScanContext ctx{chipId, rows.size() == 1 ? rows.front() : R3BScanContext::ALL_ROWS, 0, chargeStart, colPhase};
+			/* hits of the pulsed pixels if every one of them fired at every injection */
+			const int nCols = (R3BInjectionPattern::N_COLS - colPhase + pattern.GetColStride() - 1) / pattern.GetColStride();
+			const uint64_t nPulsed = (uint64_t)chips.size() * rows.size() * nCols;
+
+			stepPolicy->BeginStage(nSteps+1);
+            for(int step; (step = stepPolicy->NextStep()) >= 0;) {   
+				ctx.step = step;
+				uint64_t stepHits = 0;
+				ctx.charge = chargeStart + step * chargeStep;
+				const int chargeInj = ctx.charge;
+
+				{
+					R3B_PROFILE_SCOPE(profile, ScanStage::kREGISTER);
+					for(size_t i=0; i<chips.size(); ++i)
+						hw->WriteRegister(chips[i], AlpideRegister::VPULSEL, vpulseh[i] - chargeInj);
+				}
+				/* Burst: all injections in one Trigger(n), then read until every chip has
+				 * answered each of them. Otherwise one injection and a fixed number of reads. */
+				const int nInj = burst ? nInjections : 1;
+				{
+					R3B_PROFILE_SCOPE(profile, ScanStage::kTRIGGER);
+					hw->Trigger(nInj);
+				}
+				readoutStats.nTriggers += nInj;
+				if(recorder) recorder->BeginStep(ctx, nInj);
+				if(pipeline) pipeline->BeginStep(ctx, nInj);
+				else if(rowOk) sink->BeginStep(ctx, nInj);
+
+				// First call to TReadoutBoardMOSAIC::ReadEventData should poll trigger data,
+				// which extracts timestamp
+				// Subsequent calls should poll correct chip data (one call per chip) or empty-frame
+				auto readEvent = [&]() {
+					int readDataFlag;
+					{
+						R3B_PROFILE_SCOPE(profile, ScanStage::kREAD);
+						readDataFlag = hw->ReadEventData(nBytes, tempBuffer);
+					}
 					if(readDataFlag == 0) {
-						cerr << __PRETTY_FUNCTION__ << " : no data.\n";
-						cerr << "ChipID : " << chipId << endl;
-						abort();
+						/* fatal for this board, the caller decides what happens to the others */
+						throw runtime_error(string(__PRETTY_FUNCTION__) + " : no data. ChipID : " + to_string(chipId) + ", Stage : " + to_string(stage));
 					}
-					else if(readDataFlag == MosaicDict::kTRGRECORDER_EVENT) {
+					R3B_PROFILE_COUNT(profile, 1, nBytes, 0);
+					if(recorder) {
+						R3B_PROFILE_SCOPE(profile, ScanStage::kRECORD);
+						recorder->WriteEvent(tempBuffer, nBytes, readDataFlag, ctx);
+					}
+					if(readDataFlag == MosaicDict::kTRGRECORDER_EVENT) {
+						++readoutStats.nTrgRecorder;
+						if(burst) return readDataFlag; // one per trigger, expected
 						cerr << __PRETTY_FUNCTION__ << " : wrong data. Expected chip data, got trigger event. Waiting.\n";
 						cerr << "ChipID    : " << chipId << endl;
-						cerr << "Row       : " << row << endl;
+						cerr << "Stage     : " << stage << endl;
 						cerr << "Charge Inj: " << chargeInj << endl;
 					}
 					else if(readDataFlag == MosaicDict::kEMPTY_EVENT) {
+						++readoutStats.nEmpty;
+						if(burst) return readDataFlag; // the chip saw the trigger, no hits
 						cerr << __PRETTY_FUNCTION__ << " : no data when polling for chip data. Got empty event. Waiting.\n";
 						cerr << "ChipID    : " << chipId << endl;
-						cerr << "Row       : " << row << endl;
+						cerr << "Stage     : " << stage << endl;
 						cerr << "Charge Inj: " << chargeInj << endl;
 					}
-					else {
-						decoder.DecodeEvent(tempBuffer, nBytes);
-						storeHits.Fill(decoder);
+					else if(pipeline) {
+						++readoutStats.nData;
+						pipeline->PushEvent(tempBuffer, nBytes, ctx);
+						tempBuffer = pipeline->AcquireBuffer(); // blocks while the decoder is behind
 					}
-
-#ifdef WRITE_WR
-					// Write WR timestamp first
-					struct timespec tnow;
-
-					//byteswap data 
-					tempBuffer[nBytes-1] = 0xff;
-					while((nBytes & 0x3) != 0) {
-						tempBuffer[nBytes++] = 0xff;
+					else {
+						++readoutStats.nData;
+						auto fill = [&]() {
+							if(!rowOk) return;
+							R3B_PROFILE_COUNT(profile, 0, 0, decoder.GetHits().Size());
+							R3B_PROFILE_SCOPE(profile, ScanStage::kFILL);
+							sink->Fill(decoder.GetHits(), ctx);
+						};
+						if(!lmd || feedback || streamSink) {
+							{
+								R3B_PROFILE_SCOPE(profile, ScanStage::kDECODE);
+								decoder.DecodeEvent(tempBuffer, nBytes);
+							}
+							fill();
+							if(feedback) stepHits += CountPulsedHits(decoder.GetHits(), pattern, stage, chipMask);
+							while(decoder.IsSuspended()) { // hit limit reached, drain and continue
+								{
+									R3B_PROFILE_SCOPE(profile, ScanStage::kDECODE);
+									decoder.ResumeEvent();
+								}
+								fill();
+								if(feedback) stepHits += CountPulsedHits(decoder.GetHits(), pattern, stage, chipMask);
+							}
+						}
+						if(lmd) {
+							/* after decoding: the writer pads tempBuffer */
+							R3B_PROFILE_SCOPE(profile, ScanStage::kRECORD);
+							lmd->WriteEvent(tempBuffer, nBytes, R3BLmdWriter::GetWrTime());
+						}
 					}
-
-					{
-						uint32_t* p = (uint32_t *)&tempBuffer[64];
-						for(int i = 64; i < nBytes; i+=4) {
-							uint32_t val =
-								((*p & 0x000000ff) << 24)
-								| ((*p & 0x0000ff00) <<  8)
-								| ((*p & 0x00ff0000) >>  8)
-								| ((*p & 0xff000000) >> 24);
-							*p = val;
-							p++;
+					return readDataFlag;
+				};
+
+				if(burst) {
+					const int nExpected = nInj * static_cast<int>(chips.size());
+					const int maxReads = 4 * (nExpected + nInj); // chip events plus one trigger record each, with margin
+					int nAccounted = 0;
+					for(int n=0; nAccounted < nExpected; ++n) {
+						if(n == maxReads) {
+							throw runtime_error(string(__PRETTY_FUNCTION__) + " : " + to_string(nAccounted) + " of " + to_string(nExpected)
+								+ " chip events after " + to_string(n) + " reads. ChipID : " + to_string(chipId) + ", Stage : " + to_string(stage));
 						}
+						if(readEvent() != MosaicDict::kTRGRECORDER_EVENT) ++nAccounted;
 					}
-#endif
 				}
+				else {
+					for(int n=0; n<nReads; ++n) readEvent();
+				}
+				if(feedback) stepPolicy->Feedback(step, stepHits, nPulsed * nInj);
             } // end of step loop
 
-			storeHits.Terminate(); // writes and saves the rootfile
-        } // end of row loop
+			if(recorder) recorder->EndRow(ctx);
+			if(pipeline) pipeline->EndRow(ctx);
+			else if(rowOk) {
+				R3B_PROFILE_SCOPE(profile, ScanStage::kCLOSE);
+				sink->EndRow(ctx);
+			}
+			R3B_PROFILE_END_ROW(profile);
+			if(rowsDone && pattern.IsLastPhase(stage)) *rowsDone += static_cast<int>(chips.size() * rows.size());
+        } // end of stage loop
 
-    } // end of chip loop
+    } // end of chip group loop
 
-	free(tempBuffer);
-	return true;
+	if(pipeline) {
+		pipeline->Stop(); // rethrows decoder/sink errors
+		pipeline->PrintStats();
+	}
+	{
+		R3B_PROFILE_SCOPE(profile, ScanStage::kCLOSE);
+		sink->Terminate();
+	}
+	if(lmd) {
+		lmd->Close();
+		printf("R3BThresholdScan : %d events, %lu bytes written to %s\n", lmd->GetNEvents(),
+			(unsigned long)lmd->GetNBytes(), continuation(GetOutputBase(), ".lmd").c_str());
+	}
+	if(recorder) {
+		recorder->Close();
+		printf("R3BThresholdScan : %lu raw records, %lu bytes written to %s\n", (unsigned long)recorder->GetNRecords(),
+			(unsigned long)recorder->GetNBytes(), recordName.c_str());
+	}
+	printf("R3BThresholdScan : %lu injections, %lu trigger records, %lu empty and %lu data chip events\n",
+		(unsigned long)readoutStats.nTriggers, (unsigned long)readoutStats.nTrgRecorder,
+		(unsigned long)readoutStats.nEmpty, (unsigned long)readoutStats.nData);
+	decodeErrors = pipeline ? pipeline->GetDecodeErrors() : decoder.GetErrors();
+	decodeErrors.Print();
+	if(decodeErrors.GetNErrors()) decodeErrors.Write(GetOutputBase() + "_decode_errors.json");
+	profile.Print();
+	return !IsStopRequested();
 }
 
 void R3BThresholdScan::Terminate() {
-	if(!board) return;
+	R3BScanBackend* hw = GetBackend();
+	if(!hw) return;
 	try {
-		board->StopRun(); 	
+		hw->StopRun(); 	
 	}
 	catch(exception& e) {
 		cerr << e.what() << " in function: " << __PRETTY_FUNCTION__ << endl;
 	}
 }
 
+bool R3BThresholdScan::Analyse(SCurveMethod method, unsigned nThreads) {
+	if(!scurves || scurves->GetScannedChips().empty()) {
+		cerr << "bool R3BThresholdScan::Analyse() - no S-curve counts, run Go() with ScanOutput::kSCURVE first." << endl;
+		return false;
+	}
+	R3B_PROFILE_SCOPE(profile, ScanStage::kANALYSE);
+	fitter.SetMethod(method);
+	fitter.SetNThreads(nThreads);
+	fitter.Process(*scurves);
+	fitter.Print();
+	fitter.Write(GetOutputName("_thresholds"));
+	/* dead / inefficient / hot pixels from the same counts, the hot mask is the input of the next scan's SetMaskFile() */
+	R3BPixelClassification classes = scurves->Classify(R3BSCurveAccumulator::PixelCuts(), &pixelMask);
+	classes.hot.Merge(pixelMask); // still masked in the next scan
+	classes.Print();
+	classes.Write(GetOutputBase());
+	return true;
+}
+
+bool R3BThresholdScan::WriteProfile() const {
+	return profile.Write(GetOutputBase() + "_profile.json");
+}
+
 void R3BThresholdScan::Help() {
     /* FIXME */
 }
@@ -3,11 +3,25 @@
 
 #include "Common.h"
 #include "AlpideDictionary.h"
+#include "R3BSCurveFitter.h"
+#include "R3BInjectionPattern.h"
+#include "R3BScanProfile.h"
+#include "R3BDecodeErrors.h"
+#include "R3BAlpideDecoder.h"
+#include "R3BHitStream.h"
+#include "R3BScanJournal.h"
+#include "R3BStorePixHit.h"
 #include <set>
+#include <memory>
+#include <atomic>
 
 class TDevice;
 class TReadoutBoardMOSAIC;
 class R3BAlpideDecoder;
+class R3BSCurveAccumulator;
+class R3BStepPolicy;
+class R3BScanBackend;
+class R3BMosaicBackend;
 
 /* ... I'm not doing sanity checks vs. nullptr ... 
  * Scan doesn't get involved in ownership of the TReadoutBoardMOSAIC object 
@@ -17,9 +31,31 @@ class R3BAlpideDecoder;
  * Each device has a unique TReadoutBoardMOSAIC as it of April 2023.
  * ... If it changes later this needs to be refactored! --Klayze */
 
+/* What Go() writes out:
+ * kHITS      - every decoded hit as a TTree entry, with the injected charge, one file per row
+ * kHITS_CHIP - the same in one file per chip, with the scanned row as a column
+ * kHITS_SCAN - the same in one file for all chips of the scan
+ * kSCURVE    - hit counts per pixel and charge step, see R3BSCurveAccumulator
+ * kLMD       - the chip events undecoded, as the drasi/ucesb chain reads them, see R3BLmdWriter */
+enum class ScanOutput {
+	kHITS,
+	kHITS_CHIP,
+	kHITS_SCAN,
+	kSCURVE,
+	kLMD
+};
+
 class R3BThresholdScan {
 	friend class R3BAlpideDecoder;
 public: 
+	/* What the board returned during the last Go() */
+	struct ReadoutStats {
+		uint64_t nTriggers;    // charge injections sent
+		uint64_t nTrgRecorder; // trigger recorder events
+		uint64_t nEmpty;       // chip events without hits
+		uint64_t nData;        // chip events with data
+	};
+
 	/* default scan params */
     static const int CHARGE_START    = 0;
     static const int CHARGE_STOP     = 100;
@@ -28,12 +64,19 @@ public:
     static const int N_TRIGS_SEND    = 10;
     static const int BUFFER_SIZE     = 1 << 24; /* 16 MB */
     static const int MAX_ROWS        = 512;
+    static const int HIT_LIMIT       = 1 << 16; /* decoded hits held before they're flushed to the output */
+    static const int PIPELINE_BUFFERS = 8;      /* raw buffers in flight in pipelined mode, BUFFER_SIZE each, at least 2 per decoder thread */
 
 private:
     TDevice *device;
     TReadoutBoardMOSAIC* board;
 	std::set<int> validChips;
 
+    /* what Go() drives: set with SetBackend() (e.g. an R3BSimBackend), or
+     * a forwarder to device and board, made on first use */
+    R3BScanBackend* backend;
+    std::unique_ptr<R3BMosaicBackend> mosaic;
+
     /* Name of the file which will store the information */
     std::string fileName;
     
@@ -49,10 +92,76 @@ private:
     /* Sending one software trigger to the device and nTrigs to the readout */
     int nTrigs;
 
+    /* burst mode: nInjections triggers per step in one go, read until every chip answered all of them */
+    bool burst;
+    int nInjections;
+    ReadoutStats readoutStats;
+
+    /* max number of hits the decoder buffers, 0 = unbounded */
+    size_t hitLimit;
+
+    ScanOutput outputMode;
+
+    /* compression, baskets and writer thread queue of the hit files, see R3BHitFileSink::DefaultSettings() */
+    R3BStorePixHit::Settings storeSettings;
+
+    /* readout, decoding and storing on three threads, see R3BScanPipeline.
+     * The sink thread owns the output files: ROOT::EnableThreadSafety() first, once per process */
+    bool pipelined;
+
+    /* pulse the same row of all validChips at once instead of one chip after the other */
+    bool allChips;
+
+    /* pixels pulsed together at each stage, one full row by default */
+    R3BInjectionPattern pattern;
+
+    /* order of the charge steps of each stage, R3BUniformSweep by default */
+    std::unique_ptr<R3BStepPolicy> stepPolicy;
+
+    /* threads decoding the chip events of one buffer side by side, see R3BParallelDecoder */
+    unsigned decodeThreads;
+
+    /* decoder variant, full validation by default, see R3BDecodePolicy */
+    R3BDecodeMode decodeMode;
+
+    /* R3BPixelMask file, hits of its pixels are dropped while decoding if set */
+    std::string maskFile;
+    R3BPixelMask pixelMask; // loaded by Go()
+
+    /* raw buffers of Go() are recorded there if set, see R3BRawRecorder */
+    std::string recordFile;
+
+    /* finished rows to GetOutputBase() + ".journal" after each row if journaled,
+     * resume skips the rows the journal has and appends to the outputs, see R3BScanJournal */
+    bool journaled;
+    bool resume;
+    R3BScanJournal journal;
+
+    /* decoded hits also published under this name while Go() runs if set, see R3BStreamSink */
+    std::string streamName;
+    StreamTransport streamTransport;
+    StreamPolicy streamPolicy;
+
+    /* kSCURVE counts of the last Go(), input of Analyse() */
+    std::unique_ptr<R3BSCurveAccumulator> scurves;
+    R3BSCurveFitter fitter;
+
+    /* time spent per stage of Go() and Analyse(), summed over the object's lifetime */
+    R3BScanProfile profile;
+
+    /* decoding errors of the last Go(), also written to GetOutputBase() + "_decode_errors.json" if any */
+    R3BDecodeErrors decodeErrors;
+
+    /* Shared with the caller when several boards are scanned concurrently:
+     * Go() stops after the current row once *stopFlag is set, and counts finished rows in *rowsDone */
+    const std::atomic<bool>* stopFlag;
+    std::atomic<int>* rowsDone;
+
 public:
     R3BThresholdScan();
     R3BThresholdScan(TDevice* device);
     R3BThresholdScan(std::shared_ptr<TDevice> device);
+    ~R3BThresholdScan();
 	
 	void FindValidChips();
 
@@ -61,26 +170,68 @@ public:
     void SetDevice();
     inline void SetBoard(TReadoutBoardMOSAIC* board) {this->board = board;}
     void SetBoard();
+    /* not owned, replaces device and board for the scan */
+    void SetBackend(R3BScanBackend* backend);
     void SetFileName(const char* fileName);
     void SetChargeParams(int chargeStart=CHARGE_START, int chargeStop=CHARGE_STOP, int nSteps=N_STEPS);
     void SetNTrigs(unsigned nTrigs);
+    void SetBurst(bool burst, unsigned nInjections = N_TRIGS_SEND);
+    void SetHitLimit(size_t hitLimit);
+    void SetDecodeThreads(unsigned nThreads);
+    inline void SetDecodeMode(const R3BDecodeMode& mode) {decodeMode = mode;}
+    inline void SetMaskFile(const std::string& maskFile) {this->maskFile = maskFile;}
+    inline void SetOutputMode(ScanOutput mode) {outputMode = mode;}
+    inline void SetStoreSettings(const R3BStorePixHit::Settings& settings) {storeSettings = settings;}
+    inline const R3BStorePixHit::Settings& GetStoreSettings() const {return storeSettings;}
+    inline void SetPipelined(bool pipelined) {this->pipelined = pipelined;}
+    inline void SetAllChips(bool allChips) {this->allChips = allChips;}
+    inline void SetInjectionPattern(int rowsPerStage, int colStride = 1) {pattern = R3BInjectionPattern(rowsPerStage, colStride);}
+    void SetStepPolicy(std::unique_ptr<R3BStepPolicy> policy);
+    inline void SetRecordFile(const std::string& recordFile) {this->recordFile = recordFile;}
+    inline void SetStream(const std::string& name, StreamTransport transport = StreamTransport::kAUTO, StreamPolicy policy = StreamPolicy::kDROP) {
+        streamName = name;
+        streamTransport = transport;
+        streamPolicy = policy;
+    }
+    inline void SetJournal(bool journaled, bool resume = false) {this->journaled = journaled; this->resume = resume;}
+    inline void SetStopFlag(const std::atomic<bool>* stopFlag) {this->stopFlag = stopFlag;}
+    inline void SetProgressCounter(std::atomic<int>* rowsDone) {this->rowsDone = rowsDone;}
     
      
     TDevice* GetDevice() const;
     TReadoutBoardMOSAIC* GetBoard() const;
+    R3BScanBackend* GetBackend();
     std::string GetFileName() const;
+    std::string GetOutputBase() const;
+    std::string GetOutputName(const std::string& suffix) const;
+    inline ScanOutput GetOutputMode() const {return outputMode;}
+    inline const R3BInjectionPattern& GetInjectionPattern() const {return pattern;}
+    inline bool IsStopRequested() const {return stopFlag && stopFlag->load();}
+    inline int GetNRowsTotal() const {return validChips.size() * MAX_ROWS;}
     std::tuple<int,int,int> GetChargeParams() const;
     int GetNTrigs() const;
+    inline const ReadoutStats& GetReadoutStats() const {return readoutStats;}
+    inline const R3BDecodeErrors& GetDecodeErrors() const {return decodeErrors;}
+    inline const R3BScanJournal& GetJournal() const {return journal;}
 
     void FixParams(); 
 	void DeactiveAllChips();
 
-    void ActivateNextRow(const int chipId, const int row);
-
 	void Init();
+    /* Throws std::runtime_error when the board stops delivering data,
+     * returns false if the scan didn't complete (stop requested) */
     bool Go();
 	void Terminate();
 
+    /* Threshold and noise of every scanned pixel from the kSCURVE counts of Go(),
+     * maps written to GetOutputName("_thresholds"). nThreads = 0 uses all cores */
+    bool Analyse(SCurveMethod method = SCurveMethod::kESTIMATE, unsigned nThreads = 0);
+    inline const R3BSCurveFitter& GetFitter() const {return fitter;}
+
+    inline R3BScanProfile& GetProfile() {return profile;}
+    /* timing report to GetOutputBase() + "_profile.json" */
+    bool WriteProfile() const;
+
     void Help();
 };
 
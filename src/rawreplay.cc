@@ -0,0 +1,125 @@
+#include "CMDLineParser.h"
+#include "R3BRawReplay.h"
+#include "R3BParallelDecoder.h"
+#include "R3BScanSink.h"
+#include "R3BSCurveAccumulator.h"
+#include "R3BSCurveFitter.h"
+#include "R3BPixelMask.h"
+#include "TROOT.h"
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+const std::string _help = 
+"\
+Replays a raw file written by thresholdscan --record, no board needed.\n\
+  --in=<file>      raw file (required)\n\
+  --out=<name>     output file prefix (default: the input name without .raw)\n\
+  --hits=<mode>    hit output files: row, chip (default) or scan, as in thresholdscan\n\
+  --scurve         count hits per pixel and charge, then extract threshold and noise maps\n\
+  --pipeline       decode and store on their own threads\n\
+  --decoders=<n>   decoder threads (default 1): the chips of one buffer side by side,\n\
+                   with --pipeline consecutive buffers too\n\
+  --validation=<v> decoder checks: full (default), counters or none, as in thresholdscan\n\
+  --noclustering   the chips didn't cluster, DATALONG words are unexpected\n\
+  --mask=<file>    drop the hits of the pixels in this R3BPixelMask file, e.g. a\n\
+                   <out>_hot.mask; --scurve writes <out>_{dead,inefficient,hot}.mask\n\
+  --none           decode only, nothing written (decoder throughput)\n\
+";
+
+/* --name=<n> into value, false after the usage if n isn't a whole number in [minValue, maxValue] */
+template<class T>
+static bool ParseNumberArg(const char* name, T& value, long long minValue, long long maxValue, int argc, char** argv) {
+	long long n = 0;
+	const int found = ParseCmdLineNumber(name, n, minValue, maxValue, argc, argv);
+	if(found < 0) {
+		cerr << "--" << name << " expects a whole number from " << minValue << " to " << maxValue << ".\n" << _help << endl;
+		return false;
+	}
+	if(found) value = static_cast<T>(n);
+	return true;
+}
+
+auto main(int argc, char* argv[]) -> int {
+	if(IsCmdArg("h", argc, argv) || IsCmdArg("help", argc, argv)) {
+		cout << _help << endl; return 0;
+	}
+	string inFile;
+	if(!ParseCmdLine("in", inFile, argc, argv)) {
+		cerr << "No input file, use --in=<file>.\n" << _help << endl;
+		return 1;
+	}
+	string outPrefix = inFile;
+	if(outPrefix.size() > 4 && outPrefix.compare(outPrefix.size() - 4, 4, ".raw") == 0) outPrefix.erase(outPrefix.size() - 4);
+	ParseCmdLine("out", outPrefix, argc, argv);
+
+	R3BRawReplay replay;
+	if(!replay.Open(inFile)) return 1;
+	const R3BRawFileHeader& header = replay.GetHeader();
+
+	/* The same sinks as thresholdscan, set up from the parameters stored in the file */
+	unique_ptr<R3BScanSink> sink;
+	R3BSCurveAccumulator* scurves = nullptr;
+	string hitsMode = "chip";
+	ParseCmdLine("hits", hitsMode, argc, argv);
+	if(IsCmdArg("none", argc, argv)) {
+		sink.reset(new R3BNullSink());
+	}
+	else if(IsCmdArg("scurve", argc, argv)) {
+		scurves = new R3BSCurveAccumulator();
+		sink.reset(scurves);
+		scurves->SetFileName(outPrefix + "_scurves.root");
+		scurves->Init(header.chargeStart, header.chargeStep, header.nSteps, header.colStride);
+		if(!scurves->IsInitOk()) return 1;
+	}
+	else if(hitsMode == "row") sink.reset(new R3BHitTreeSink(outPrefix));
+	else if(hitsMode == "chip") sink.reset(new R3BHitFileSink(outPrefix, R3BHitFileSink::Scope::kCHIP));
+	else if(hitsMode == "scan") sink.reset(new R3BHitFileSink(outPrefix, R3BHitFileSink::Scope::kSCAN));
+	else {
+		cerr << "Unknown --hits mode " << hitsMode << ", expected row, chip or scan.\n";
+		return 1;
+	}
+
+	const bool pipelined = IsCmdArg("pipeline", argc, argv);
+	if(pipelined) ROOT::EnableThreadSafety();
+
+	unsigned decodeThreads = 1;
+	if(!ParseNumberArg("decoders", decodeThreads, 0, R3BParallelDecoder::MAX_THREADS, argc, argv)) return 1;
+	R3BDecodeMode decodeMode;
+	string validationArg;
+	if(ParseCmdLine("validation", validationArg, argc, argv) && !ParseDecodeValidation(validationArg, decodeMode.validation)) {
+		cerr << "Unknown --validation " << validationArg << ", expected full, counters or none.\n";
+		return 1;
+	}
+	decodeMode.clustering = !IsCmdArg("noclustering", argc, argv);
+	replay.SetDecodeMode(decodeMode);
+	R3BPixelMask pixelMask;
+	string maskFile;
+	if(ParseCmdLine("mask", maskFile, argc, argv)) {
+		if(!pixelMask.Load(maskFile)) return 1;
+		replay.SetPixelMask(&pixelMask);
+	}
+
+	R3BRawReplay::Stats stats = replay.Run(*sink, pipelined, 1 << 16, max(8u, 2 * decodeThreads), decodeThreads);
+	sink->Terminate();
+
+	printf("rawreplay : %lu records, %lu data / %lu empty / %lu trigger recorder events\n", (unsigned long)stats.nRecords,
+		(unsigned long)stats.nData, (unsigned long)stats.nEmpty, (unsigned long)stats.nTrgRecorder);
+	printf("rawreplay : %.1f MB decoded in %.3f s, %.1f MB/s\n", stats.nDataBytes / 1e6, stats.seconds,
+		stats.seconds > 0. ? stats.nDataBytes / 1e6 / stats.seconds : 0.);
+
+	if(scurves) {
+		R3BSCurveFitter fitter;
+		fitter.Process(*scurves);
+		fitter.Print();
+		fitter.Write(outPrefix + "_thresholds.root");
+		R3BPixelClassification classes = scurves->Classify(R3BSCurveAccumulator::PixelCuts(), &pixelMask);
+		classes.hot.Merge(pixelMask); // still masked in the next replay or scan
+		classes.Print();
+		classes.Write(outPrefix);
+	}
+	return 0;
+}
@@ -1,6 +1,18 @@
 #include "libs.hh"
 #include "CMDLineParser.h"
+#include "R3BThresholdScan.h"
+#include "R3BParallelDecoder.h"
+#include "R3BInjectionPattern.h"
+#include "R3BScanSink.h"
+#include "R3BStepPolicy.h"
+#include "R3BSimBackend.h"
+#include "TROOT.h"
 #include "nlohmann/json.hpp"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <climits>
 
 using json = nlohmann::json;
 using std::chrono::duration_cast;
@@ -13,8 +25,63 @@ using namespace std;
 const std::string _help = 
 "\
 Run with -h flag to print this message.\n\
+  --cfg=<file>     board/chip map (default sensors.json)\n\
+  --out=<name>     output file prefix, the board IP is appended (default scan)\n\
+  --hits=<mode>    hit output files: row (one per chip and row), chip (default)\n\
+                   or scan (one for all chips)\n\
+  --compression=<c>  hit file compression: lz4 (default), zstd, zlib, lzma or none,\n\
+                   with an optional level, e.g. zstd:3 (default 4, zstd 5)\n\
+  --basket=<bytes> basket size of every hit file branch (default 262144)\n\
+  --autoflush=<n>  hit file baskets flushed every n entries (default ROOT's)\n\
+  --writequeue=<n> hit batches in flight to each file's writer thread (default 16),\n\
+                   0 writes on the storing thread\n\
+  --scurve         count hits per pixel and charge instead of storing every hit,\n\
+                   then extract threshold and noise maps\n\
+  -p, --parallel   scan all boards at the same time, one thread per board\n\
+  --rows=<n>       rows pulsed together per stage, spread over the matrix (default 1)\n\
+  --colstride=<k>  pulse every k-th column of those rows per stage (default 1)\n\
+  --burst[=<n>]    send all n injections of a charge step in one trigger burst and\n\
+                   read until every chip answered each of them (default n = 10)\n\
+  --sweep=<mode>   charge steps per stage: uniform (all, default), early (all until\n\
+                   every pulsed pixel fired at each injection of 3 steps in a row)\n\
+                   or adaptive (coarse pass, then fine steps around the turn-on)\n\
+  --record         also write every raw board buffer to <out>_<IP>.raw, see rawreplay\n\
+  --stream[=<t>]   also publish the decoded hits while scanning, for the online monitor:\n\
+                   t = shm (shared memory r3b_hits_<out>_<IP>), socket\n\
+                   (/tmp/r3b_hits_<out>_<IP>.sock) or auto (default, shm if possible)\n\
+  --streampolicy=<p>  drop (default) or block the scan while the consumer is behind\n\
+  --lmd            write the chip events undecoded to <out>_<IP>.lmd, for drasi/ucesb,\n\
+                   with a White Rabbit timestamp each\n\
+  --allchips       pulse all chips of a board at once instead of one after the other\n\
+  --pipeline       decode and store on their own threads while reading out\n\
+  --decoders=<n>   decoder threads (default 1): the chips of one buffer side by side,\n\
+                   with --pipeline consecutive buffers too, 2 x 16 MB raw buffers each\n\
+  --validation=<v> decoder checks: full (default, every word and pixel), counters\n\
+                   (word errors counted only) or none, for calibrated production scans\n\
+  --noclustering   the chips don't cluster, DATALONG words are unexpected\n\
+  --mask=<out>     drop the hits of the pixels an earlier --scurve scan with --out=<out>\n\
+                   found hot, from its <out>_<IP>_hot.mask. --scurve writes\n\
+                   <out>_<IP>_{dead,inefficient,hot}.mask\n\
+  --resume         continue an interrupted scan with the same options: the rows in\n\
+                   <out>_<IP>.journal are skipped and the outputs appended to\n\
+  --sim[=<n>]      scan n simulated chips (default 1) instead of the boards in\n\
+                   --cfg, in burst mode, and report the scan throughput\n\
+  -v               verbose\n\
 ";
 
+/* --name=<n> into value, false after the usage if n isn't a whole number in [minValue, maxValue] */
+template<class T>
+static bool ParseNumberArg(const char* name, T& value, long long minValue, long long maxValue, int argc, char** argv) {
+	long long n = 0;
+	const int found = ParseCmdLineNumber(name, n, minValue, maxValue, argc, argv);
+	if(found < 0) {
+		cerr << "--" << name << " expects a whole number from " << minValue << " to " << maxValue << ".\n" << _help << endl;
+		return false;
+	}
+	if(found) value = static_cast<T>(n);
+	return true;
+}
+
 constexpr int CHARGE_START    = 0;
 constexpr int CHARGE_STOP     = 100;
 constexpr int N_STEPS         = 50;
@@ -49,6 +116,176 @@ DebugVerbosity verbosity = DebugVerbosity::kCHATTY;
 DebugVerbosity verbosity = DebugVerbosity::kQUIET;
 #endif
 
+/* Shared between the board threads: with -p one failing board stops the others after their current row */
+struct BoardProgress {
+	std::string boardIP;
+	std::atomic<int> rowsDone{0};
+	std::atomic<int> rowsTotal{0};
+	std::atomic<bool> finished{false};
+	std::atomic<bool> failed{false};
+	std::string error; // only read once the board thread is done
+};
+
+std::atomic<bool> stopAll{false};
+std::mutex setupMutex; // framework config parsing isn't known to be reentrant
+std::mutex progressMutex;
+std::condition_variable boardFinished; // wakes the progress report early when a board is done
+
+struct ScanOptions {
+	std::string outPrefix = "scan";
+	ScanOutput hits = ScanOutput::kHITS_CHIP;
+	bool scurve = false;
+	bool pipeline = false;
+	bool allChips = false;
+	int rowsPerStage = 1;
+	int colStride = 1;
+	bool burst = false;
+	int nInjections = N_TRIGS_SEND;
+	std::string sweep = "uniform";
+	bool record = false;
+	bool lmd = false;
+	unsigned decodeThreads = 1;
+	R3BDecodeMode decodeMode;
+	std::string maskPrefix; // --out of the scan whose hot pixels are masked
+	bool stream = false;
+	StreamTransport streamTransport = StreamTransport::kAUTO;
+	StreamPolicy streamPolicy = StreamPolicy::kDROP;
+	bool resume = false; // skip the rows the journal of an earlier run has
+	R3BStorePixHit::Settings store = R3BHitFileSink::DefaultSettings();
+	int simChips = 0; // > 0: R3BSimBackend instead of the boards
+};
+
+/* Everything from the command line, for a board or the simulation */
+void ConfigureScan(R3BThresholdScan& scan, const std::string& tag, const ScanOptions& opt) {
+	scan.SetFileName((opt.outPrefix + "_" + tag).c_str());
+	scan.SetOutputMode(opt.scurve ? ScanOutput::kSCURVE : opt.lmd ? ScanOutput::kLMD : opt.hits);
+	scan.SetStoreSettings(opt.store);
+	scan.SetPipelined(opt.pipeline);
+	scan.SetDecodeThreads(opt.decodeThreads);
+	scan.SetDecodeMode(opt.decodeMode);
+	if(!opt.maskPrefix.empty()) scan.SetMaskFile(opt.maskPrefix + "_" + tag + "_hot.mask");
+	scan.SetAllChips(opt.allChips);
+	scan.SetInjectionPattern(opt.rowsPerStage, opt.colStride);
+	scan.SetBurst(opt.burst, opt.nInjections);
+	scan.SetJournal(true, opt.resume);
+	if(opt.sweep == "early") scan.SetStepPolicy(std::unique_ptr<R3BStepPolicy>(new R3BUniformSweep(R3BAdaptiveSweep::SATURATED_STEPS)));
+	else if(opt.sweep == "adaptive") scan.SetStepPolicy(std::unique_ptr<R3BStepPolicy>(new R3BAdaptiveSweep()));
+	if(opt.record) scan.SetRecordFile(scan.GetOutputBase() + ".raw");
+	if(opt.stream) {
+		std::string name = "r3b_hits_" + opt.outPrefix + "_" + tag;
+		std::replace_if(name.begin(), name.end(), [](char c) {return !isalnum(c) && c != '_';}, '_');
+		scan.SetStream(name, opt.streamTransport, opt.streamPolicy);
+	}
+}
+
+/* Setup, scan and output of one board - everything it touches is its own */
+void ScanBoard(const std::string& boardIP, const json& chipData, const ScanOptions& opt, BoardProgress& progress) {
+	auto tSetup = std::chrono::steady_clock::now();
+	TSetup_p s = make_shared<TSetup>();
+	{
+		std::lock_guard<std::mutex> lock(setupMutex);
+		s->ReadConfigFile(CONFIG_PATH "/MASTER.cfg");
+		s->SetDeviceAddress(boardIP.c_str());
+	}
+	s->InitializeSetup();
+	TDevice_p device = s->GetDevice();
+
+	/* Set proper receiverId's */
+	/* Put the json array into (chipId,recId) map */
+	std::unordered_map<int,int> recMap = std::invoke(
+		[&](){
+			unordered_map<int,int> recMap;
+			for(auto& [_k, _chipData] : chipData.items()) {
+				int k = _chipData["chipId"].get<int>();
+				int v = _chipData["recId"].get<int>();
+				recMap.emplace(std::make_pair(k,v));
+			}
+			return recMap;
+		}
+	);
+
+	for(int i=0; i < device->GetNWorkingChips(); ++i) {
+		device->GetChip(i)->ActivateConfigMode();
+		int chipId = device->GetChipId(i);
+		auto config = device->GetChipConfig(i);
+		config->SetParamValue("RECEIVER", recMap[chipId]);
+		
+		device->GetChip(i)->BaseConfig();
+		device->GetChip(i)->ActivateReadoutMode();
+	}
+	
+	/* Device object is built - with proper receiver map */
+	std::string boardTag = boardIP;
+	std::replace(boardTag.begin(), boardTag.end(), '.', '_');
+
+	R3BThresholdScan scan(device);
+	ConfigureScan(scan, boardTag, opt);
+	scan.SetStopFlag(&stopAll);
+	scan.SetProgressCounter(&progress.rowsDone);
+	progress.rowsTotal = scan.GetNRowsTotal();
+	R3B_PROFILE_ADD(scan.GetProfile(), ScanStage::kSETUP, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tSetup).count());
+
+	scan.Init();
+	usleep(500);
+	try {
+		scan.Go();
+	}
+	catch(...) {
+		scan.Terminate();
+		scan.WriteProfile(); // up to the failure
+		throw;
+	}
+	scan.Terminate();
+	if(opt.scurve && !stopAll) scan.Analyse();
+	scan.WriteProfile();
+}
+
+/* The whole scan against simulated chips, see R3BSimBackend */
+int SimScan(const ScanOptions& opt) {
+	R3BSimBackend::Config config;
+	config.chipIds.clear();
+	for(int chipId=0; chipId<opt.simChips; ++chipId) config.chipIds.push_back(chipId);
+	R3BSimBackend sim(config);
+
+	R3BThresholdScan scan;
+	scan.SetBackend(&sim);
+	ConfigureScan(scan, "sim", opt);
+	scan.SetBurst(true, opt.nInjections); // the simulation doesn't answer reads past the last event
+
+	auto t1 = timeNow();
+	scan.Init();
+	try {
+		scan.Go();
+	}
+	catch(exception& e) {
+		scan.Terminate();
+		scan.WriteProfile();
+		cerr << "Simulated scan failed: " << e.what() << endl;
+		return 1;
+	}
+	scan.Terminate();
+	const double dt = duration_cast<milliseconds>(timeNow()-t1).count() * 1e-3;
+	printf("Simulated scan: %d chips, %lu injections, %lu hits in %.1f s (%.0f injections/s, %.3g hits/s)\n",
+		opt.simChips, (unsigned long)sim.GetNTriggers(), (unsigned long)sim.GetNHits(), dt,
+		dt > 0 ? sim.GetNTriggers() / dt : 0., dt > 0 ? sim.GetNHits() / dt : 0.);
+	if(opt.scurve) {
+		scan.Analyse();
+		printf("Simulated thresholds: %.2f +- %.2f DAC, noise %.2f +- %.2f DAC\n", config.thresholdMean,
+			config.thresholdRMS, config.noiseMean, config.noiseRMS);
+	}
+	scan.WriteProfile();
+	return 0;
+}
+
+void PrintProgress(const std::vector<std::unique_ptr<BoardProgress>>& boards) {
+	for(auto& b : boards) {
+		int total = b->rowsTotal;
+		printf("  %-16s %5d / %5d rows%s\n", b->boardIP.c_str(), b->rowsDone.load(), total,
+			b->failed ? " FAILED" : (b->finished ? " done" : ""));
+	}
+	fflush(stdout);
+}
+
 auto main(int argc, char* argv[]) -> int {
 	auto t1 = timeNow();
 
@@ -59,6 +296,79 @@ auto main(int argc, char* argv[]) -> int {
 		verbosity = DebugVerbosity::kCHATTY;
 		printf("Parsed -v flag.\n");
 	}
+	const bool parallel = IsCmdArg("p", argc, argv) || IsCmdArg("parallel", argc, argv);
+	/* once, before any thread: board threads, the pipeline's sink thread and the hit
+	 * file writers each own TFiles */
+	ROOT::EnableThreadSafety();
+
+	ScanOptions opt;
+	opt.scurve = IsCmdArg("scurve", argc, argv);
+	opt.pipeline = IsCmdArg("pipeline", argc, argv);
+	opt.allChips = IsCmdArg("allchips", argc, argv);
+	std::string patternArg;
+	if(!ParseNumberArg("rows", opt.rowsPerStage, 1, MAX_ROWS, argc, argv)
+		|| !ParseNumberArg("colstride", opt.colStride, 1, R3BInjectionPattern::MAX_COL_STRIDE, argc, argv)
+		|| !ParseNumberArg("decoders", opt.decodeThreads, 0, R3BParallelDecoder::MAX_THREADS, argc, argv)) return 1;
+	if(ParseCmdLine("validation", patternArg, argc, argv) && !ParseDecodeValidation(patternArg, opt.decodeMode.validation)) {
+		cerr << "Unknown --validation " << patternArg << ", expected full, counters or none.\n";
+		return 1;
+	}
+	opt.decodeMode.clustering = !IsCmdArg("noclustering", argc, argv);
+	ParseCmdLine("mask", opt.maskPrefix, argc, argv);
+	if(ParseCmdLine("sweep", opt.sweep, argc, argv) && opt.sweep != "uniform" && opt.sweep != "early" && opt.sweep != "adaptive") {
+		cerr << "Unknown --sweep mode " << opt.sweep << ", expected uniform, early or adaptive.\n";
+		return 1;
+	}
+	opt.record = IsCmdArg("record", argc, argv);
+	opt.resume = IsCmdArg("resume", argc, argv);
+	opt.lmd = IsCmdArg("lmd", argc, argv);
+	opt.stream = IsCmdArg("stream", argc, argv);
+	if(ParseCmdLine("stream", patternArg, argc, argv)) {
+		opt.stream = true;
+		if(patternArg == "shm") opt.streamTransport = StreamTransport::kSHM;
+		else if(patternArg == "socket") opt.streamTransport = StreamTransport::kSOCKET;
+		else if(patternArg != "auto") {
+			cerr << "Unknown --stream transport " << patternArg << ", expected shm, socket or auto.\n";
+			return 1;
+		}
+	}
+	if(ParseCmdLine("streampolicy", patternArg, argc, argv)) {
+		if(patternArg == "block") opt.streamPolicy = StreamPolicy::kBLOCK;
+		else if(patternArg != "drop") {
+			cerr << "Unknown --streampolicy " << patternArg << ", expected drop or block.\n";
+			return 1;
+		}
+	}
+	opt.burst = IsCmdArg("burst", argc, argv);
+	if(ParseCmdLine("burst", patternArg, argc, argv)) opt.burst = true;
+	if(!ParseNumberArg("burst", opt.nInjections, 1, INT_MAX, argc, argv)) return 1;
+	if(ParseCmdLine("compression", patternArg, argc, argv) && !ParseStoreCompression(patternArg, opt.store.compression)) {
+		cerr << "Unknown --compression " << patternArg << ", expected lz4, zstd, zlib, lzma or none, with an optional :<level> 1-9.\n";
+		return 1;
+	}
+	if(!ParseNumberArg("basket", opt.store.basketSize, 0, INT_MAX, argc, argv)
+		|| !ParseNumberArg("autoflush", opt.store.autoFlush, LONG_MIN, LONG_MAX, argc, argv)
+		|| !ParseNumberArg("writequeue", opt.store.queueDepth, 0, INT_MAX, argc, argv)) return 1;
+	ParseCmdLine("out", opt.outPrefix, argc, argv);
+	std::string hitsMode;
+	if(ParseCmdLine("hits", hitsMode, argc, argv)) {
+		if(hitsMode == "row") opt.hits = ScanOutput::kHITS;
+		else if(hitsMode == "chip") opt.hits = ScanOutput::kHITS_CHIP;
+		else if(hitsMode == "scan") opt.hits = ScanOutput::kHITS_SCAN;
+		else {
+			cerr << "Unknown --hits mode " << hitsMode << ", expected row, chip or scan.\n";
+			return 1;
+		}
+	}
+
+	if(opt.lmd && opt.scurve) {
+		cerr << "--lmd and --scurve are two output modes, choose one.\n";
+		return 1;
+	}
+
+	if(IsCmdArg("sim", argc, argv)) opt.simChips = 1;
+	if(!ParseNumberArg("sim", opt.simChips, 1, 16, argc, argv)) return 1; // the chip id has 4 bits
+	if(opt.simChips > 0) return SimScan(opt);
 
 	std::string file_name;
 	if(!ParseCmdLine("cfg", file_name, argc, argv)) 
@@ -67,51 +377,69 @@ auto main(int argc, char* argv[]) -> int {
 	std::ifstream f(file_name);
 	json data; f >> data;
 
+	std::vector<std::unique_ptr<BoardProgress>> boards;
+	std::vector<std::pair<std::string, json>> boardData;
 	for(auto& [boardIP, chipData] : data.items()) {
-		TSetup_p s = make_shared<TSetup>();
-		s->ReadConfigFile(CONFIG_PATH "/MASTER.cfg");
-		s->SetDeviceAddress(boardIP.c_str());
-		s->InitializeSetup();
-		TDevice_p device = s->GetDevice();
-
-		/* Set proper receiverId's */
-		/* Put the json array into (chipId,recId) map */
-		std::unordered_map<int,int> recMap = std::invoke(
-			[&](){
-				unordered_map<int,int> recMap;
-				for(auto& [_k, _chipData] : chipData.items()) {
-					int k = _chipData["chipId"].get<int>();
-					int v = _chipData["recId"].get<int>();
-					recMap.emplace(std::make_pair(k,v));
-				}
-				return recMap;
+		boards.emplace_back(new BoardProgress());
+		boards.back()->boardIP = boardIP;
+		boardData.emplace_back(boardIP, chipData);
+	}
+
+	auto runBoard = [&](size_t i) {
+		BoardProgress& progress = *boards[i];
+		try {
+			ScanBoard(boardData[i].first, boardData[i].second, opt, progress);
+		}
+		catch(exception& e) {
+			progress.error = e.what();
+			progress.failed = true;
+			if(parallel) {
+				stopAll = true;
+				cerr << "Board " << progress.boardIP << " failed: " << e.what() << "\nStopping the other boards after their current row.\n";
 			}
-		);
-
-		for(int i=0; i < device->GetNWorkingChips(); ++i) {
-			device->GetChip(i)->ActivateConfigMode();
-			int chipId = device->GetChipId(i);
-			auto config = device->GetChipConfig(i);
-			config->SetParamValue("RECEIVER", recMap[chipId]);
-			
-			device->GetChip(i)->BaseConfig();
-			device->GetChip(i)->ActivateReadoutMode();
+			else cerr << "Board " << progress.boardIP << " failed: " << e.what() << "\nContinuing with the next board.\n";
 		}
-		
-		/* Device object is built - with proper receiver map */
-		TScanConfig_p scan_config = make_shared<TScanConfig>();
-		TDeviceThresholdScan_p main_scan = make_shared<TDeviceThresholdScan>(device, scan_config);
-		
-		main_scan->SetPrefixFilename("threshold_scan_");
-		main_scan->Init();
-		usleep(500);
-		main_scan->Go();
-		main_scan->Terminate();
+		{
+			std::lock_guard<std::mutex> lock(progressMutex);
+			progress.finished = true;
+		}
+		boardFinished.notify_all();
+	};
 
-		main_scan->WriteDataToFile();
+	if(parallel) {
+		std::vector<std::thread> threads;
+		for(size_t i=0; i<boards.size(); ++i) threads.emplace_back(runBoard, i);
+
+		/* Global progress, until every board thread is done */
+		auto allFinished = [&]() {
+			for(auto& b : boards) if(!b->finished) return false;
+			return true;
+		};
+		for(;;) {
+			{
+				std::unique_lock<std::mutex> lock(progressMutex);
+				if(boardFinished.wait_for(lock, seconds(10), allFinished)) break;
+			}
+			cout << "Progress after " << duration_cast<seconds>(timeNow()-t1).count() << "s:\n";
+			PrintProgress(boards);
+		}
+		for(auto& t : threads) t.join();
+	}
+	else {
+		/* a failed board doesn't keep the others from being scanned, it is reported at the end */
+		for(size_t i=0; i<boards.size(); ++i) runBoard(i);
 	}
 
+	int status = 0;
+	for(auto& b : boards) {
+		if(!b->error.empty()) {
+			cerr << "Board " << b->boardIP << " : " << b->error << endl;
+			status = 1;
+		}
+	}
+	PrintProgress(boards);
+
 	auto t2 = timeNow();
     cout << "\nTime taken: " << duration_cast<seconds>(t2-t1).count() << "s\n";
-	return 0;
+	return status;
 }